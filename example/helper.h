@@ -5,9 +5,12 @@
 #include "AsyncOperProcessor.h"
 #include "DeregisterableHandler.h"
 #include "DispatchReactorStoppable.h"
+#include "NameRegistry.h"
 #include "StoppingHandler.h"
 
 #include <iostream>
+#include <map>
+#include <string>
 
 namespace andre::helper
 {
@@ -19,10 +22,7 @@ public:
 		  std::function<void(const std::shared_ptr<MessageData> &)> hfunc) :
 		m_handlerFunc(hfunc)
 	{
-		Handle handle;
-		std::hash<std::string_view> hasher;
-		handle = {hasher(handlestring), 0};
-		addHandle(handle);
+		addHandle({NameRegistry::instance().intern(handlestring), 0});
 	}
 	~Actor()
 	{
@@ -64,6 +64,19 @@ std::unique_ptr<Actor> makeActor(std::string_view handle,
 	return actor;
 }
 
+// идентификатор имени без блокировки NameRegistry: кэш потока
+inline unsigned long long handleID(std::string_view handle)
+{
+	thread_local std::map<std::string, unsigned long long, std::less<>> ids;
+	auto it = ids.find(handle);
+
+	if ( ids.end() == it ) {
+		it = ids.emplace(std::string(handle), NameRegistry::instance().intern(handle)).first;
+	}
+
+	return it->second;
+}
+
 template <typename T>
 void postMessage(T data, std::string_view handle)
 {
@@ -72,8 +85,7 @@ void postMessage(T data, std::string_view handle)
 
 	std::unique_ptr<T> custom = std::make_unique<T>();
 	*custom = data;
-	std::hash<std::string_view> hasher;
-	custom->handle = {hasher(handle), 0};
+	custom->handle = {handleID(handle), 0};
 	auto constData = std::unique_ptr<ConstData>(std::move(custom));
 	AsyncOperProcessor::instance().postMessage(std::make_shared<MessageData>(constData));
 }
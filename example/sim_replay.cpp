@@ -0,0 +1,156 @@
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "SimExecutor.h"
+
+using namespace andre;
+
+// Детерминированный прогон на SimExecutor: три актора передают друг другу
+// счётчик по кругу, пока один и тот же поток сообщений читает журнал.
+// Два прогона с одним зерном дают один и тот же порядок обработки.
+
+namespace
+{
+
+const unsigned long long kRingCommand = 300;
+const unsigned long long kLogCommand = 301;
+const int kActors = 3;
+const int kHops = 200;
+const int kLogRecords = 100;
+
+struct Counter : ConstData
+{
+	int counter = 0;
+};
+
+void post(unsigned long long commandID, unsigned long long messageParam, int counter)
+{
+	std::unique_ptr<Counter> data = std::make_unique<Counter>();
+	data->handle = {commandID, messageParam};
+	data->counter = counter;
+	std::unique_ptr<ConstData> constData(std::move(data));
+
+	AsyncOperProcessor::instance().postMessage(std::make_shared<MessageData>(constData));
+}
+
+int counterOf(const std::shared_ptr<MessageData> &msg)
+{
+	return std::static_pointer_cast<const Counter>(msg->getData())->counter;
+}
+
+class RingActor : public EventHandler
+{
+public:
+	RingActor(int id, std::string &trace) : m_id(id), m_trace(trace)
+	{
+		addHandle({kRingCommand, (unsigned long long)id});
+	}
+
+	void handleEvent(const std::shared_ptr<MessageData> &msg) override
+	{
+		int counter = counterOf(msg);
+		m_trace.push_back(char('a' + m_id));
+
+		if ( counter < kHops ) {
+			post(kRingCommand, (m_id + 1) % kActors, counter + 1);
+		}
+	}
+
+private:
+	int m_id;
+	std::string &m_trace;
+};
+
+class LogReader : public EventHandler
+{
+public:
+	explicit LogReader(std::string &trace) : m_trace(trace)
+	{
+		addHandle({kLogCommand, 0});
+	}
+
+	void handleEvent(const std::shared_ptr<MessageData> &msg) override
+	{
+		// сообщения одного обработчика приходят в порядке отправки
+		if ( counterOf(msg) != m_expected ) {
+			++ m_outOfOrder;
+		}
+		m_expected = counterOf(msg) + 1;
+		m_trace.push_back('L');
+	}
+
+	int getOutOfOrder() const
+	{
+		return m_outOfOrder;
+	}
+
+private:
+	std::string &m_trace;
+	int m_expected = 0;
+	int m_outOfOrder = 0;
+};
+
+// порядок обработки сообщений всеми акторами прогона
+std::string run(unsigned long long seed, int &outOfOrder)
+{
+	std::string trace;
+	SimExecutorConfig config;
+	config.seed = seed;
+	SimExecutor executor(config);
+
+	std::vector< std::unique_ptr<RingActor> > ring;
+
+	// каждый актор на своём реакторе - иначе порядок задают адреса обработчиков
+	for ( int id = 0; id < kActors; ++id ) {
+		ring.push_back(std::make_unique<RingActor>(id, trace));
+		executor.registerHandler(executor.addReactor(), ring.back().get());
+	}
+	LogReader reader(trace);
+	executor.registerHandler(executor.addReactor(), &reader);
+
+	post(kRingCommand, 0, 0);
+
+	for ( int i = 0; i < kLogRecords; ++i ) {
+		post(kLogCommand, 0, i);
+	}
+	executor.schedule(std::chrono::microseconds(50), []() {
+		post(kRingCommand, 1, kHops / 2);
+	});
+	executor.runUntilIdle();
+	outOfOrder = reader.getOutOfOrder();
+
+	for ( const std::unique_ptr<RingActor> &actor : ring ) {
+		AsyncOperProcessor::instance().deregisterHandler(actor.get());
+	}
+	AsyncOperProcessor::instance().deregisterHandler(&reader);
+
+	return trace;
+}
+
+} // namespace
+
+int main()
+{
+	int outOfOrder[3];
+	std::string first = run(42, outOfOrder[0]);
+	std::string replay = run(42, outOfOrder[1]);
+	std::string other = run(7, outOfOrder[2]);
+
+	std::cout << "seed 42: " << first.substr(0, 60) << "..." << std::endl;
+	std::cout << "seed 7:  " << other.substr(0, 60) << "..." << std::endl;
+
+	if ( first != replay ) {
+		std::cout << "replay with the same seed differs" << std::endl;
+		return 1;
+	}
+
+	if ( 0 != outOfOrder[0] + outOfOrder[1] + outOfOrder[2] ) {
+		std::cout << "messages of one handler reordered" << std::endl;
+		return 1;
+	}
+	std::cout << "replay with the same seed is identical" << std::endl;
+
+	return 0;
+}
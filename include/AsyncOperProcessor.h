@@ -1,26 +1,131 @@
 #ifndef ASYNCOPERPROCESSOR_H
 #define ASYNCOPERPROCESSOR_H
 
+#include <cerrno>
+#include <chrono>
+#include <iostream>
+#include <limits>
 #include <map>
 #include <memory>
 #include <vector>
 #include <set>
 #include <sstream>
+#include <typeinfo>
 
 #include "MessageData.h"
 #include "Handle.hpp"
+#include "MailboxPolicy.h"
 
+#include "BlockingExecutor.h"
 #include "EventHandler.h"
 #include "Reactor.h"
+#include "RoutingTable.h"
+#include "ShardGroup.h"
 
-#include "threadsafemap.hpp"
+#include "concurrentmap.hpp"
 #include "atomiccounter.hpp"
+#include "locks.hpp"
 
 #include "andre_global.h"
 
 namespace andre
 {
 
+class MessageJournal;
+
+// Нагрузка обработчика; см. Reactor::setMeasureBusyTime
+struct ANDRESHARED_EXPORT HandlerLoad
+{
+	EventHandler *handler;
+	unsigned long long busyNs;
+	unsigned long long handledCount;
+};
+
+// Снимок нагрузки реактора
+struct ANDRESHARED_EXPORT ReactorLoad
+{
+	size_t reactorID;
+	const std::type_info *type;
+	size_t queueSize;
+	unsigned long long busyNs;
+	unsigned long long handledCount;
+	std::vector<HandlerLoad> handlers;
+};
+
+// Итог остановки одного реактора
+struct ANDRESHARED_EXPORT ReactorDrain
+{
+	size_t reactorID;
+	unsigned long long processed;
+	unsigned long long discarded;
+	bool completed;		// очередь обработана до конца к сроку
+};
+
+// Итог drainAndShutdown
+struct ANDRESHARED_EXPORT DrainReport
+{
+	std::vector<ReactorDrain> reactors;
+	bool completed;		// все реакторы и BlockingExecutor обработали свои очереди
+
+	// сообщения блокирующих обработчиков, не обработанные к сроку
+	// (BlockingExecutor их не отбрасывает - они ещё будут обработаны)
+	size_t blockingPending;
+
+	unsigned long long processed() const
+	{
+		unsigned long long result = 0;
+
+		for ( const ReactorDrain &reactor : reactors ) {
+			result += reactor.processed;
+		}
+		return result;
+	}
+
+	unsigned long long discarded() const
+	{
+		unsigned long long result = 0;
+
+		for ( const ReactorDrain &reactor : reactors ) {
+			result += reactor.discarded;
+		}
+		return result;
+	}
+};
+
+// Получатели сообщений одного Handle, найденные заранее.
+// Отправка через AsyncOperProcessor::postMessage(route, msg) не обращается
+// к таблице маршрутов, пока регистрации не изменились (любые: маршруты
+// общие для всех Handle); после изменения получатели находятся заново.
+// Не потокобезопасен: у каждого отправляющего потока свой Route.
+class ANDRESHARED_EXPORT Route
+{
+	friend class AsyncOperProcessor;
+
+public:
+	explicit Route(const Handle &handle)
+		: m_handle(handle), m_version(0), m_found(false), m_mailbox(nullptr)
+	{
+	}
+
+	const Handle &getHandle() const
+	{
+		return m_handle;
+	}
+
+private:
+	struct Target
+	{
+		std::shared_ptr<Reactor> reactor;	// nullptr - реактор остановлен
+		size_t reactorID;
+		EventHandler *handler;
+	};
+
+	Handle m_handle;
+	unsigned long long m_version;	// 0 - ещё не найдены
+	bool m_found;
+	MailboxState *m_mailbox;
+	std::vector<Target> m_targets;
+};
 
 // Основной класс для межреакторного взаимодействия. 
 // Процессор асинхронных операций.
@@ -50,6 +155,7 @@ public:
 	};
 
 	friend class StartReactorDispatcher;
+	friend class Reactor;
 
 	static AsyncOperProcessor &instance()
 	{
@@ -60,7 +166,18 @@ public:
 	// останавливает и удаляет ReactorDispatcher из межреакторного взаимодействия
 	void shutdownReactorDispatcher();
 	
-	// регистрирует класс(EventHandler), реагирующий на определенные сообщения
+	// Подключает реактор, у которого нет собственного потока (см. SimExecutor).
+	// threadID - ключ вместо идентификатора потока: обработчики регистрируются
+	// на реактор через registerHandler(handler, threadID). auxInit не вызывается.
+	// Возвращает ID реактора.
+	size_t attachReactor(const std::shared_ptr<Reactor> &reactor, size_t threadID);
+	
+	// отключает реактор, подключённый attachReactor, и удаляет его маршруты
+	void detachReactor(size_t threadID);
+	
+	// регистрирует класс(EventHandler), реагирующий на определенные сообщения;
+	// false - обработчик дерегистрируется, отклонил регистрацию (canRegister)
+	// или реактор потока не создан (Reactor::getInitError, errno - причина)
 	template<typename ReactorType>
 	bool registerHandler(EventHandler *handler)
 	{
@@ -71,22 +188,46 @@ public:
 			return false;
 		}
 		multithread::AtomicCounter ac(handler->m_registeringThreadsCounter);
-		if (handler->m_deregistering)
+		if ( handler->m_deregistering || ! handler->canRegister() )
 		{
 			return false;
 		}
 		
 		size_t reactId = registerReactor<ReactorType>();
+
+		if ( kNoReactor == reactId ) {
+			return false;
+		}
 		const std::vector<Handle> &handles = handler->getHandles();
 		handler->onRegister();
 		
+		std::lock_guard<std::shared_mutex> lk(m_mainMapMutex);
+		
 		for ( const Handle &handle : handles ) {
-			std::lock_guard<std::shared_mutex> lk(m_mainMapMutex);
-			m_mainMap[handle][reactId].insert(handler);
+			m_mainMap.add(handle, reactId, handler);
+		}
+
+		for ( const HandleRange &range : handler->getHandleRanges() ) {
+			m_mainMap.add(range, reactId, handler);
 		}
+		invalidateRoutes();
 		
 		return true;
 	}
+	
+	// Регистрирует обработчики handlers на реакторе вызывающего потока.
+	// Подписки всех обработчиков собираются и сортируются без блокировки
+	// и публикуются одним изменением m_mainMap. onRegister вызывается для каждого.
+	// Возвращает количество зарегистрированных (дерегистрируемые и отклонившие
+	// регистрацию пропускаются; 0 - и если реактор потока не создан).
+	template<typename ReactorType>
+	size_t registerHandlers(const std::vector<EventHandler *> &handlers)
+	{
+		static_assert( std::is_base_of<Reactor, ReactorType>::value,
+					   "Need class derived from 'Reactor'");
+		
+		return registerHandlers(registerReactor<ReactorType>(), handlers);
+	}
 
 	// Регистрирует класс(EventHandler), реагирующий на определенные сообщения.
 	bool registerHandler(EventHandler *handler, size_t threadID)
@@ -96,7 +237,7 @@ public:
 			return false;
 		}
 		multithread::AtomicCounter ac(handler->m_registeringThreadsCounter);
-		if (handler->m_deregistering)
+		if ( handler->m_deregistering || ! handler->canRegister() )
 		{
 			return false;
 		}
@@ -109,14 +250,27 @@ public:
 		const std::vector<Handle> &handles = handler->getHandles();
 		handler->onRegister();
 
+		std::lock_guard<std::shared_mutex> lk(m_mainMapMutex);
+
 		for ( const Handle &handle : handles ) {
-			std::lock_guard<std::shared_mutex> lk(m_mainMapMutex);
-			m_mainMap[handle][reactId].insert(handler);
+			m_mainMap.add(handle, reactId, handler);
+		}
+
+		for ( const HandleRange &range : handler->getHandleRanges() ) {
+			m_mainMap.add(range, reactId, handler);
 		}
+		invalidateRoutes();
 
 		return true;
 	}
 	
+	// Добавляет зарегистрированному обработчику маршруты одной подписки
+	// (range с paramFrom == paramTo - один Handle) на всех его реакторах;
+	// остальные маршруты не перестраиваются. Саму подписку обработчик
+	// добавляет себе раньше (addHandle/addHandleRange) - по ней его дерегистрируют.
+	// false - обработчик не зарегистрирован или дерегистрируется.
+	bool addHandlerRoute(EventHandler *handler, const HandleRange &range);
+
 	// overflows 
 	bool deregisterHandler(EventHandler *handler,
 			bool isBlocking = false,
@@ -126,12 +280,120 @@ public:
 					 std::map< unsigned long long,
 					 std::set<EventHandler *> > *overflows = nullptr);
 	
+	// То же по заранее найденным получателям (см. Route).
+	// Сообщение с другим Handle отправляется обычным postMessage.
+	bool postMessage(Route &route, const std::shared_ptr<MessageData> &msg,
+					 std::map< unsigned long long,
+					 std::set<EventHandler *> > *overflows = nullptr);
+	
 	bool isHandlerRegistered(EventHandler *handler, const Handle &handle);
+
+	// есть ли у обработчика маршруты хотя бы на одном реакторе (из любого потока);
+	// false - не зарегистрирован или его реакторы остановлены
+	bool isHandlerRouted(EventHandler *handler);
+
+	// Переносит обработчик на реактор toReactorID того же типа, что и текущий.
+	// Сообщения, уже стоящие в очереди прежнего реактора, обрабатываются там;
+	// пришедшие после переноса новый реактор придерживает, пока прежний
+	// не закончит, - порядок сообщений обработчика сохраняется.
+	// false - обработчик не переносимый (EventHandler::setMigratable),
+	// зарегистрирован не на одном реакторе, типы реакторов различаются,
+	// уже идёт перенос или очередь прежнего реактора переполнена.
+	// Обработчик не должен сам перерегистрироваться из потока прежнего реактора.
+	bool migrateHandler(EventHandler *handler, size_t toReactorID);
+
+	// То же, что EventHandler::setBlocking(), для обработчика, который
+	// не включает это сам (см. BlockingExecutor).
+	void setHandlerBlocking(EventHandler *handler, bool blocking = true);
+
+	// Объединяет обработчики shards в группу шардов (см. ShardGroup): сообщения
+	// Handle, на которые они подписаны, получает один шард - по messageParam
+	// (Handle дерегистрации - каждый). Первые activeCount (0 - все) - шарды группы,
+	// остальные - резерв для addShard: сообщений группы они не получают.
+	// Группа создаётся до регистрации обработчиков, каждого на своём реакторе, -
+	// иначе до этого они получают все сообщения.
+	// nullptr - обработчик повторяется или уже состоит в группе.
+	ShardGroup *createShardGroup(const std::vector<EventHandler *> &shards,
+								 size_t activeCount = 0);
+
+	// Добавляет в конец группы шард - резервный или не состоящий в группах.
+	// К нему переходит ~1/(n + 1) ключей; их новые сообщения он придерживает,
+	// пока прежние шарды не обработают полученные до изменения (как при
+	// migrateHandler). Если очередь прежнего шарда переполнена, его ключи
+	// переходят без ожидания.
+	// false - шард не на одном реакторе, в другой группе или кто-то из шардов переносится.
+	bool addShard(ShardGroup *group, EventHandler *shard);
+
+	// Убирает последний шард группы; его ключи переходят к остальным с тем же
+	// сохранением порядка. Убранный шард становится резервным: сообщений группы
+	// не получает, его можно дерегистрировать или вернуть addShard.
+	// nullptr - в группе один шард или кто-то из шардов переносится.
+	EventHandler *removeShard(ShardGroup *group);
+
+	// нагрузка всех работающих реакторов
+	std::vector<ReactorLoad> getReactorLoads();
+
+	// Плавная остановка всех реакторов. postMessage перестаёт принимать
+	// сообщения (возвращает false), каждый реактор в своём потоке обрабатывает
+	// то, что уже стоит в его очереди, и завершается. Не успевшее к сроку
+	// отбрасывается, ожидающие в waitInLoop освобождаются. Очереди реакторов
+	// без потока (attachReactor, SimExecutor) разбираются в вызывающем потоке.
+	// Затем до того же срока ждёт сообщения, переданные в BlockingExecutor.
+	// Возвращает не позже deadline (плюс время отбрасывания очередей).
+	DrainReport drainAndShutdown(std::chrono::steady_clock::time_point deadline);
+
+	// принимает ли postMessage сообщения (false - после drainAndShutdown)
+	bool isAccepting() const
+	{
+		return m_accepting;
+	}
+
+	// Задаёт политику очередей реакторов для сообщений handle
+	// (отправленных после вызова). Счётчики новой политики начинаются с нуля.
+	void setMailboxPolicy(const Handle &handle, const MailboxPolicy &policy);
+	
+	// сообщения handle снова ставятся в очередь без политики
+	void clearMailboxPolicy(const Handle &handle);
+	
+	// false - у handle нет политики
+	bool getMailboxCounters(const Handle &handle, /*out*/ MailboxCounters &counters);
+
+	// Подключает журнал к postMessage (nullptr - отключает).
+	// После возврата setJournal(nullptr) прежний журнал больше не вызывается.
+	void setJournal(MessageJournal *journal);
+	
+	// реактор, принадлежащий вызывающему потоку; nullptr - его нет
+	std::shared_ptr<Reactor> getCurrentReactor()
+	{
+		size_t reactorID;
+		size_t threadID;
+		
+		if ( ! getReactorID(reactorID, threadID) ) {
+			return nullptr;
+		}
+		
+		return getReactor(reactorID);
+	}
+	
+	// Привязывает вызывающий поток и его реактор к процессорам cpus.
+	// Если реактора ещё нет, его очередь будет создана на узле NUMA этих процессоров.
+	bool pinCurrentReactor(const multithread::CpuSet &cpus)
+	{
+		std::shared_ptr<Reactor> reactor = getCurrentReactor();
+		
+		if ( nullptr == reactor ) {
+			return multithread::pinCurrentThread(cpus);
+		}
+		
+		return reactor->setAffinity(cpus);
+	}
 	
 	bool isAllReactorsStopped() {
 		return 0 == m_startedReactorNumbers;
 	}
 
+	// nullptr - в т. ч. если вызван не из потока реактора
+	// (например, из блокирующего обработчика, см. EventHandler::setBlocking)
 	std::shared_ptr<MessageData> waitInLoop(EventHandler *handler,
 											const Handle &handle) 
 	{
@@ -139,6 +401,9 @@ public:
 		size_t threadID;
 		
 		if ( ! getReactorID(reactorID, threadID) ) {
+			if ( BlockingExecutor::isExecutorThread() ) {
+				std::cerr << "waitInLoop: blocking handler has no reactor" << std::endl;
+			}
 			return nullptr;
 		}
 
@@ -149,17 +414,28 @@ public:
 	
 	std::string getDebugInfo() {
 		std::stringstream sstream;
-		sstream << "m_mainMap: " << m_mainMap.size() << std::endl;
+		{
+			std::shared_lock<std::shared_mutex> lk(m_mainMapMutex);
+			sstream << "m_mainMap: " << m_mainMap.size() << std::endl;
+		}
 		
 		std::shared_lock<std::shared_mutex> lk(m_reactorsMutex);
 		
 		sstream << "m_reactors: " << m_reactors.size() << std::endl;
 		
 		for ( auto &elem: m_reactors ) {
-			sstream << std::boolalpha << (elem == nullptr) << std::endl;
+			sstream << std::boolalpha << (elem == nullptr);
+			
+			if ( nullptr != elem ) {
+				sstream << " mailbox node " << elem->getNumaNode()
+						<< ", affinity node " << elem->getAffinityNode();
+			}
+			sstream << std::endl;
 		}
 		sstream << "m_threadToReactor: " 
 				<< m_threadToReactor.size() << std::endl;
+		sstream << multithread::Topology::instance().toString();
+		sstream << multithread::LockRegistry::instance().toString();
 		return sstream.str();
 	}
 	
@@ -170,6 +446,29 @@ private:
 	// Количество запущенных реакторов
 	std::atomic<int> m_startedReactorNumbers; 
 
+	std::atomic<MessageJournal *> m_journal;
+
+	// количество потоков внутри вызова журнала
+	std::atomic<int> m_journalUsers;
+
+	std::atomic<bool> m_accepting;
+
+	// Меняется при любом изменении маршрутов; Route с другой версией устарел.
+	std::atomic<unsigned long long> m_routingVersion;
+
+	// количество потоков, отправляющих по Route
+	std::atomic<int> m_routeUsers;
+
+	// Увеличивает m_routingVersion и ждёт отправки, начатые по прежним Route.
+	// Вызывается после изменения маршрутов, до того как от изменения что-то зависит
+	// (освобождение обработчика, Handoff при переносе).
+	void invalidateRoutes();
+
+	// находит получателей route заново
+	void resolveRoute(Route &route);
+
+	void journalMessage(const std::shared_ptr<MessageData> &msg);
+
 	// запускает ReactorDispatcher принадлежащий запускающему потоку
 	void startReactorDispatcher();
 	
@@ -181,7 +480,8 @@ private:
 	// пмещает сообщение в очередь реактора.
 	// возвращает false если очередь переполнена или передан несуществующий reactId
 	bool eventToReactor(size_t reactId, EventHandler * handler,
-						const std::shared_ptr<MessageData> &message);
+						const std::shared_ptr<MessageData> &message,
+						MailboxState *mailbox = nullptr);
 
 	// вспомогательная, потоко-не-безопасная функция
 	inline bool unlockedPostMessage(const std::shared_ptr<MessageData> &msg,
@@ -189,10 +489,38 @@ private:
 							  std::set<EventHandler *>
 							> *overflows = nullptr);
 
+	size_t registerHandlers(size_t reactId, const std::vector<EventHandler *> &handlers);
+
+	// сообщение группы шардов получает один шард; Handle дерегистрации - каждый
+	static bool isShardTarget(const EventHandler *handler, const Handle &handle)
+	{
+		return handle == handler->m_deregisterHandle ||
+			   handler->m_shardIndex == handler->m_shardGroup->shardOf(handle.messageParam);
+	}
+
+	// Придерживает сообщения gainers на их реакторах, пока каждый из losers
+	// не обработает уже полученное. Под исключительной блокировкой m_mainMapMutex.
+	// false - кто-то не на одном реакторе или уже переносится.
+	bool holdShards(const std::vector<EventHandler *> &gainers,
+					const std::vector<EventHandler *> &losers);
+
+	// Ставит Handoff для каждой пары (loser, gainer) в очередь реактора loser'а.
+	// Не поместившиеся - в unheld: resumeMigrated для них вызывается после
+	// снятия блокировки.
+	void handoffShards(const std::vector<EventHandler *> &losers,
+					   const std::vector<EventHandler *> &gainers,
+					   std::vector< std::pair<size_t, EventHandler *> > &unheld);
+
 	// удаляем Handle из главной map
 	void unlockedRemoveHandle(const Handle &handle);
+
+	// Вызывается прежним реактором переносимого обработчика, когда тот
+	// обработал все свои сообщения: разрешает новому реактору продолжить
+	void resumeMigrated(size_t targetReactorID, EventHandler *handler);
 	
-	// возвращает ID реактора
+	static constexpr size_t kNoReactor = std::numeric_limits<size_t>::max();
+
+	// возвращает ID реактора; kNoReactor - реактор не создан, errno - причина
 	template<typename ReactorType>
 	size_t registerReactor()
 	{
@@ -200,6 +528,7 @@ private:
 		
 		size_t threadID;
 		ReactorType *freshReactor = nullptr;
+		int initError = 0;
 		
 		if ( ! getReactorID(reactorID, threadID) ) {
 			std::lock_guard<std::shared_mutex> lk(m_reactorsMutex);
@@ -207,22 +536,32 @@ private:
 			reactorID = m_reactors.size();
 			std::shared_ptr<ReactorType> reactor =
 					std::make_shared<ReactorType>();
-			freshReactor = reactor.get();
+			initError = reactor->getInitError();
+			
+			if ( 0 == initError ) {
+				freshReactor = reactor.get();
 
-			for ( size_t id = 0; id < m_reactors.size(); id++ ) {
+				for ( size_t id = 0; id < m_reactors.size(); id++ ) {
+					
+					if ( nullptr == m_reactors[id] ) {
+						reactorID = id;
+						m_reactors[reactorID] = reactor;
+						break;			
+					}
+				}
 				
-				if ( nullptr == m_reactors[id] ) {
-					reactorID = id;
-					m_reactors[reactorID] = reactor;
-					break;			
+				if ( reactorID == m_reactors.size() ) {
+					m_reactors.push_back(reactor);
 				}
+				
+				m_threadToReactor.write(threadID, reactorID);
 			}
-			
-			if ( reactorID == m_reactors.size() ) {
-				m_reactors.push_back(reactor);
-			}
-			
-			m_threadToReactor.write(threadID, reactorID);
+		}
+		
+		// errno - после удаления реактора: деструктор может его изменить
+		if ( 0 != initError ) {
+			errno = initError;
+			return kNoReactor;
 		}
 		
 		if ( nullptr != freshReactor ) {
@@ -232,11 +571,22 @@ private:
 		return reactorID;
 	}	
 
-	multithread::SimpleMap< size_t/*threadID(hash)*/,
+	multithread::ShardedMap< size_t/*threadID(hash)*/,
 								size_t/*reactorID*/ > m_threadToReactor;
-	std::map<  Handle, 
-				std::map< size_t /*reactorID*/,
-							std::set<EventHandler* /*handler*/> >  > m_mainMap;
+	
+	// Handle -> политика очереди. Политики не удаляются до конца работы:
+	// на них ссылаются события, ещё стоящие в очередях.
+	multithread::ShardedMap< Handle, MailboxState *, HandleHash > m_mailboxes;
+	std::mutex m_mailboxStatesMutex;
+	std::vector< std::unique_ptr<MailboxState> > m_mailboxStates;
+	
+	// без политик postMessage не ищет их
+	std::atomic<bool> m_hasMailboxPolicies;
+
+	// группы шардов; меняются под исключительной блокировкой m_mainMapMutex
+	std::vector< std::unique_ptr<ShardGroup> > m_shardGroups;
+	// commandID -> messageParam (точно или диапазоном) -> reactorID -> handler
+	RoutingTable m_mainMap;
 	std::vector< std::shared_ptr<Reactor> > m_reactors;
 	inline std::shared_ptr<Reactor> getReactor(size_t reactorID)
 	{
@@ -250,7 +600,9 @@ private:
 		return reactorPtr;
 	}
 	
-	AsyncOperProcessor(): m_startedReactorNumbers(0)
+	AsyncOperProcessor(): m_startedReactorNumbers(0), m_journal(nullptr),
+		m_journalUsers(0), m_accepting(true), m_routingVersion(1), m_routeUsers(0),
+		m_hasMailboxPolicies(false)
 	{
 		
 	}
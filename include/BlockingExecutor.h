@@ -0,0 +1,134 @@
+#ifndef BLOCKINGEXECUTOR_H
+#define BLOCKINGEXECUTOR_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "MessageData.h"
+#include "threadpool.hpp"
+
+#include "andre_global.h"
+
+namespace andre
+{
+
+class EventHandler;
+
+// Исполнитель блокирующих обработчиков (EventHandler::setBlocking,
+// AsyncOperProcessor::setHandlerBlocking).
+//
+// Реактор не вызывает такой обработчик сам, а передаёт сообщение сюда и
+// продолжает обрабатывать остальных. Сообщения одного обработчика выполняются
+// потоками SimpleThreadPool по одному и в порядке поступления (strand);
+// разных обработчиков - параллельно.
+//
+// Сторож (setWatchdog) сообщает об обработчиках, чей вызов дольше бюджета.
+//
+// Поток пула - не поток реактора: блокирующему обработчику недоступны
+// waitInLoop, getCurrentReactor и shutdownReactorDispatcher.
+class ANDRESHARED_EXPORT BlockingExecutor
+{
+public:
+	// обработчик, время его текущего вызова
+	typedef std::function<void (EventHandler *, std::chrono::nanoseconds)> OverBudgetCallback;
+
+	static BlockingExecutor &instance()
+	{
+		static BlockingExecutor theSingleInstance;
+		return theSingleInstance;
+	}
+
+	// создан ли исполнитель (не создаёт его, в отличие от instance())
+	static bool isStarted()
+	{
+		return s_started;
+	}
+
+	// вызван ли из потока исполнителя, т. е. из блокирующего обработчика
+	static bool isExecutorThread();
+
+	// ставит сообщение в очередь обработчика
+	void submit(EventHandler *handler, const std::shared_ptr<MessageData> &msg);
+
+	// добавляет потоки в пул (изначально - по числу процессоров, но не меньше kMinThreads)
+	void increaseThreads(unsigned int threadCount);
+
+	unsigned int getThreadsCount();
+
+	// Раз в budget / 2 проверяет выполняющиеся вызовы; о каждом вызове дольше
+	// budget сообщает callback один раз (из потока сторожа).
+	// budget = 0 - сторож остановлен.
+	void setWatchdog(std::chrono::nanoseconds budget, OverBudgetCallback callback);
+
+	// ждёт, пока все поставленные сообщения будут обработаны; false - не дождались
+	bool waitIdle(std::chrono::nanoseconds timeout);
+
+	// сообщений в очередях обработчиков, включая выполняющиеся
+	size_t getPendingCount();
+
+	unsigned long long getCompletedCount() const
+	{
+		return m_completed;
+	}
+
+	// вызовов дольше бюджета сторожа
+	unsigned long long getOverBudgetCount() const
+	{
+		return m_overBudget;
+	}
+
+private:
+	static constexpr unsigned int kMinThreads = 4;
+
+	static std::atomic<bool> s_started;
+
+	// подряд из одной очереди, затем задача уступает пул другим
+	static constexpr unsigned int kBatch = 16;
+
+	// очередь одного обработчика; удаляется, когда опустела
+	struct Strand
+	{
+		std::deque< std::shared_ptr<MessageData> > queue;
+
+		// начало текущего вызова, нс steady_clock; 0 - не выполняется
+		std::atomic<long long> startedNs{0};
+		bool reported = false;
+	};
+
+	std::mutex m_mutex;
+	std::condition_variable m_idleCondition;
+	std::unordered_map< EventHandler *, std::unique_ptr<Strand> > m_strands;
+	size_t m_pending;
+	std::atomic<unsigned long long> m_completed;
+	std::atomic<unsigned long long> m_overBudget;
+
+	std::mutex m_watchdogMutex;
+	std::condition_variable m_watchdogCondition;
+	std::thread m_watchdog;
+	std::chrono::nanoseconds m_budget;
+	OverBudgetCallback m_callback;
+
+	// после полей, которые используют его задачи
+	multithread::SimpleThreadPool m_pool;
+
+	BlockingExecutor();
+	~BlockingExecutor();
+	BlockingExecutor(const BlockingExecutor &) = delete;
+	BlockingExecutor &operator=(const BlockingExecutor &) = delete;
+
+	// выполняет до kBatch сообщений обработчика
+	void runStrand(EventHandler *handler);
+	void watch();
+	void stopWatchdog();
+};
+
+} // namespace andre
+
+#endif // BLOCKINGEXECUTOR_H
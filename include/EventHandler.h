@@ -12,19 +12,47 @@ namespace andre
 {
 
 class AsyncOperProcessor;
+class BlockingExecutor;
 class Reactor;
+class ShardGroup;
 
 class ANDRESHARED_EXPORT EventHandler
 {
 	friend class AsyncOperProcessor;
+	friend class BlockingExecutor;
 	friend class Reactor;
 	
 public:
 	EventHandler();
 	virtual ~EventHandler();
 	
+	// Время в handleEvent и число обработанных сообщений.
+	// Считаются, пока включён Reactor::setMeasureBusyTime(true).
+	unsigned long long getBusyNs() const
+	{
+		return m_busyNs;
+	}
+	
+	unsigned long long getHandledCount() const
+	{
+		return m_handledCount;
+	}
+
+	// см. setBlocking()
+	bool isBlocking() const
+	{
+		return m_blocking;
+	}
+
+	// см. setMigratable()
+	bool isMigratable() const
+	{
+		return m_migratable;
+	}
+	
 private:
 	std::vector<Handle> m_handles;
+	std::vector<HandleRange> m_handleRanges;
 	
 	// Количество потоков, пытающихся зарегистрировать данный 'EventHandler'.
 	std::atomic<int> m_registeringThreadsCounter;
@@ -35,6 +63,31 @@ private:
 	// Для реализации последующей логики дерегистрируемых EventHandler'в
 	Handle m_deregisterHandle;
 
+	// Реактор, на который переносится обработчик: пока перенос не завершён,
+	// он откладывает сообщения обработчика. nullptr - переноса нет.
+	std::atomic<Reactor *> m_migrationTarget;
+
+	// сколько прежних реакторов ещё не обработали сообщения, пришедшие
+	// до переноса (при изменении группы шардов их несколько)
+	std::atomic<int> m_pendingHandoffs;
+
+	// группа, в которой обработчик - шард номер m_shardIndex; nullptr - не шард
+	ShardGroup *m_shardGroup;
+	size_t m_shardIndex;
+
+	std::atomic<unsigned long long> m_busyNs;
+	std::atomic<unsigned long long> m_handledCount;
+
+	// Тип обработчика, который реактор может вызвать без виртуального вызова
+	// (см. StaticReactor). nullptr - только через handleEvent().
+	const void *m_staticType;
+
+	// сообщения обработчика выполняет BlockingExecutor, а не поток реактора
+	std::atomic<bool> m_blocking;
+
+	// false - обработчик привязан к своему реактору
+	bool m_migratable;
+
 protected:
 	// функция обработчик сообщений.
 	virtual void handleEvent(const std::shared_ptr<MessageData> &msg) = 0;
@@ -45,16 +98,64 @@ protected:
 		m_handles.push_back(handle);
 	}
 	
+	// Подписываем наш класс на диапазон messageParam одной команды
+	void addHandleRange(const HandleRange &range)
+	{
+		m_handleRanges.push_back(range);
+	}
+
+	// Подписываем наш класс на все сообщения команды, независимо от messageParam
+	void addWildcardHandle(unsigned long long commandID)
+	{
+		m_handleRanges.push_back(HandleRange::anyParam(commandID));
+	}
+	
 	// То что от нас запросит Процессор асинхронных операций
 	//  (AsyncOperProcessor) во время регистрации класса
 	const std::vector<Handle> &getHandles()
 	{
 		return m_handles;
 	}
+
+	const std::vector<HandleRange> &getHandleRanges()
+	{
+		return m_handleRanges;
+	}
 	
 	// Вызывается при регистрации EventHandler'а
 	virtual void onRegister() {}
 
+	// Вызывается перед регистрацией; false - регистрация отклоняется
+	virtual bool canRegister()
+	{
+		return true;
+	}
+
+	void setStaticType(const void *staticType)
+	{
+		m_staticType = staticType;
+	}
+
+	// Обработчик может надолго блокироваться (диск, сеть, тяжёлые вычисления):
+	// реактор передаёт его сообщения BlockingExecutor и не задерживает остальных.
+	// Порядок сообщений обработчика сохраняется. Переключать - до регистрации
+	// или когда у обработчика нет сообщений в обработке.
+	// handleEvent выполняется в потоке пула, у которого нет реактора:
+	// waitInLoop возвращает nullptr (с сообщением в std::cerr),
+	// getCurrentReactor - nullptr, shutdownReactorDispatcher ничего не делает.
+	void setBlocking(bool blocking)
+	{
+		m_blocking = blocking;
+	}
+
+	// false - обработчик не переносится на другой реактор (migrateHandler,
+	// ReactorBalancer): например, он останавливает свой реактор или следит
+	// за дескрипторами IoReactor. Задаётся до регистрации.
+	void setMigratable(bool migratable)
+	{
+		m_migratable = migratable;
+	}
+
 	inline bool isDeregistering()
 	{
 		return m_deregistering;
@@ -0,0 +1,530 @@
+#ifndef FLATMESSAGE_H
+#define FLATMESSAGE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include "MessageData.h"
+#include "Handle.hpp"
+
+#include "andre_global.h"
+
+namespace andre
+{
+
+namespace flat_detail
+{
+
+// заголовок и ссылки хранятся в little-endian
+inline uint32_t littleEndian(uint32_t value)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	return __builtin_bswap32(value);
+#else
+	return value;
+#endif
+}
+
+inline uint64_t littleEndian(uint64_t value)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	return __builtin_bswap64(value);
+#else
+	return value;
+#endif
+}
+
+} // namespace flat_detail
+
+// Плоское перемещаемое сообщение:
+//   [FlatHeader][T - корневая структура][строки и массивы]
+// Внутри нет указателей: строки и массивы адресуются смещением от самого
+// поля-ссылки, поэтому буфер можно копировать memcpy'ем в кольцо, файл
+// или сокет и читать на месте, без десериализации.
+// Заголовок и ссылки (FlatString, FlatArray) - little-endian на любом узле;
+// прочие поля корня и элементы массивов читаются на месте, в порядке байт узла.
+struct ANDRESHARED_EXPORT FlatHeader
+{
+	unsigned long long commandID;
+	unsigned long long messageParam;
+	uint32_t typeID;
+	uint32_t size;			// размер всего сообщения вместе с заголовком
+	uint64_t timestamp;		// наносекунды system_clock на момент сборки
+
+	Handle getHandle() const
+	{
+		return {flat_detail::littleEndian(uint64_t(commandID)),
+				flat_detail::littleEndian(uint64_t(messageParam))};
+	}
+
+	uint32_t getTypeID() const { return flat_detail::littleEndian(typeID); }
+	uint32_t getSize() const { return flat_detail::littleEndian(size); }
+	uint64_t getTimestamp() const { return flat_detail::littleEndian(timestamp); }
+};
+
+static_assert(sizeof(FlatHeader) == 32, "FlatHeader layout must be stable");
+
+// Строка внутри плоского сообщения
+struct FlatString
+{
+	uint32_t offset;	// от адреса самого поля
+	uint32_t length;
+
+	std::string_view view() const
+	{
+		if ( 0 == size() ) {
+			return std::string_view();
+		}
+		return std::string_view(reinterpret_cast<const char *>(this) +
+								flat_detail::littleEndian(offset), size());
+	}
+
+	size_t size() const { return flat_detail::littleEndian(length); }
+};
+
+// Массив тривиально копируемых элементов внутри плоского сообщения
+template<typename T>
+struct FlatArray
+{
+	static_assert(std::is_trivially_copyable<T>::value,
+				  "FlatArray needs trivially copyable elements");
+
+	uint32_t offset;	// от адреса самого поля
+	uint32_t count;
+
+	const T *data() const
+	{
+		return reinterpret_cast<const T *>(reinterpret_cast<const char *>(this) +
+										   flat_detail::littleEndian(offset));
+	}
+
+	size_t size() const { return flat_detail::littleEndian(count); }
+	bool empty() const { return 0 == count; }
+	const T *begin() const { return data(); }
+	const T *end() const { return data() + size(); }
+	const T &operator[](size_t index) const { return data()[index]; }
+};
+
+// Описание поля для рефлексии
+template<typename T, typename M>
+struct FlatField
+{
+	const char *name;
+	M T::*member;
+};
+
+template<typename T, typename M>
+constexpr FlatField<T, M> makeFlatField(const char *name, M T::*member)
+{
+	return FlatField<T, M>{name, member};
+}
+
+// Схема плоского типа. Специализируется макросом ANDRE_FLAT_MESSAGE.
+template<typename T>
+struct FlatSchema
+{
+	static constexpr bool registered = false;
+};
+
+namespace flat_detail
+{
+
+template<typename M>
+struct IsFlatArray : std::false_type {};
+
+template<typename U>
+struct IsFlatArray< FlatArray<U> > : std::true_type
+{
+	typedef U Element;
+};
+
+inline bool inBounds(const void *field, uint64_t offset, uint64_t bytes,
+					 const char *end)
+{
+	uintptr_t begin = reinterpret_cast<uintptr_t>(field) + offset;
+	uintptr_t limit = reinterpret_cast<uintptr_t>(end);
+
+	return begin <= limit && uint64_t(limit - begin) >= bytes;
+}
+
+// содержит ли M ссылки, которые нужно проверять
+template<typename M>
+constexpr bool hasReferences()
+{
+	return std::is_same<M, FlatString>::value || IsFlatArray<M>::value ||
+		   FlatSchema<M>::registered;
+}
+
+// Проверка ссылок поля, рекурсивно - по элементам массивов и полям вложенных
+// зарегистрированных структур. budget - сколько ссылок ещё можно проверить:
+// ссылки чужого буфера могут указывать на одни и те же данные, и без
+// ограничения проверка вложенных массивов растёт как степень размера буфера.
+template<typename M>
+bool validateField(const M &field, const char *end, size_t &budget)
+{
+	if constexpr ( std::is_same<M, FlatString>::value ) {
+		if ( 0 == budget ) {
+			return false;
+		}
+		-- budget;
+
+		return 0 == field.size() ||
+			   inBounds(&field, littleEndian(field.offset), field.size(), end);
+	}
+	else if constexpr ( IsFlatArray<M>::value ) {
+		typedef typename IsFlatArray<M>::Element Element;
+
+		if ( 0 == budget ) {
+			return false;
+		}
+		-- budget;
+
+		if ( field.empty() ) {
+			return true;
+		}
+
+		if ( ! inBounds(&field, littleEndian(field.offset),
+						uint64_t(field.size()) * sizeof(Element), end) ||
+			 0 != reinterpret_cast<uintptr_t>(field.data()) % alignof(Element) ) {
+			return false;
+		}
+
+		if constexpr ( hasReferences<Element>() ) {
+			for ( const Element &element : field ) {
+				if ( ! validateField(element, end, budget) ) {
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+	else if constexpr ( FlatSchema<M>::registered ) {
+		bool valid = true;
+
+		std::apply([&](const auto &...member) {
+			((valid = valid && validateField(field.*(member.member), end, budget)), ...);
+		}, FlatSchema<M>::fields());
+
+		return valid;
+	}
+	else {
+		return true;
+	}
+}
+
+template<typename M>
+void dumpField(std::ostream &stream, const M &field)
+{
+	if constexpr ( std::is_same<M, FlatString>::value ) {
+		stream << '"' << field.view() << '"';
+	}
+	else if constexpr ( IsFlatArray<M>::value ) {
+		stream << '[';
+		for ( size_t i = 0; i < field.size(); ++i ) {
+			stream << (i ? ", " : "");
+			dumpField(stream, field[i]);
+		}
+		stream << ']';
+	}
+	else if constexpr ( std::is_arithmetic<M>::value ) {
+		stream << +field;
+	}
+	else {
+		stream << "<" << sizeof(M) << " bytes>";
+	}
+}
+
+} // namespace flat_detail
+
+// Вызывает func(name, value) для каждого поля, перечисленного в схеме
+template<typename T, typename Function>
+void forEachFlatField(const T &root, Function func)
+{
+	static_assert(FlatSchema<T>::registered, "Type is not registered with ANDRE_FLAT_MESSAGE");
+
+	std::apply([&](const auto &...field) {
+		(func(field.name, root.*(field.member)), ...);
+	}, FlatSchema<T>::fields());
+}
+
+// Проверяет, что все строки и массивы корня, включая вложенные массивы и
+// зарегистрированные структуры, лежат внутри сообщения и выровнены.
+// Пригодна для буферов из недоверенных источников; после неё чтение
+// через FlatString/FlatArray не выходит за end.
+template<typename T>
+bool validateFlat(const T &root, const char *end)
+{
+	if ( end < reinterpret_cast<const char *>(&root) + sizeof(T) ) {
+		return false;
+	}
+	// корректное сообщение хранит каждую ссылку в своих 8 байтах
+	size_t budget = size_t(end - reinterpret_cast<const char *>(&root)) / sizeof(FlatString);
+
+	return flat_detail::validateField(root, end, budget);
+}
+
+// Возвращает корень типа T, лежащий в data, без копирования.
+// nullptr - не тот тип, неверный размер, выравнивание или смещения.
+template<typename T>
+const T *flatCast(const char *data, size_t size)
+{
+	static_assert(FlatSchema<T>::registered, "Type is not registered with ANDRE_FLAT_MESSAGE");
+
+	if ( size < sizeof(FlatHeader) + sizeof(T) ||
+		 0 != reinterpret_cast<uintptr_t>(data) % alignof(FlatHeader) ) {
+		return nullptr;
+	}
+	const FlatHeader *header = reinterpret_cast<const FlatHeader *>(data);
+
+	if ( header->getTypeID() != FlatSchema<T>::typeID || header->getSize() != size ) {
+		return nullptr;
+	}
+	const T *root = reinterpret_cast<const T *>(data + sizeof(FlatHeader));
+
+	if ( ! validateFlat(*root, data + size) ) {
+		return nullptr;
+	}
+
+	return root;
+}
+
+// текстовое представление для диагностики: Type{field=value, ...}
+template<typename T>
+std::string dumpFlat(const T &root)
+{
+	std::ostringstream stream;
+	stream << FlatSchema<T>::name() << '{';
+	bool first = true;
+
+	forEachFlatField(root, [&](const char *name, const auto &field) {
+		stream << (first ? "" : ", ") << name << '=';
+		flat_detail::dumpField(stream, field);
+		first = false;
+	});
+	stream << '}';
+
+	return stream.str();
+}
+
+// наносекунды system_clock, используются в FlatHeader::timestamp
+ANDRESHARED_EXPORT uint64_t flatTimestamp();
+
+// Готовое плоское сообщение, которое можно отправить через postMessage
+class ANDRESHARED_EXPORT FlatData : public ConstData
+{
+public:
+	FlatData();
+
+	// копирует буфер; false - в буфере нет корректного заголовка
+	bool assign(const char *data, size_t size);
+
+	const FlatHeader &getHeader() const
+	{
+		return *reinterpret_cast<const FlatHeader *>(m_buffer.data());
+	}
+
+	const char *getBuffer() const
+	{
+		return reinterpret_cast<const char *>(m_buffer.data());
+	}
+
+	size_t getSize() const
+	{
+		return m_size;
+	}
+
+	template<typename T>
+	const T *get() const
+	{
+		return flatCast<T>(getBuffer(), m_size);
+	}
+
+	// MessageCodec будет передавать сообщения команды как есть, одним блоком
+	static void registerCodec(unsigned long long commandID);
+
+private:
+	// uint64_t - для выравнивания корня по 8 байт
+	std::vector<uint64_t> m_buffer;
+	size_t m_size;
+};
+
+// Собирает плоское сообщение типа T
+template<typename T>
+class FlatWriter
+{
+	static_assert(std::is_trivially_copyable<T>::value &&
+				  std::is_standard_layout<T>::value,
+				  "Flat message root must be a trivially copyable standard-layout struct");
+	static_assert(alignof(T) <= alignof(uint64_t), "Flat message root is over-aligned");
+	static_assert(FlatSchema<T>::registered, "Type is not registered with ANDRE_FLAT_MESSAGE");
+
+public:
+	explicit FlatWriter(const Handle &handle)
+	{
+		m_buffer.assign(sizeof(FlatHeader) + sizeof(T), 0);
+
+		FlatHeader header;
+		std::memset(&header, 0, sizeof(header));
+		header.commandID = flat_detail::littleEndian(uint64_t(handle.commandID));
+		header.messageParam = flat_detail::littleEndian(uint64_t(handle.messageParam));
+		header.typeID = flat_detail::littleEndian(FlatSchema<T>::typeID);
+		std::memcpy(m_buffer.data(), &header, sizeof(header));
+	}
+
+	// корень; ссылка недействительна после добавления строк и массивов
+	T &root()
+	{
+		return *reinterpret_cast<T *>(m_buffer.data() + sizeof(FlatHeader));
+	}
+
+	template<typename M>
+	void set(M T::*member, const M &value)
+	{
+		root().*member = value;
+	}
+
+	void setString(FlatString T::*member, std::string_view value)
+	{
+		size_t fieldPos = fieldPosition(member);
+		size_t dataPos = append(value.data(), value.size(), 1);
+		writeReference(fieldPos, dataPos, uint32_t(value.size()));
+	}
+
+	template<typename U>
+	void setArray(FlatArray<U> T::*member, const U *data, size_t count)
+	{
+		size_t fieldPos = fieldPosition(member);
+		size_t dataPos = append(data, count * sizeof(U), alignof(U));
+		writeReference(fieldPos, dataPos, uint32_t(count));
+	}
+
+	template<typename U>
+	void setArray(FlatArray<U> T::*member, const std::vector<U> &values)
+	{
+		setArray(member, values.data(), values.size());
+	}
+
+	void setStrings(FlatArray<FlatString> T::*member,
+					const std::vector<std::string_view> &values)
+	{
+		size_t fieldPos = fieldPosition(member);
+		size_t arrayPos = append(nullptr, values.size() * sizeof(FlatString),
+								 alignof(FlatString));
+		writeReference(fieldPos, arrayPos, uint32_t(values.size()));
+
+		for ( size_t i = 0; i < values.size(); ++i ) {
+			size_t dataPos = append(values[i].data(), values[i].size(), 1);
+			writeReference(arrayPos + i * sizeof(FlatString), dataPos,
+						   uint32_t(values[i].size()));
+		}
+	}
+
+	// Завершает сборку. Время в заголовке - момент вызова.
+	std::unique_ptr<FlatData> finish()
+	{
+		FlatHeader *header = reinterpret_cast<FlatHeader *>(m_buffer.data());
+		header->size = flat_detail::littleEndian(uint32_t(m_buffer.size()));
+		header->timestamp = flat_detail::littleEndian(flatTimestamp());
+
+		std::unique_ptr<FlatData> result = std::make_unique<FlatData>();
+		result->assign(m_buffer.data(), m_buffer.size());
+
+		return result;
+	}
+
+	// заголовок и тело для записи без FlatData (кольцо, файл, сокет)
+	const std::vector<char> &finishBuffer()
+	{
+		FlatHeader *header = reinterpret_cast<FlatHeader *>(m_buffer.data());
+		header->size = flat_detail::littleEndian(uint32_t(m_buffer.size()));
+		header->timestamp = flat_detail::littleEndian(flatTimestamp());
+
+		return m_buffer;
+	}
+
+private:
+	std::vector<char> m_buffer;
+
+	template<typename M>
+	size_t fieldPosition(M T::*member)
+	{
+		return size_t(reinterpret_cast<char *>(&(root().*member)) - m_buffer.data());
+	}
+
+	size_t append(const void *data, size_t size, size_t alignment)
+	{
+		size_t pos = (m_buffer.size() + alignment - 1) / alignment * alignment;
+		m_buffer.resize(pos + size, 0);
+
+		if ( nullptr != data && 0 != size ) {
+			std::memcpy(m_buffer.data() + pos, data, size);
+		}
+
+		return pos;
+	}
+
+	void writeReference(size_t fieldPos, size_t dataPos, uint32_t count)
+	{
+		uint32_t reference[2] = {flat_detail::littleEndian(uint32_t(dataPos - fieldPos)),
+								 flat_detail::littleEndian(count)};
+		std::memcpy(m_buffer.data() + fieldPos, reference, sizeof(reference));
+	}
+};
+
+} // namespace andre
+
+#define ANDRE_FLAT_FIELD(Type, field) ::andre::makeFlatField(#field, &Type::field)
+
+#define ANDRE_FLAT_F1(T, a) ANDRE_FLAT_FIELD(T, a)
+#define ANDRE_FLAT_F2(T, a, ...) ANDRE_FLAT_FIELD(T, a), ANDRE_FLAT_F1(T, __VA_ARGS__)
+#define ANDRE_FLAT_F3(T, a, ...) ANDRE_FLAT_FIELD(T, a), ANDRE_FLAT_F2(T, __VA_ARGS__)
+#define ANDRE_FLAT_F4(T, a, ...) ANDRE_FLAT_FIELD(T, a), ANDRE_FLAT_F3(T, __VA_ARGS__)
+#define ANDRE_FLAT_F5(T, a, ...) ANDRE_FLAT_FIELD(T, a), ANDRE_FLAT_F4(T, __VA_ARGS__)
+#define ANDRE_FLAT_F6(T, a, ...) ANDRE_FLAT_FIELD(T, a), ANDRE_FLAT_F5(T, __VA_ARGS__)
+#define ANDRE_FLAT_F7(T, a, ...) ANDRE_FLAT_FIELD(T, a), ANDRE_FLAT_F6(T, __VA_ARGS__)
+#define ANDRE_FLAT_F8(T, a, ...) ANDRE_FLAT_FIELD(T, a), ANDRE_FLAT_F7(T, __VA_ARGS__)
+#define ANDRE_FLAT_F9(T, a, ...) ANDRE_FLAT_FIELD(T, a), ANDRE_FLAT_F8(T, __VA_ARGS__)
+#define ANDRE_FLAT_F10(T, a, ...) ANDRE_FLAT_FIELD(T, a), ANDRE_FLAT_F9(T, __VA_ARGS__)
+#define ANDRE_FLAT_F11(T, a, ...) ANDRE_FLAT_FIELD(T, a), ANDRE_FLAT_F10(T, __VA_ARGS__)
+#define ANDRE_FLAT_F12(T, a, ...) ANDRE_FLAT_FIELD(T, a), ANDRE_FLAT_F11(T, __VA_ARGS__)
+#define ANDRE_FLAT_F13(T, a, ...) ANDRE_FLAT_FIELD(T, a), ANDRE_FLAT_F12(T, __VA_ARGS__)
+#define ANDRE_FLAT_F14(T, a, ...) ANDRE_FLAT_FIELD(T, a), ANDRE_FLAT_F13(T, __VA_ARGS__)
+#define ANDRE_FLAT_F15(T, a, ...) ANDRE_FLAT_FIELD(T, a), ANDRE_FLAT_F14(T, __VA_ARGS__)
+#define ANDRE_FLAT_F16(T, a, ...) ANDRE_FLAT_FIELD(T, a), ANDRE_FLAT_F15(T, __VA_ARGS__)
+
+#define ANDRE_FLAT_SELECT(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, \
+						  _11, _12, _13, _14, _15, _16, NAME, ...) NAME
+
+#define ANDRE_FLAT_FIELDS(T, ...) \
+	ANDRE_FLAT_SELECT(__VA_ARGS__, ANDRE_FLAT_F16, ANDRE_FLAT_F15, ANDRE_FLAT_F14, \
+		ANDRE_FLAT_F13, ANDRE_FLAT_F12, ANDRE_FLAT_F11, ANDRE_FLAT_F10, \
+		ANDRE_FLAT_F9, ANDRE_FLAT_F8, ANDRE_FLAT_F7, ANDRE_FLAT_F6, ANDRE_FLAT_F5, \
+		ANDRE_FLAT_F4, ANDRE_FLAT_F3, ANDRE_FLAT_F2, ANDRE_FLAT_F1)(T, __VA_ARGS__)
+
+// Регистрирует плоский тип (до 16 полей). Используется в глобальном пространстве имён:
+//   struct Trade { uint64_t id; double price; andre::FlatString symbol; };
+//   ANDRE_FLAT_MESSAGE(Trade, 1001, id, price, symbol)
+#define ANDRE_FLAT_MESSAGE(Type, TypeID, ...) \
+	namespace andre { \
+	template<> \
+	struct FlatSchema<Type> \
+	{ \
+		static constexpr bool registered = true; \
+		static constexpr uint32_t typeID = TypeID; \
+		static constexpr const char *name() { return #Type; } \
+		static constexpr auto fields() \
+		{ \
+			return std::make_tuple(ANDRE_FLAT_FIELDS(Type, __VA_ARGS__)); \
+		} \
+	}; \
+	}
+
+#endif // FLATMESSAGE_H
@@ -1,6 +1,7 @@
 #ifndef HANDLE_HPP
 #define HANDLE_HPP
 #include <functional>
+#include <limits>
 
 #include "andre_global.h"
 
@@ -42,6 +43,50 @@ struct ANDRESHARED_EXPORT Handle
 	}
 };
 
+// Хеш Handle для неупорядоченных контейнеров
+struct ANDRESHARED_EXPORT HandleHash
+{
+	size_t operator()(const Handle &handle) const
+	{
+		std::hash<unsigned long long> hasher;
+		return hasher(handle.commandID) * 0x9e3779b97f4a7c15ULL ^ hasher(handle.messageParam);
+	}
+};
+
+// Идентифицирует группу событий одной команды:
+// все messageParam из диапазона [paramFrom, paramTo] (границы включены)
+struct ANDRESHARED_EXPORT HandleRange
+{
+	unsigned long long commandID;
+	unsigned long long paramFrom;
+	unsigned long long paramTo;
+
+	// подписка на любой messageParam команды
+	static HandleRange anyParam(unsigned long long commandID)
+	{
+		return {commandID, 0, std::numeric_limits<unsigned long long>::max()};
+	}
+
+	bool contains(const Handle &handle) const
+	{
+		return ( (this->commandID == handle.commandID) &&
+				 (this->paramFrom <= handle.messageParam) &&
+				 (handle.messageParam <= this->paramTo) );
+	}
+
+	bool operator==(const HandleRange &right) const
+	{
+		return ( (this->commandID == right.commandID) &&
+				 (this->paramFrom == right.paramFrom) &&
+				 (this->paramTo == right.paramTo) );
+	}
+
+	bool operator!=(const HandleRange &right) const
+	{
+		return ( ! operator==(right) );
+	}
+};
+
 } // namespace andre
 
 #endif // HANDLE_HPP
@@ -0,0 +1,76 @@
+#ifndef IOREACTOR_H
+#define IOREACTOR_H
+
+#include <atomic>
+#include <cstdint>
+#include <unordered_map>
+
+#include "Reactor.h"
+#include "andre_global.h"
+
+namespace andre
+{
+
+// Получатель событий готовности файловых дескрипторов.
+// Обычно реализуется вместе с EventHandler/DeregisterableHandler,
+// чтобы сообщения и I/O обрабатывались в одном потоке.
+class ANDRESHARED_EXPORT IoHandler
+{
+public:
+	virtual ~IoHandler() {}
+
+	// events - маска EPOLLIN/EPOLLOUT/EPOLLERR/EPOLLHUP/...
+	virtual void handleIoEvent(int fd, uint32_t events) = 0;
+};
+
+// Реактор, цикл которого ждёт в epoll одновременно готовность дескрипторов
+// и очередь сообщений. Очередь будит цикл через eventfd, причём запись в
+// eventfd делается, только если цикл действительно спит.
+// Если epoll или eventfd создать не удалось, реактор не регистрируется:
+// registerHandler<IoReactor> возвращает false, errno - причина.
+// Только Linux.
+class ANDRESHARED_EXPORT IoReactor : public Reactor
+{
+public:
+	IoReactor();
+	~IoReactor() override;
+
+	// IoReactor вызывающего потока; nullptr - у потока другой реактор или нет его
+	static IoReactor *current();
+
+	int getInitError() const override { return m_initError; }
+
+	// Методы работы с дескрипторами вызываются из потока реактора
+	// (например, из handleEvent/handleIoEvent или до запуска цикла).
+	// false - ошибка epoll_ctl, errno - причина.
+	bool watch(int fd, uint32_t events, IoHandler *handler);
+	bool modify(int fd, uint32_t events);
+	bool unwatch(int fd);
+
+	void handleEvents() override;
+	void exit() override;
+
+protected:
+	void wakeUp() override;
+
+private:
+	int m_epollFd;
+	int m_eventFd;
+	int m_initError;
+
+	// цикл собирается заснуть в epoll_wait - производителям надо позвонить
+	std::atomic<bool> m_needWake;
+
+	std::unordered_map<int, IoHandler *> m_ioHandlers;
+
+	// сколько сообщений обрабатывать между опросами дескрипторов
+	const int maxEventsPerPoll = 256;
+
+	void ringDoorbell();
+	void drainDoorbell();
+	bool drainMailbox();
+};
+
+} // namespace andre
+
+#endif // IOREACTOR_H
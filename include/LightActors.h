@@ -0,0 +1,336 @@
+#ifndef LIGHTACTORS_H
+#define LIGHTACTORS_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "AsyncOperProcessor.h"
+#include "DeregisterableHandler.h"
+#include "NameRegistry.h"
+
+#include "andre_global.h"
+
+namespace andre
+{
+
+// Множество лёгких акторов одного типа в одном обработчике.
+//
+// Актор - это только его State, без своего EventHandler и своих подписок:
+// хост подписан одним диапазоном {commandID, firstID, lastID}, messageParam
+// сообщения - номер актора. Состояния лежат в блоках (slab) по slabSize штук
+// и адресуются номером напрямую; на актор сверх sizeof(State) - два бита.
+// Блок выделяется при активации первого актора в нём и освобождается с последним.
+//
+// Актор активируется при первом сообщении: activator заполняет State
+// (например, загружает из хранилища) или возвращает false - актора нет,
+// сообщение отбрасывается. Пассивация - сохранение через passivator
+// и освобождение места - когда behavior вернул false, или в passivateIdle()
+// для акторов без сообщений с прошлого её вызова.
+//
+// Акторов больше, чем может обработать один реактор, - несколько хостов
+// с соседними диапазонами на разных реакторах.
+// Методы, кроме requestPassivateIdle() и счётчиков, вызываются только из потока
+// реактора хоста (из behavior, activator, passivator).
+template<typename State>
+class LightActorHost : public DeregisterableHandler
+{
+public:
+	typedef unsigned long long ActorID;
+
+	// false - актор завершил работу и пассивируется
+	typedef std::function<bool (ActorID, State &, const std::shared_ptr<MessageData> &)> Behavior;
+
+	// false - актора с таким номером нет
+	typedef std::function<bool (ActorID, State &)> Activator;
+
+	typedef std::function<void (ActorID, State &)> Passivator;
+
+	LightActorHost(unsigned long long commandID, ActorID firstID, ActorID lastID,
+				   Behavior behavior, Activator activator = nullptr,
+				   Passivator passivator = nullptr, size_t slabSize = 4096)
+		: m_firstID(firstID), m_behavior(std::move(behavior)),
+		  m_activator(std::move(activator)), m_passivator(std::move(passivator)),
+		  m_slabSize(roundSlabSize(slabSize)), m_resident(0), m_activations(0),
+		  m_passivations(0)
+	{
+		m_slabs.resize( (lastID - firstID) / m_slabSize + 1 );
+		addHandleRange({commandID, firstID, lastID});
+
+		m_passivateHandle.commandID =
+				NameRegistry::instance().intern("light_actors_passivate_idle");
+		m_passivateHandle.messageParam = reinterpret_cast<unsigned long long>(this);
+		addHandle(m_passivateHandle);
+	}
+
+	// Пассивирует все активные акторы. Вызывается после дерегистрации.
+	~LightActorHost() override
+	{
+		for ( size_t index = 0; index < m_slabs.size(); ++index ) {
+			Slab *slab = m_slabs[index].get();
+
+			for ( size_t offset = 0; nullptr != slab && offset < m_slabSize; ++offset ) {
+				if ( slab->isResident(offset) ) {
+					passivate(index, offset);
+					slab = m_slabs[index].get();
+				}
+			}
+		}
+	}
+
+	// Просит реактор хоста выполнить passivateIdle(). Из любого потока.
+	bool requestPassivateIdle()
+	{
+		std::unique_ptr<ConstData> data = std::make_unique<ConstData>();
+		data->handle = m_passivateHandle;
+
+		return AsyncOperProcessor::instance().postMessage(std::make_shared<MessageData>(data));
+	}
+
+	// Пассивирует акторы, не получавшие сообщений с прошлого вызова.
+	// Возвращает количество пассивированных.
+	size_t passivateIdle()
+	{
+		size_t count = 0;
+
+		for ( size_t index = 0; index < m_slabs.size(); ++index ) {
+			Slab *slab = m_slabs[index].get();
+
+			for ( size_t offset = 0; nullptr != slab && offset < m_slabSize; ++offset ) {
+				if ( ! slab->isResident(offset) ) {
+					continue;
+				}
+
+				if ( slab->takeReferenced(offset) ) {
+					continue;
+				}
+				passivate(index, offset);
+				++ count;
+
+				// блок освобождён вместе с последним актором
+				slab = m_slabs[index].get();
+			}
+		}
+
+		return count;
+	}
+
+	bool isResident(ActorID id) const
+	{
+		if ( id < m_firstID || slabIndex(id) >= m_slabs.size() ) {
+			return false;
+		}
+		Slab *slab = m_slabs[slabIndex(id)].get();
+		return nullptr != slab && slab->isResident(slabOffset(id));
+	}
+
+	// активные акторы
+	size_t getResidentCount() const
+	{
+		return m_resident;
+	}
+
+	unsigned long long getActivationCount() const
+	{
+		return m_activations;
+	}
+
+	unsigned long long getPassivationCount() const
+	{
+		return m_passivations;
+	}
+
+	// память выделенных блоков
+	size_t getMemoryBytes() const
+	{
+		size_t slabs = 0;
+
+		for ( const std::unique_ptr<Slab> &slab : m_slabs ) {
+			slabs += ( nullptr != slab ) ? 1 : 0;
+		}
+
+		return slabs * ( sizeof(Slab) + m_slabSize * sizeof(State) +
+						 2 * m_slabSize / 8 ) + m_slabs.size() * sizeof(m_slabs[0]);
+	}
+
+protected:
+	void onHandleEvent(const std::shared_ptr<MessageData> &msg) override
+	{
+		const Handle &handle = msg->getData()->handle;
+
+		if ( handle == m_passivateHandle ) {
+			passivateIdle();
+			return;
+		}
+		ActorID id = handle.messageParam;
+		size_t index = slabIndex(id);
+		size_t offset = slabOffset(id);
+		State *state = activate(index, offset, id);
+
+		if ( nullptr == state ) {
+			return;
+		}
+
+		if ( ! m_behavior(id, *state, msg) ) {
+			passivate(index, offset);
+		}
+	}
+
+private:
+	// Блок состояний. Биты: активен ли актор, были ли сообщения с прошлого passivateIdle.
+	class Slab
+	{
+	public:
+		explicit Slab(size_t size)
+			: m_states(static_cast<State *>(::operator new(size * sizeof(State),
+														  std::align_val_t(alignof(State))))),
+			  m_resident(size / 64, 0), m_referenced(size / 64, 0), m_residentCount(0)
+		{
+		}
+
+		~Slab()
+		{
+			::operator delete(m_states, std::align_val_t(alignof(State)));
+		}
+
+		Slab(const Slab &) = delete;
+		Slab &operator=(const Slab &) = delete;
+
+		State *state(size_t offset)
+		{
+			return m_states + offset;
+		}
+
+		bool isResident(size_t offset) const
+		{
+			return 0 != ( m_resident[offset / 64] & bit(offset) );
+		}
+
+		void setResident(size_t offset, bool resident)
+		{
+			if (resident) {
+				m_resident[offset / 64] |= bit(offset);
+				++ m_residentCount;
+			}
+			else {
+				m_resident[offset / 64] &= ~bit(offset);
+				-- m_residentCount;
+			}
+		}
+
+		void setReferenced(size_t offset)
+		{
+			m_referenced[offset / 64] |= bit(offset);
+		}
+
+		// сбрасывает бит; возвращает прежнее значение
+		bool takeReferenced(size_t offset)
+		{
+			bool referenced = 0 != ( m_referenced[offset / 64] & bit(offset) );
+			m_referenced[offset / 64] &= ~bit(offset);
+
+			return referenced;
+		}
+
+		size_t getResidentCount() const
+		{
+			return m_residentCount;
+		}
+
+	private:
+		State *m_states;
+		std::vector<uint64_t> m_resident;
+		std::vector<uint64_t> m_referenced;
+		size_t m_residentCount;
+
+		static uint64_t bit(size_t offset)
+		{
+			return uint64_t(1) << (offset % 64);
+		}
+	};
+
+	ActorID m_firstID;
+	Behavior m_behavior;
+	Activator m_activator;
+	Passivator m_passivator;
+	size_t m_slabSize;
+	std::vector< std::unique_ptr<Slab> > m_slabs;
+	Handle m_passivateHandle;
+
+	std::atomic<size_t> m_resident;
+	std::atomic<unsigned long long> m_activations;
+	std::atomic<unsigned long long> m_passivations;
+
+	// кратно 64 - по целому слову битов
+	static size_t roundSlabSize(size_t slabSize)
+	{
+		return ( 0 == slabSize ) ? 64 : (slabSize + 63) / 64 * 64;
+	}
+
+	size_t slabIndex(ActorID id) const
+	{
+		return (id - m_firstID) / m_slabSize;
+	}
+
+	size_t slabOffset(ActorID id) const
+	{
+		return (id - m_firstID) % m_slabSize;
+	}
+
+	// nullptr - актора нет
+	State *activate(size_t index, size_t offset, ActorID id)
+	{
+		std::unique_ptr<Slab> &slab = m_slabs[index];
+
+		if ( nullptr != slab && slab->isResident(offset) ) {
+			slab->setReferenced(offset);
+			return slab->state(offset);
+		}
+
+		if ( nullptr == slab ) {
+			slab.reset(new Slab(m_slabSize));
+		}
+		State *state = new (slab->state(offset)) State();
+
+		if ( nullptr != m_activator && ! m_activator(id, *state) ) {
+			state->~State();
+
+			if ( 0 == slab->getResidentCount() ) {
+				slab.reset();
+			}
+			return nullptr;
+		}
+		slab->setResident(offset, true);
+		slab->setReferenced(offset);
+		++ m_resident;
+		++ m_activations;
+
+		return state;
+	}
+
+	void passivate(size_t index, size_t offset)
+	{
+		std::unique_ptr<Slab> &slab = m_slabs[index];
+		State *state = slab->state(offset);
+
+		if ( nullptr != m_passivator ) {
+			m_passivator(m_firstID + index * m_slabSize + offset, *state);
+		}
+		state->~State();
+		slab->setResident(offset, false);
+		slab->takeReferenced(offset);
+		-- m_resident;
+		++ m_passivations;
+
+		if ( 0 == slab->getResidentCount() ) {
+			slab.reset();
+		}
+	}
+};
+
+} // namespace andre
+
+#endif // LIGHTACTORS_H
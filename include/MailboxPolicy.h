@@ -0,0 +1,73 @@
+#ifndef MAILBOXPOLICY_H
+#define MAILBOXPOLICY_H
+
+#include <atomic>
+#include <chrono>
+
+#include "andre_global.h"
+
+namespace andre
+{
+
+// Политика очереди реактора для сообщений одного Handle.
+// Правила можно сочетать.
+struct ANDRESHARED_EXPORT MailboxPolicy
+{
+	// В очереди каждого обработчика хранится только последнее сообщение Handle:
+	// новое заменяет ждущее, сохраняя его место в очереди.
+	bool conflate = false;
+
+	// Сообщение, пролежавшее в очереди дольше ttl, не доставляется.
+	// 0 - без ограничения.
+	std::chrono::nanoseconds ttl{0};
+
+	// При переполнении очереди вытесняется самое старое сообщение (голова очереди),
+	// а не отвергается новое.
+	bool dropOldest = false;
+};
+
+// Счётчики политики: сколько сообщений заменено, просрочено, вытеснено
+struct ANDRESHARED_EXPORT MailboxCounters
+{
+	unsigned long long conflated;
+	unsigned long long expired;
+	unsigned long long evicted;
+};
+
+// Политика Handle вместе со счётчиками. Живёт до конца работы
+// AsyncOperProcessor: на неё ссылаются события в очередях.
+class ANDRESHARED_EXPORT MailboxState
+{
+public:
+	explicit MailboxState(const MailboxPolicy &policy)
+		: m_policy(policy), m_conflated(0), m_expired(0), m_evicted(0)
+	{
+	}
+
+	const MailboxPolicy &getPolicy() const
+	{
+		return m_policy;
+	}
+
+	MailboxCounters getCounters() const
+	{
+		return {m_conflated, m_expired, m_evicted};
+	}
+
+	void onConflated() { m_conflated.fetch_add(1, std::memory_order_relaxed); }
+	void onExpired() { m_expired.fetch_add(1, std::memory_order_relaxed); }
+	void onEvicted() { m_evicted.fetch_add(1, std::memory_order_relaxed); }
+
+private:
+	const MailboxPolicy m_policy;
+	std::atomic<unsigned long long> m_conflated;
+	std::atomic<unsigned long long> m_expired;
+	std::atomic<unsigned long long> m_evicted;
+
+	MailboxState(const MailboxState &) = delete;
+	MailboxState &operator=(const MailboxState &) = delete;
+};
+
+} // namespace andre
+
+#endif // MAILBOXPOLICY_H
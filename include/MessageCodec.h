@@ -0,0 +1,109 @@
+#ifndef MESSAGECODEC_H
+#define MESSAGECODEC_H
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <typeinfo>
+
+#include "MessageData.h"
+
+#include "andre_global.h"
+
+namespace andre
+{
+
+// Сериализация наследников ConstData для передачи за пределы процесса.
+// Формат записи:
+//   [commandID 8][messageParam 8][payload]
+// (commandID и messageParam - little-endian).
+// Имена частей Handle не передаются: идентификаторы NameRegistry::intern()
+// у всех процессов одинаковы (хеш имени), другие - согласуются через bind().
+// payload пишет и читает пользовательский кодек, зарегистрированный на commandID.
+// Сообщения без кодека передаются, только если это сам ConstData;
+// наследник без кодека не сериализуется (encode возвращает false).
+class ANDRESHARED_EXPORT MessageCodec
+{
+public:
+	// дописывает в out собственные поля наследника
+	typedef std::function<bool (const ConstData &data, std::string &out)> Encoder;
+
+	// создаёт наследника по payload; поля ConstData заполнит MessageCodec
+	typedef std::function<std::unique_ptr<ConstData> (const char *payload,
+													  size_t length)> Decoder;
+
+	static MessageCodec &instance()
+	{
+		static MessageCodec theSingleInstance;
+		return theSingleInstance;
+	}
+
+	// type - тип, который создаёт decoder (nullptr - не известен)
+	void registerCodec(unsigned long long commandID,
+					   const Encoder &encoder, const Decoder &decoder,
+					   const std::type_info *type = nullptr);
+
+	// Регистрирует кодек для типа T с функциями
+	//   bool encode(const T &, std::string &out)
+	//   bool decode(const char *payload, size_t length, T &out)
+	template<typename T, typename EncodeFunc, typename DecodeFunc>
+	void registerType(unsigned long long commandID,
+					  EncodeFunc encode, DecodeFunc decode)
+	{
+		static_assert( std::is_base_of<ConstData, T>::value,
+					   "Need class derived from 'ConstData'");
+
+		registerCodec(commandID,
+			[encode](const ConstData &data, std::string &out) {
+				// с этим commandID может прийти и сообщение другого типа
+				const T *custom = dynamic_cast<const T *>(&data);
+				return nullptr != custom && encode(*custom, out);
+			},
+			[decode](const char *payload, size_t length) {
+				std::unique_ptr<T> custom = std::make_unique<T>();
+
+				if ( ! decode(payload, length, *custom) ) {
+					return std::unique_ptr<ConstData>();
+				}
+				return std::unique_ptr<ConstData>(std::move(custom));
+			},
+			&typeid(T));
+	}
+
+	void unregisterCodec(unsigned long long commandID);
+
+	// false - кодека для commandID нет; type - тип, который создаёт его
+	// декодер (nullptr - зарегистрирован registerCodec без типа)
+	bool getCodecType(unsigned long long commandID, const std::type_info *&type) const;
+
+	// сериализует сообщение в out (out очищается);
+	// false - кодек отверг сообщение либо у наследника ConstData нет кодека
+	bool encode(const ConstData &data, std::string &out) const;
+
+	// nullptr - запись повреждена или отвергнута кодеком
+	std::shared_ptr<MessageData> decode(const char *data, size_t length) const;
+
+	// читает только Handle из начала записи
+	static bool peekHandle(const char *data, size_t length, Handle &handle);
+
+private:
+	struct Codec
+	{
+		Encoder encoder;
+		Decoder decoder;
+		const std::type_info *type;
+	};
+
+	mutable std::shared_mutex m_codecsMutex;
+	std::map<unsigned long long /*commandID*/, Codec> m_codecs;
+
+	MessageCodec() {}
+	MessageCodec(const MessageCodec &root) = delete;
+	MessageCodec &operator=(const MessageCodec &) = delete;
+};
+
+} // namespace andre
+
+#endif // MESSAGECODEC_H
@@ -11,9 +11,7 @@ namespace andre
 {
 struct ANDRESHARED_EXPORT ConstData
 {
-	Handle handle;// 
-	std::string strCommandID;	
-	std::string strMessageParam;
+	Handle handle;// имена частей - NameRegistry::toString(handle)
 	
 	ConstData();
 	ConstData(const ConstData &data);
@@ -27,7 +25,7 @@ struct ANDRESHARED_EXPORT ConstData
 class ANDRESHARED_EXPORT MessageData final
 {
 public:
-	explicit MessageData(std::unique_ptr<ConstData> &data)
+	explicit MessageData(std::unique_ptr<ConstData> &data) : m_origin(0)
 	{
 		m_data = std::move(data);
 	}
@@ -36,9 +34,22 @@ public:
 	{
 		return m_data;
 	}
+
+	// Идентификатор транспорта, доставившего сообщение из другого процесса.
+	// 0 - сообщение создано в текущем процессе.
+	unsigned long long getOrigin() const
+	{
+		return m_origin;
+	}
+
+	void setOrigin(unsigned long long origin)
+	{
+		m_origin = origin;
+	}
 	
 private:
 	std::shared_ptr<const ConstData> m_data;
+	unsigned long long m_origin;
 };
 
 } // namespace andre
@@ -0,0 +1,144 @@
+#ifndef MESSAGEJOURNAL_H
+#define MESSAGEJOURNAL_H
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MessageData.h"
+#include "Handle.hpp"
+
+#include "andre_global.h"
+
+namespace multithread
+{
+class ByteRing;
+}
+
+namespace andre
+{
+
+enum class JournalFsync
+{
+	Never,			// сброс на диск - на усмотрение ОС
+	EveryCommit,	// msync после каждой группы записей
+	Interval		// msync не чаще fsyncInterval
+};
+
+enum class JournalReplayMode
+{
+	RecordedTiming,		// с интервалами, как при записи
+	AsFastAsPossible
+};
+
+struct ANDRESHARED_EXPORT MessageJournalConfig
+{
+	std::string directory;
+	size_t segmentSize = 64 * 1024 * 1024;
+
+	JournalFsync fsyncPolicy = JournalFsync::Interval;
+	std::chrono::milliseconds fsyncInterval{100};
+
+	// максимальное количество записей в одной группе (group commit)
+	size_t maxBatch = 4096;
+
+	// очередь между производителями и потоком записи
+	uint32_t ringSlots = 65536;		// степень двойки
+	uint32_t slotSize = 4096;		// максимальный размер сериализованного сообщения
+
+	// пауза потока записи, когда очередь пуста
+	std::chrono::microseconds idleSleep{200};
+};
+
+// Журнал сообщений, прошедших через AsyncOperProcessor::postMessage.
+// Выбранные Handle'ы сериализуются MessageCodec'ом в неблокирующее кольцо
+// (в потоке производителя - без системных вызовов), поток записи группами
+// переносит их в сегменты - отображённые в память файлы фиксированного размера.
+//
+// Формат записи сегмента (выровнена по 8 байт):
+//   [длина тела 4][контрольная сумма 4][timestamp 8][тело - формат MessageCodec]
+// Нулевая длина - конец сегмента.
+class ANDRESHARED_EXPORT MessageJournal
+{
+public:
+	explicit MessageJournal(const MessageJournalConfig &config);
+	~MessageJournal();
+
+	// Выбор журналируемых Handle'ов. Только до start().
+	bool addHandle(const Handle &handle);
+	bool addHandleRange(const HandleRange &range);
+
+	// Создаёт каталог и новый сегмент, запускает поток записи и подключает
+	// журнал к AsyncOperProcessor.
+	bool start();
+
+	// Отключает журнал, дописывает накопленное и синхронизирует файлы.
+	void stop();
+
+	bool isSelected(const Handle &handle) const;
+
+	// Вызывается из postMessage. Не блокируется: при переполнении очереди
+	// сообщение не записывается и учитывается в getDroppedCount().
+	bool append(const std::shared_ptr<MessageData> &msg);
+
+	// Проигрывает все сегменты каталога через postMessage.
+	// Сообщения воспроизведения повторно не журналируются.
+	// Возвращает количество отправленных сообщений.
+	size_t replay(JournalReplayMode mode, double speed = 1.0);
+
+	unsigned long long getAppendedCount() const { return m_appended; }
+	unsigned long long getDroppedCount() const { return m_dropped; }
+	unsigned long long getWrittenCount() const { return m_written; }
+	unsigned long long getCommitCount() const { return m_commits; }
+
+private:
+	MessageJournalConfig m_config;
+
+	std::set<Handle> m_handles;
+	std::vector<HandleRange> m_ranges;
+
+	std::atomic<bool> m_running;
+	std::thread m_writerThread;
+
+	std::unique_ptr<uint64_t[]> m_ringMemory;
+	multithread::ByteRing *m_ring;
+
+	// текущий сегмент; только поток записи
+	int m_segmentFd;
+	char *m_segment;
+	size_t m_segmentPos;
+	size_t m_syncedPos;
+	unsigned int m_segmentIndex;
+	std::chrono::steady_clock::time_point m_lastSync;
+
+	std::atomic<unsigned long long> m_appended;
+	std::atomic<unsigned long long> m_dropped;
+	std::atomic<unsigned long long> m_written;
+	std::atomic<unsigned long long> m_commits;
+
+	void writerLoop();
+	bool writeRecord(const char *data, size_t length);
+	void commit(bool force);
+
+	bool openSegment(unsigned int index);
+	void closeSegment();
+
+	std::vector<std::string> listSegments() const;
+	std::string segmentPath(unsigned int index) const;
+
+	unsigned long long getOriginTag() const
+	{
+		return reinterpret_cast<unsigned long long>(this);
+	}
+
+	MessageJournal(const MessageJournal &) = delete;
+	MessageJournal &operator=(const MessageJournal &) = delete;
+};
+
+} // namespace andre
+
+#endif // MESSAGEJOURNAL_H
@@ -0,0 +1,84 @@
+#ifndef NAMEREGISTRY_H
+#define NAMEREGISTRY_H
+
+#include <cstdint>
+#include <deque>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "Handle.hpp"
+
+#include "andre_global.h"
+
+namespace andre
+{
+
+// Таблица имён команд (и других частей Handle) процесса.
+// Идентификатор имени - его 64-битный хеш (FNV-1a с перемешиванием) с
+// установленным старшим битом, который отделяет имена от небольших чисел,
+// заданных напрямую. Хеш не зависит от порядка вызовов, сборки и процесса,
+// поэтому разные процессы и журнал после перезапуска получают одни и те же
+// идентификаторы - их и передают транспорты.
+// Разные имена никогда не получают один идентификатор: при совпадении хешей
+// (или идентификатора, занятого bind()) имя получает следующий свободный -
+// только такой идентификатор зависит от порядка вызовов; если это недопустимо,
+// идентификатор задаётся явно - bind().
+// Идентификатор стоит получить один раз и хранить: intern() берёт блокировку.
+class ANDRESHARED_EXPORT NameRegistry
+{
+public:
+	// 0 - не имя
+	static const unsigned long long kInvalidID = 0;
+
+	// старший бит идентификаторов intern()
+	static const unsigned long long kNameBit = 1ULL << 63;
+
+	static NameRegistry &instance()
+	{
+		static NameRegistry theSingleInstance;
+		return theSingleInstance;
+	}
+
+	// идентификатор имени: hashOf(name), при коллизии - следующий свободный
+	unsigned long long intern(std::string_view name);
+
+	// идентификатор, который intern() выдаёт имени без коллизий
+	static unsigned long long hashOf(std::string_view name);
+
+	// Связывает имя с заданным идентификатором.
+	// false - коллизия: имя связано с другим идентификатором
+	// или идентификатор - с другим именем.
+	bool bind(std::string_view name, unsigned long long id);
+
+	// false - имя не зарегистрировано
+	bool find(std::string_view name, /*out*/ unsigned long long &id) const;
+
+	// false - идентификатор не зарегистрирован
+	bool nameOf(unsigned long long id, /*out*/ std::string &name) const;
+
+	// "имя/параметр" для диагностики; незарегистрированные части - числами
+	std::string toString(const Handle &handle) const;
+
+	size_t size() const;
+
+private:
+	mutable std::shared_mutex m_mutex;
+	std::unordered_map<std::string, unsigned long long> m_ids;
+	std::unordered_map<unsigned long long, const std::string *> m_names;
+
+	// нужно для const std::string * в m_names
+	std::deque<std::string> m_storage;
+
+	const std::string *unlockedNameOf(unsigned long long id) const;
+	void unlockedAdd(std::string_view name, unsigned long long id);
+
+	NameRegistry() {}
+	NameRegistry(const NameRegistry &root) = delete;
+	NameRegistry &operator=(const NameRegistry &) = delete;
+};
+
+} // namespace andre
+
+#endif // NAMEREGISTRY_H
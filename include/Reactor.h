@@ -2,7 +2,14 @@
 #define REACTOR_H
 
 #include "EventHandler.h"
+#include "MailboxPolicy.h"
 #include "threadsafequeue.hpp"
+#include "affinity.hpp"
+
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
 
 #include "andre_global.h"
 
@@ -10,20 +17,43 @@ namespace andre
 {
 
 
+enum class ReactorEventKind : uint8_t
+{
+	Message,	// сообщение для handler
+	Handoff,	// handler переносится на targetReactor: его прежние сообщения обработаны
+	Resume,		// handler перенесён сюда: можно обрабатывать отложенные сообщения
+	Conflated,	// место в очереди для последнего сообщения handler'а с этим Handle
+	Drain		// конец очереди при остановке: всё, что стояло до него, обработано
+};
+
 struct ANDRESHARED_EXPORT ReactorEvent
 {
 	EventHandler *handler;
 	std::shared_ptr<MessageData> message;
+	ReactorEventKind kind = ReactorEventKind::Message;
+	size_t targetReactor = 0;
+	
+	// политика Handle сообщения; nullptr - без политики
+	MailboxState *mailbox = nullptr;
+	
+	// после этого момента сообщение не доставляется (MailboxPolicy::ttl)
+	std::chrono::steady_clock::time_point deadline{};
 };
 
 class ANDRESHARED_EXPORT Reactor
 {
+	friend class AsyncOperProcessor;
+	
 public:
 	Reactor();	
 	virtual ~Reactor();
 	
 	// Дополнительная инициализация. Вызывается после конструирования реактора
 	virtual void auxInit(){}
+
+	// 0 - реактор готов к работе, иначе errno неудавшегося конструирования;
+	// такой реактор не регистрируется
+	virtual int getInitError() const { return 0; }
 	
 	// Цикл очереди сообщений
 	virtual void handleEvents();
@@ -36,18 +66,101 @@ public:
 	bool addEvent(EventHandler *handler,
 				  const std::shared_ptr<MessageData> &message);
 	
-	void exit();
+	// Добавляем в очередь сообщение по политике mailbox (nullptr - без политики)
+	bool addEvent(EventHandler *handler,
+				  const std::shared_ptr<MessageData> &message,
+				  MailboxState *mailbox);
+	
+	// Добавляем в очередь событие, в том числе служебное (перенос обработчика).
+	// При переполнении сообщение с политикой dropOldest вытесняет голову очереди,
+	// если там тоже такое сообщение.
+	bool addEvent(const ReactorEvent &event);
+	
+	// количество событий, ждущих в очереди
+	size_t getQueueSize() const
+	{
+		return m_events.size();
+	}
+	
+	// Время в обработчиках и число обработанных сообщений.
+	// Считаются, пока включён setMeasureBusyTime(true).
+	unsigned long long getBusyNs() const
+	{
+		return m_busyNs;
+	}
+	
+	unsigned long long getHandledCount() const
+	{
+		return m_handledCount;
+	}
+	
+	// замер времени обработки во всех реакторах
+	static void setMeasureBusyTime(bool measure);
+	
+	virtual void exit();
+	
+	// Остановка с обработкой очереди: реактор обрабатывает события, стоящие
+	// в очереди, и завершается, дойдя до её конца. События, не обработанные
+	// к deadline, отбрасываются. Вызывается один раз, из любого потока.
+	bool beginDrain(std::chrono::steady_clock::time_point deadline);
+	
+	// Принудительно завершает остановку (обработчик не вернул управление
+	// к deadline): очередь отбрасывается.
+	void abortDrain();
+	
+	// остановка завершена, счётчики окончательны
+	bool isDrained() const
+	{
+		return m_drainDone;
+	}
+	
+	// сообщения, доставленные и отброшенные после beginDrain() (без служебных событий)
+	unsigned long long getDrainProcessed() const
+	{
+		return m_drainProcessed;
+	}
+	
+	unsigned long long getDrainDiscarded() const
+	{
+		return m_drainDiscarded;
+	}
+	
+	// Привязывает поток реактора к процессорам cpus.
+	// Вызывается только из потока реактора.
+	bool setAffinity(const multithread::CpuSet &cpus);
+	
+	// Узел NUMA, на котором размещается очередь сообщений; -1 - не определён.
+	// Выбирается при создании реактора по привязке создающего (своего) потока,
+	// поэтому поток стоит привязать до первой регистрации обработчика.
+	int getNumaNode() const
+	{
+		return m_numaNode;
+	}
+	
+	// узел процессоров, заданных setAffinity; -1 - не привязан или несколько узлов
+	int getAffinityNode() const
+	{
+		return m_affinityNode;
+	}
 	
 protected:
 	std::atomic<bool> m_exit; 
 	
+	const int m_numaNode;
+	std::atomic<int> m_affinityNode;
+	
 	// Очередь сообщений
-	multithread::SimpleQueue<ReactorEvent> m_events;
+	multithread::SimpleQueue<ReactorEvent,
+							 multithread::NodeAllocator<ReactorEvent> > m_events;
 	
 	// Максимальное количество event'ов-сообщений
 	//,одновременно ждущих в очереди на обработку
 	const int maxQueueSize = 100000;
 	
+	// Вызывается после успешного добавления события в очередь.
+	// Наследники, ждущие не только на m_events, будят здесь свой цикл.
+	virtual void wakeUp() {}
+	
 	// Позволяет получить доступ к вызову функции 'EventHandler::handleEvent()'
 	// из классов-наследников Reactor'а
 	inline void handleEvent(EventHandler *handler,
@@ -56,6 +169,95 @@ protected:
 		handler->handleEvent(msg);
 	}
 	
+	// Обработка события из очереди. Циклы наследников вызывают её
+	// вместо handleEvent(), чтобы работал перенос обработчиков между реакторами.
+	void dispatchEvent(ReactorEvent &event);
+	
+	// Сообщение можно отдать обработчику типа staticType напрямую, минуя
+	// dispatchEvent(): нет политики очереди, переноса и замера времени.
+	bool isDirectDelivery(const ReactorEvent &event, const void *staticType) const
+	{
+		return ReactorEventKind::Message == event.kind &&
+			   staticType == event.handler->m_staticType &&
+			   nullptr == event.mailbox &&
+			   ! s_measureBusyTime.load(std::memory_order_relaxed) &&
+			   ! m_draining.load(std::memory_order_relaxed) &&
+			   ! event.handler->m_blocking.load(std::memory_order_relaxed) &&
+			   event.handler->m_migrationTarget.load(std::memory_order_acquire) != this;
+	}
+	
+private:
+	static std::atomic<bool> s_measureBusyTime;
+	
+	std::atomic<unsigned long long> m_busyNs;
+	std::atomic<unsigned long long> m_handledCount;
+	
+	std::atomic<bool> m_draining;
+	std::atomic<bool> m_drainClaimed;	// завершение остановки взял поток реактора или abortDrain
+	std::atomic<bool> m_drainDone;		// счётчики окончательны
+	std::chrono::steady_clock::time_point m_drainDeadline;
+	std::atomic<unsigned long long> m_drainProcessed;
+	std::atomic<unsigned long long> m_drainDiscarded;
+	
+	// подключён attachReactor: своего потока нет
+	bool m_attached;
+	
+	// учёт события при остановке; false - событие не обрабатывается
+	bool drainStep(ReactorEvent &event);
+	bool claimDrain();
+	void finishDrain();
+	unsigned long long discardPending();
+	unsigned long long discardHeld();
+	
+	// остановка реактора без потока: очередь разбирает вызывающий поток
+	void runDrain();
+	
+	// событие с сообщением обработчику (не служебное)
+	bool carriesMessage(const ReactorEvent &event);
+	
+	// сообщения обработчиков, переносимых на этот реактор, до их Resume
+	std::unordered_map<EventHandler *, std::deque<ReactorEvent> > m_held;
+	
+	struct ConflationKey
+	{
+		EventHandler *handler;
+		Handle handle;
+		
+		bool operator==(const ConflationKey &right) const
+		{
+			return handler == right.handler && handle == right.handle;
+		}
+	};
+	
+	struct ConflationKeyHash
+	{
+		size_t operator()(const ConflationKey &key) const
+		{
+			return std::hash<EventHandler *>()(key.handler) ^ HandleHash()(key.handle);
+		}
+	};
+	
+	struct ConflatedMessage
+	{
+		std::shared_ptr<MessageData> message;
+		std::chrono::steady_clock::time_point deadline;
+	};
+	
+	// последние сообщения, ждущие своего места (Conflated) в очереди
+	std::mutex m_conflationMutex;
+	std::unordered_map<ConflationKey, ConflatedMessage, ConflationKeyHash> m_conflated;
+	
+	bool addConflated(const ReactorEvent &event);
+	
+	// подставляет в Conflated-событие последнее сообщение; false - его нет
+	bool takeConflated(ReactorEvent &event);
+	
+	// true - срок сообщения истёк, оно учтено и не доставляется
+	static bool dropIfExpired(const ReactorEvent &event);
+	
+	void deliver(ReactorEvent &event);
+	void invokeHandler(EventHandler *handler, const std::shared_ptr<MessageData> &msg);
+	void resumeHeld(EventHandler *handler);
 };
 
 } // namespace andre
@@ -0,0 +1,91 @@
+#ifndef REACTORBALANCER_H
+#define REACTORBALANCER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include "AsyncOperProcessor.h"
+
+#include "andre_global.h"
+
+namespace andre
+{
+
+struct ANDRESHARED_EXPORT ReactorBalancerConfig
+{
+	// период проверки нагрузки
+	std::chrono::milliseconds interval{200};
+
+	// Перекос очередей: самая длинная не короче minQueueDepth
+	// и в queueRatio раз длиннее самой короткой.
+	size_t minQueueDepth = 1000;
+	double queueRatio = 4.0;
+
+	// Перекос занятости: разница времени в обработчиках за период
+	// больше busyImbalance от длины периода.
+	double busyImbalance = 0.5;
+
+	// сколько периодов перенесённый обработчик не переносится снова
+	unsigned int cooldownIntervals = 5;
+};
+
+// Переносит обработчики между реакторами одного типа.
+// Вручную - migrate(), автоматически - поток, запущенный start(): раз в период
+// сравнивает очереди и занятость реакторов и переносит (не больше одного
+// обработчика на группу реакторов одного типа за период) с самого нагруженного
+// на самый свободный обработчик, больше всех занявший реактор, но не больше
+// половины разницы - чтобы нагрузка не перескакивала туда-обратно.
+// Пока поток работает, включён замер времени обработки (Reactor::setMeasureBusyTime).
+class ANDRESHARED_EXPORT ReactorBalancer
+{
+public:
+	explicit ReactorBalancer(const ReactorBalancerConfig &config = ReactorBalancerConfig());
+	~ReactorBalancer();
+
+	// перенос обработчика на реактор toReactorID (см. AsyncOperProcessor::migrateHandler)
+	bool migrate(EventHandler *handler, size_t toReactorID);
+
+	bool start();
+	void stop();
+
+	// один шаг автоматической политики; возвращает количество переносов
+	size_t rebalance();
+
+	unsigned long long getMigrationCount() const { return m_migrations; }
+
+private:
+	ReactorBalancerConfig m_config;
+
+	std::atomic<bool> m_running;
+	std::thread m_thread;
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+
+	// только в rebalance()
+	std::map<size_t, unsigned long long> m_lastReactorBusy;
+	std::map<EventHandler *, unsigned long long> m_lastHandlerBusy;
+	std::map<EventHandler *, unsigned long long> m_lastHandlerCount;
+	std::map<EventHandler *, unsigned long long> m_cooldown;	// до какого шага не трогать
+	unsigned long long m_tick;
+
+	// прирост счётчиков за последний период
+	std::map<size_t, unsigned long long> m_reactorDelta;
+	std::map<EventHandler *, unsigned long long> m_busyDelta;
+	std::map<EventHandler *, unsigned long long> m_countDelta;
+
+	std::atomic<unsigned long long> m_migrations;
+
+	void threadLoop();
+	bool rebalanceGroup(const std::vector<const ReactorLoad *> &group);
+
+	ReactorBalancer(const ReactorBalancer &) = delete;
+	ReactorBalancer &operator=(const ReactorBalancer &) = delete;
+};
+
+} // namespace andre
+
+#endif // REACTORBALANCER_H
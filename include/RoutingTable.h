@@ -0,0 +1,189 @@
+#ifndef ROUTINGTABLE_H
+#define ROUTINGTABLE_H
+
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+#include "Handle.hpp"
+
+#include "andre_global.h"
+
+namespace andre
+{
+
+class EventHandler;
+
+// Обработчики одного Handle, сгруппированные по реакторам
+typedef std::map< size_t /*reactorID*/,
+				  std::set<EventHandler* /*handler*/> > ReactorHandlers;
+
+// Подписка обработчика на диапазон messageParam
+struct ANDRESHARED_EXPORT RangeSubscription
+{
+	unsigned long long paramFrom;
+	unsigned long long paramTo;
+	size_t reactorID;
+	EventHandler *handler;
+};
+
+// Все подписки одной команды (commandID)
+struct ANDRESHARED_EXPORT CommandRoute
+{
+	// точные подписки: messageParam -> обработчики
+	std::unordered_map< unsigned long long /*messageParam*/,
+						ReactorHandlers > exact;
+
+	// подписки на диапазоны и wildcard, отсортированы по paramFrom
+	std::vector<RangeSubscription> ranges;
+
+	bool empty() const
+	{
+		return exact.empty() && ranges.empty();
+	}
+};
+
+// Подписки, добавляемые в RoutingTable одним вызовом addBatch().
+// Заполняется и сортируется без блокировки таблицы.
+class ANDRESHARED_EXPORT RoutingBatch
+{
+	friend class RoutingTable;
+
+public:
+	void reserve(size_t exactCount, size_t rangeCount);
+
+	void add(const Handle &handle, size_t reactorID, EventHandler *handler);
+	void add(const HandleRange &range, size_t reactorID, EventHandler *handler);
+
+	// сортирует подписки по commandID и messageParam; вызывается перед addBatch()
+	void prepare();
+
+	size_t size() const
+	{
+		return m_exact.size() + m_ranges.size();
+	}
+
+private:
+	struct ExactEntry
+	{
+		Handle handle;
+		size_t reactorID;
+		EventHandler *handler;
+	};
+
+	struct RangeEntry
+	{
+		unsigned long long commandID;
+		RangeSubscription subscription;
+	};
+
+	std::vector<ExactEntry> m_exact;
+	std::vector<RangeEntry> m_ranges;
+};
+
+// Двухуровневый индекс маршрутизации: commandID -> messageParam -> обработчики.
+// Не потокобезопасен, синхронизация - на стороне AsyncOperProcessor.
+class ANDRESHARED_EXPORT RoutingTable
+{
+public:
+	void add(const Handle &handle, size_t reactorID, EventHandler *handler);
+	void add(const HandleRange &range, size_t reactorID, EventHandler *handler);
+
+	// Добавляет все подписки batch (после batch.prepare()).
+	// Таблицы команд резервируются заранее, диапазоны команды сортируются один раз.
+	void addBatch(const RoutingBatch &batch);
+
+	// удаляет подписку обработчика во всех реакторах
+	void remove(const Handle &handle, EventHandler *handler);
+	void remove(const HandleRange &range, EventHandler *handler);
+
+	// удаляет точную подписку всех обработчиков на handle
+	void removeHandle(const Handle &handle);
+
+	// удаляет всё, что относится к реактору
+	void removeReactor(size_t reactorID);
+
+	// Переводит все подписки обработчика с реактора fromReactorID на toReactorID.
+	// Возвращает количество перенесённых подписок.
+	size_t moveHandler(EventHandler *handler, size_t fromReactorID, size_t toReactorID);
+
+	// реакторы, на которых зарегистрирован обработчик
+	std::set<size_t> reactorsOf(EventHandler *handler) const;
+
+	// обработчики, зарегистрированные на реакторе
+	std::set<EventHandler *> handlersOf(size_t reactorID) const;
+
+	// подписан ли обработчик реактора на handle (точно или через диапазон)
+	bool contains(const Handle &handle, size_t reactorID,
+				  EventHandler *handler) const;
+
+	// количество точных Handle и диапазонных подписок
+	size_t size() const;
+
+	// Вызывает func(reactorID, handler) для каждого получателя сообщения.
+	// Обработчик, подписанный и точно, и через диапазоны, получает сообщение один раз.
+	// Возвращает false, если на handle никто не подписан.
+	template<typename Function>
+	bool forEachTarget(const Handle &handle, Function func) const
+	{
+		auto itCommand = m_commands.find(handle.commandID);
+
+		if ( m_commands.end() == itCommand ) {
+			return false;
+		}
+
+		const CommandRoute &route = itCommand->second;
+		const ReactorHandlers *exactHandlers = nullptr;
+		auto itExact = route.exact.find(handle.messageParam);
+
+		if ( route.exact.end() != itExact ) {
+			exactHandlers = &itExact->second;
+
+			for ( const auto &reactId_HandlerSet : *exactHandlers ) {
+				for ( EventHandler *handler : reactId_HandlerSet.second ) {
+					func(reactId_HandlerSet.first, handler);
+				}
+			}
+		}
+
+		if ( route.ranges.empty() ) {
+			return nullptr != exactHandlers;
+		}
+
+		bool found = ( nullptr != exactHandlers );
+
+		for ( auto itRange = route.ranges.begin();
+			  itRange != route.ranges.end() &&
+			  itRange->paramFrom <= handle.messageParam; ++ itRange ) {
+
+			if ( handle.messageParam > itRange->paramTo ) {
+				continue;
+			}
+			found = true;
+
+			if ( isDelivered(exactHandlers, route.ranges.begin(), itRange,
+							 handle.messageParam) ) {
+				continue;
+			}
+			func(itRange->reactorID, itRange->handler);
+		}
+
+		return found;
+	}
+
+private:
+	std::unordered_map< unsigned long long /*commandID*/,
+						CommandRoute > m_commands;
+
+	// получил ли обработчик диапазона itRange сообщение раньше:
+	// через точную подписку или через другой диапазон
+	static bool isDelivered(const ReactorHandlers *exactHandlers,
+							std::vector<RangeSubscription>::const_iterator itBegin,
+							std::vector<RangeSubscription>::const_iterator itRange,
+							unsigned long long messageParam);
+};
+
+} // namespace andre
+
+#endif // ROUTINGTABLE_H
@@ -0,0 +1,69 @@
+#ifndef SHARDGROUP_H
+#define SHARDGROUP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "andre_global.h"
+
+namespace andre
+{
+
+class EventHandler;
+
+// Номер корзины [0, buckets) для key (jump consistent hash, Lamping & Veach).
+// При переходе от n к n + 1 корзинам меняют корзину только ~1/(n + 1) ключей,
+// и все они переходят в новую корзину n.
+inline std::size_t jumpConsistentHash(uint64_t key, std::size_t buckets)
+{
+	int64_t bucket = -1;
+	int64_t next = 0;
+
+	while ( next < static_cast<int64_t>(buckets) ) {
+		bucket = next;
+		key = key * 2862933555777941757ULL + 1;
+		next = static_cast<int64_t>( (bucket + 1) *
+				( static_cast<double>(1LL << 31) / static_cast<double>((key >> 33) + 1) ) );
+	}
+
+	return static_cast<std::size_t>(bucket);
+}
+
+// Логический обработчик из нескольких шардов - обработчиков на разных реакторах,
+// подписанных на одни и те же Handle. Сообщение получает один шард, выбранный
+// по messageParam, поэтому сообщения одного ключа обрабатываются по порядку.
+// Создаётся и меняется через AsyncOperProcessor, живёт до конца его работы.
+// Не потокобезопасен, синхронизация - на стороне AsyncOperProcessor.
+class ANDRESHARED_EXPORT ShardGroup
+{
+	friend class AsyncOperProcessor;
+
+public:
+	// номер резервного обработчика группы: не совпадает ни с одним шардом
+	static constexpr std::size_t kStandby = std::numeric_limits<std::size_t>::max();
+
+	// номер шарда для ключа messageParam
+	std::size_t shardOf(unsigned long long messageParam) const
+	{
+		return jumpConsistentHash(messageParam, m_shards.size());
+	}
+
+	std::size_t size() const
+	{
+		return m_shards.size();
+	}
+
+	const std::vector<EventHandler *> &getShards() const
+	{
+		return m_shards;
+	}
+
+private:
+	std::vector<EventHandler *> m_shards;
+};
+
+} // namespace andre
+
+#endif // SHARDGROUP_H
@@ -0,0 +1,196 @@
+#ifndef SHMTRANSPORT_H
+#define SHMTRANSPORT_H
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "EventHandler.h"
+#include "Handle.hpp"
+
+#include "andre_global.h"
+
+namespace multithread
+{
+class ByteRing;
+}
+
+namespace andre
+{
+
+struct ShmRegion;
+struct ShmPeerSlot;
+class ShmPeerProxy;
+
+struct ANDRESHARED_EXPORT ShmTransportConfig
+{
+	// Параметры разделяемой области. Должны совпадать у всех процессов.
+	uint32_t maxPeers = 16;
+	uint32_t slotCount = 4096;		// степень двойки
+	uint32_t slotSize = 1024;		// максимальный размер сериализованного сообщения
+	uint32_t maxSubscriptions = 256;
+
+	std::chrono::milliseconds heartbeatInterval{100};
+
+	// пир без heartbeat дольше этого времени считается мёртвым
+	std::chrono::milliseconds peerTimeout{1000};
+
+	// сколько раз повторять запись в заполненное кольцо пира, прежде чем
+	// отбросить сообщение
+	unsigned int fullRingRetries = 1000;
+};
+
+// Транспорт между AsyncOperProcessor'ами разных процессов одного хоста.
+// Процессы отображают одну разделяемую область (shm_open/mmap), в которой
+// у каждого пира есть слот: pid, heartbeat, список подписок и входящее
+// MPSC-кольцо (multithread::ByteRing).
+//
+// Подписки пира видны остальным процессам как локальные подписчики:
+// на его Handle'ы регистрируется прокси (ShmPeerProxy), который сериализует
+// сообщения через MessageCodec и пишет их в кольцо пира. Сервисный поток
+// пира читает своё кольцо и отдаёт сообщения в postMessage.
+// Ядро на пути данных не участвует.
+class ANDRESHARED_EXPORT ShmTransport
+{
+	friend class ShmPeerProxy;
+
+public:
+	explicit ShmTransport(const std::string &regionName,
+						  const ShmTransportConfig &config = ShmTransportConfig());
+	~ShmTransport();
+
+	// подключается к области (создаёт её при необходимости), занимает слот
+	// и запускает потоки транспорта
+	bool start();
+	void stop();
+
+	// Сообщения на эти Handle'ы, отправленные в других процессах,
+	// будут доставлены в локальный postMessage.
+	bool subscribe(const Handle &handle);
+	bool subscribe(const HandleRange &range);
+	bool unsubscribe(const HandleRange &range);
+
+	// номер слота текущего процесса, -1 - транспорт не запущен
+	int getPeerIndex() const
+	{
+		return m_peerIndex;
+	}
+
+	std::vector<int> getAlivePeers() const;
+
+	// вызывается из сервисного потока при обнаружении мёртвого пира
+	void setPeerDownCallback(const std::function<void (int peerIndex)> &callback)
+	{
+		m_peerDownCallback = callback;
+	}
+
+	unsigned long long getSentCount() const { return m_sent; }
+	unsigned long long getReceivedCount() const { return m_received; }
+	unsigned long long getDroppedCount() const { return m_dropped; }
+
+	// удаляет имя области из системы (отображения живых процессов остаются)
+	static bool unlinkRegion(const std::string &regionName);
+
+private:
+	// останавливает reactor-поток прокси
+	class StopHandler : public EventHandler
+	{
+	public:
+		explicit StopHandler(const Handle &handle)
+		{
+			addHandle(handle);
+			setMigratable(false);
+		}
+
+	private:
+		void handleEvent(const std::shared_ptr<MessageData> &) override;
+	};
+
+	struct PeerState
+	{
+		int pid = 0;
+		uint64_t generation = 0;
+		uint64_t subscriptionVersion = 0;
+		ShmPeerProxy *proxy = nullptr;
+	};
+
+	std::string m_regionName;
+	ShmTransportConfig m_config;
+
+	ShmRegion *m_region;
+	size_t m_regionSize;
+	int m_peerIndex;
+
+	std::atomic<bool> m_running;
+	std::thread m_dispatcherThread;	// reactor-поток прокси
+	std::thread m_serviceThread;	// входящее кольцо, heartbeat, слежение за пирами
+	size_t m_dispatcherThreadID;
+
+	std::unique_ptr<StopHandler> m_stopHandler;
+	Handle m_stopHandle;
+
+	// подписки текущего процесса, пишутся в слот под m_subscriptionsMutex
+	std::mutex m_subscriptionsMutex;
+	std::vector<HandleRange> m_subscriptions;
+
+	// состояние других пиров; только сервисный поток
+	std::map<int, PeerState> m_peers;
+	std::vector<ShmPeerProxy *> m_retiredProxies;
+
+	// голова входящего кольца занята, но не опубликована; только сервисный поток
+	bool m_stalled;
+	uint64_t m_stalledPos;
+	std::chrono::steady_clock::time_point m_stalledSince;
+
+	std::function<void (int)> m_peerDownCallback;
+
+	std::atomic<unsigned long long> m_sent;
+	std::atomic<unsigned long long> m_received;
+	std::atomic<unsigned long long> m_dropped;
+
+	bool mapRegion();
+	void unmapRegion();
+	bool claimSlot();
+	void releaseSlot();
+
+	ShmPeerSlot *slotAt(int peerIndex) const;
+	multithread::ByteRing *ringAt(int peerIndex) const;
+	void publishSubscriptions();
+	bool readSubscriptions(ShmPeerSlot *slot, std::vector<HandleRange> &out,
+						   uint64_t &version) const;
+
+	void dispatcherLoop(std::promise<void> *registered);
+	void serviceLoop();
+	bool drainInbox();
+	bool skipStalledSlot(multithread::ByteRing *ring);
+	void heartbeat();
+	void scanPeers();
+	bool isPeerDead(ShmPeerSlot *slot) const;
+	void dropPeer(int peerIndex, bool reclaim);
+	void replaceProxy(int peerIndex, PeerState &state,
+					  const std::vector<HandleRange> &subscriptions);
+	void reapRetiredProxies(bool force);
+
+	// пишет сообщение в кольцо пира; вызывается из прокси
+	bool sendToPeer(int peerIndex, uint64_t generation,
+					const std::shared_ptr<MessageData> &msg);
+
+	unsigned long long getOriginTag() const
+	{
+		return reinterpret_cast<unsigned long long>(this);
+	}
+
+	ShmTransport(const ShmTransport &) = delete;
+	ShmTransport &operator=(const ShmTransport &) = delete;
+};
+
+} // namespace andre
+
+#endif // SHMTRANSPORT_H
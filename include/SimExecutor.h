@@ -0,0 +1,132 @@
+#ifndef SIMEXECUTOR_H
+#define SIMEXECUTOR_H
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <random>
+#include <vector>
+
+#include "AsyncOperProcessor.h"
+
+#include "andre_global.h"
+
+namespace andre
+{
+
+class SimReactor;
+
+struct ANDRESHARED_EXPORT SimExecutorConfig
+{
+	// зерно планировщика: одно зерно - один и тот же порядок обработки
+	unsigned long long seed = 1;
+
+	// виртуальное время, которое занимает обработка одного события
+	std::chrono::nanoseconds stepTime{1000};
+};
+
+// Исполнитель для тестов: виртуальные реакторы работают в одном вызывающем потоке.
+// Сообщения идут обычным путём AsyncOperProcessor -> очередь реактора ->
+// Reactor::dispatchEvent, поэтому порядок сообщений обработчика тот же, что и
+// у настоящих реакторов. Какой реактор обрабатывает следующее событие, выбирает
+// генератор с заданным зерном, время - виртуальное (now()): оно идёт на stepTime
+// за событие, а когда событий нет, перескакивает к ближайшему таймеру.
+//
+// Обработчики одного сообщения на одном реакторе вызываются в порядке адресов,
+// поэтому для точного повторения прогона каждый актор стоит держать на своём
+// реакторе. waitInLoop, getCurrentReactor и shutdownReactorDispatcher
+// в обработчиках виртуальных реакторов не работают (у реактора нет потока),
+// MailboxPolicy::ttl отсчитывается по настоящему времени.
+class ANDRESHARED_EXPORT SimExecutor
+{
+public:
+	explicit SimExecutor(const SimExecutorConfig &config = SimExecutorConfig());
+
+	// отключает свои реакторы от AsyncOperProcessor
+	~SimExecutor();
+
+	// создаёт виртуальный реактор; возвращает его номер в исполнителе (0, 1, ...)
+	size_t addReactor();
+
+	size_t getReactorCount() const
+	{
+		return m_reactors.size();
+	}
+
+	// регистрирует обработчик на виртуальном реакторе reactor
+	bool registerHandler(size_t reactor, EventHandler *handler);
+
+	// ID реактора в AsyncOperProcessor (для migrateHandler и т.п.)
+	size_t getReactorID(size_t reactor) const;
+
+	std::chrono::nanoseconds now() const
+	{
+		return m_now;
+	}
+
+	// вызывает func через delay виртуального времени
+	void schedule(std::chrono::nanoseconds delay, const std::function<void ()> &func);
+
+	// отправляет сообщение через delay виртуального времени
+	void postAfter(std::chrono::nanoseconds delay, const std::shared_ptr<MessageData> &msg);
+
+	// Обрабатывает одно событие или срабатывание таймеров.
+	// false - делать нечего.
+	bool step();
+
+	// до исчерпания событий и таймеров, не больше maxSteps шагов;
+	// возвращает количество шагов
+	size_t runUntilIdle(size_t maxSteps = size_t(-1));
+
+	// пока виртуальное время не дойдёт до now() + duration
+	size_t runFor(std::chrono::nanoseconds duration);
+
+	// обработано событий всего и реактором reactor
+	unsigned long long getDispatchedCount() const
+	{
+		return m_dispatched;
+	}
+
+	unsigned long long getDispatchedCount(size_t reactor) const;
+
+private:
+	struct Timer
+	{
+		std::chrono::nanoseconds time;
+		unsigned long long sequence;	// таймеры одного момента - в порядке постановки
+		std::function<void ()> func;
+
+		bool operator>(const Timer &right) const
+		{
+			if ( time != right.time ) {
+				return time > right.time;
+			}
+			return sequence > right.sequence;
+		}
+	};
+
+	SimExecutorConfig m_config;
+	std::mt19937_64 m_random;
+	std::chrono::nanoseconds m_now;
+	unsigned long long m_dispatched;
+	unsigned long long m_timerSequence;
+
+	std::vector< std::shared_ptr<SimReactor> > m_reactors;
+	std::vector<size_t> m_reactorIDs;
+	std::vector<unsigned long long> m_reactorDispatched;
+	std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer> > m_timers;
+
+	// ключ реактора вместо идентификатора потока
+	static size_t threadKey(const std::shared_ptr<SimReactor> &reactor);
+
+	// вызывает таймеры, чьё время не позже now(); false - таких не было
+	bool fireTimers();
+
+	SimExecutor(const SimExecutor &) = delete;
+	SimExecutor &operator=(const SimExecutor &) = delete;
+};
+
+} // namespace andre
+
+#endif // SIMEXECUTOR_H
@@ -0,0 +1,146 @@
+#ifndef SOCKETBRIDGE_H
+#define SOCKETBRIDGE_H
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "EventHandler.h"
+#include "IoReactor.h"
+#include "Handle.hpp"
+
+#include "andre_global.h"
+
+namespace andre
+{
+
+struct ANDRESHARED_EXPORT SocketBridgeConfig
+{
+	// "unix:/path/to.sock" или "tcp:host:port"
+	std::string address;
+
+	// true - принимать подключения, false - подключиться к address
+	bool listen = false;
+
+	// сообщения копятся в буфере соединения и уходят одной записью,
+	// когда буфер превысит maxBatchBytes или пройдёт flushDelay
+	size_t maxBatchBytes = 64 * 1024;
+	std::chrono::microseconds flushDelay{200};
+
+	// предел неотправленных данных на соединение; сверх него сообщения отбрасываются
+	size_t maxPendingBytes = 16 * 1024 * 1024;
+
+	std::chrono::milliseconds connectTimeout{2000};
+};
+
+// Мост между AsyncOperProcessor'ами, связанными потоковым сокетом
+// (Unix-domain или TCP). Каждая сторона сообщает другой, на что подписана
+// (subscribe), и мост регистрирует на эти Handle'ы локальный обработчик
+// соединения, пересылающий сообщения в сокет пачками. Принятые сообщения
+// отдаются в локальный postMessage.
+//
+// Кадр: [длина полезной нагрузки 4][тип 1][нагрузка]; сообщения
+// сериализуются MessageCodec'ом, подписка - [commandID 8][paramFrom 8][paramTo 8].
+// Числа в кадре - little-endian, стороны могут быть на узлах с разным порядком байт. Весь ввод-вывод - в собственном потоке
+// моста на IoReactor.
+class ANDRESHARED_EXPORT SocketBridge
+{
+public:
+	explicit SocketBridge(const SocketBridgeConfig &config);
+	~SocketBridge();
+
+	bool start();
+	void stop();
+
+	// Сообщения на эти Handle'ы, отправленные на другой стороне,
+	// будут доставлены в локальный postMessage.
+	bool subscribe(const Handle &handle);
+	bool subscribe(const HandleRange &range);
+
+	size_t getConnectionCount() const { return m_connections; }
+
+	unsigned long long getSentCount() const { return m_sent; }
+	unsigned long long getReceivedCount() const { return m_received; }
+	unsigned long long getDroppedCount() const { return m_dropped; }
+
+	// количество системных вызовов записи: sent / writes - средний размер пачки
+	unsigned long long getWriteCount() const { return m_writes; }
+
+private:
+	class Link;
+
+	// Управляющий обработчик потока моста: остановка, новые подписки,
+	// приём подключений, таймер сброса буферов.
+	class Control : public EventHandler, public IoHandler
+	{
+	public:
+		Control(SocketBridge *bridge);
+
+	private:
+		SocketBridge *m_bridge;
+
+		void handleEvent(const std::shared_ptr<MessageData> &msg) override;
+		void handleIoEvent(int fd, uint32_t events) override;
+	};
+
+	SocketBridgeConfig m_config;
+
+	std::atomic<bool> m_running;
+	std::thread m_thread;
+
+	int m_listenFd;
+	int m_timerFd;
+	bool m_timerArmed;
+
+	std::unique_ptr<Control> m_control;
+	Handle m_stopHandle;
+	Handle m_subscribeHandle;
+
+	std::mutex m_subscriptionsMutex;
+	std::vector<HandleRange> m_subscriptions;
+
+	// только поток моста
+	std::map<int, std::unique_ptr<Link>> m_links;
+	std::vector<std::unique_ptr<Link>> m_retiredLinks;
+	size_t m_announced;	// сколько подписок уже разослано
+
+	std::atomic<size_t> m_connections;
+	std::atomic<unsigned long long> m_sent;
+	std::atomic<unsigned long long> m_received;
+	std::atomic<unsigned long long> m_dropped;
+	std::atomic<unsigned long long> m_writes;
+
+	int openSocket();
+	void threadLoop(int fd, std::promise<bool> *started);
+
+	// закрывает сокет start(); слушающий Unix-сокет - вместе с его файлом
+	void closeSocket(int fd);
+
+	void addLink(int fd);
+	void closeLink(Link *link);
+	void reapLinks();
+	void announceSubscriptions();
+	void armTimer();
+	void flushAll();
+
+	// false - реактор моста остановлен (drainAndShutdown), доставить некому
+	bool postControl(const Handle &handle);
+
+	unsigned long long getOriginTag() const
+	{
+		return reinterpret_cast<unsigned long long>(this);
+	}
+
+	SocketBridge(const SocketBridge &) = delete;
+	SocketBridge &operator=(const SocketBridge &) = delete;
+};
+
+} // namespace andre
+
+#endif // SOCKETBRIDGE_H
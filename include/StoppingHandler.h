@@ -2,6 +2,7 @@
 #define STOPPINGHANDLER_H
 
 #include "AsyncOperProcessor.h"
+#include "NameRegistry.h"
 
 namespace andre
 {
@@ -29,10 +30,7 @@ private:
 
 	static Handle getHandle()
 	{
-		Handle handle;
-		std::hash<std::string_view> hasher;
-		handle.commandID = hasher(getCommand());
-		handle.messageParam = hasher(getParam());
+		static const Handle handle = {NameRegistry::instance().intern(getCommand()), 0};
 		return handle;		
 	}
 
@@ -40,11 +38,6 @@ private:
 	{
 		return "ShutdownStoppableDispatchers";
 	}
-
-	static constexpr std::string_view getParam()
-	{
-		return "";
-	}
 };
 
 } // namespace andre
@@ -0,0 +1,257 @@
+#ifndef TYPEDACTOR_H
+#define TYPEDACTOR_H
+
+#include <array>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+
+#include "AsyncOperProcessor.h"
+#include "DispatchReactorStoppable.h"
+#include "MessageCodec.h"
+#include "NameRegistry.h"
+#include "atomiccounter.hpp"
+
+#include "andre_global.h"
+
+namespace andre
+{
+
+template<typename Actor, typename Base>
+class StaticReactor;
+
+// Обработчик с диспетчеризацией по типу сообщения на этапе компиляции.
+//
+// Каждый тип из Messages - наследник ConstData со статической функцией
+//     static unsigned long long commandID();
+// (обычно - идентификатор имени из NameRegistry, сохранённый в static).
+// Derived объявляет для каждого из них
+//     void onMessage(const Message &msg);
+// и, при желании, void onDestroyable(const std::shared_ptr<MessageData> &).
+//
+// Вызовы onMessage не виртуальные, без std::function, проверка дерегистрации
+// выполняется там же. Реактор вызывает обработчик одним виртуальным вызовом
+// handleEvent(), а StaticReactor<Derived> - без него.
+// Дерегистрация - как у DeregisterableHandler.
+//
+// Тип сообщения проверяется: с тем же commandID может прийти другой тип
+// (ConstData без кодека из журнала или другого процесса) - такое сообщение
+// отбрасывается (getRejectedCount). Регистрация отклоняется, если на команду
+// из Messages зарегистрирован кодек (MessageCodec), создающий другой тип.
+template<typename Derived, typename... Messages>
+class TypedActor : public EventHandler
+{
+	static_assert( 0 != sizeof...(Messages), "Need at least one message type" );
+	static_assert( (std::is_base_of<ConstData, Messages>::value && ...),
+				   "Need classes derived from 'ConstData'" );
+
+	template<typename Actor, typename Base>
+	friend class StaticReactor;
+
+public:
+	typedef TypedActor TypedActorBase;
+
+	// подписка на команды всех Messages с любым messageParam
+	TypedActor()
+		: m_commandIDs{{Messages::commandID()...}}, m_registrationCounter(0), m_rejected(0)
+	{
+		initMarker();
+
+		for ( unsigned long long commandID : m_commandIDs ) {
+			addWildcardHandle(commandID);
+		}
+	}
+
+	// подписка на команды всех Messages с данным messageParam
+	explicit TypedActor(unsigned long long messageParam)
+		: m_commandIDs{{Messages::commandID()...}}, m_registrationCounter(0), m_rejected(0)
+	{
+		initMarker();
+
+		for ( unsigned long long commandID : m_commandIDs ) {
+			addHandle({commandID, messageParam});
+		}
+	}
+
+	// см. DeregisterableHandler::deregister()
+	bool deregister()
+	{
+		return deregister(false);
+	}
+
+	// см. DeregisterableHandler::deregisterBlocking()
+	bool deregisterBlocking()
+	{
+		return deregister(true);
+	}
+
+	const Handle &getDeregistrationHandle() const
+	{
+		return m_marker;
+	}
+
+	// сообщения с командой из Messages, но другого типа
+	unsigned long long getRejectedCount() const
+	{
+		return m_rejected;
+	}
+
+	// идентификатор типа для StaticReactor
+	static const void *staticType()
+	{
+		static const char tag = 0;
+		return &tag;
+	}
+
+protected:
+	// Вызывается, когда обработчик готов к уничтожению.
+	void onDestroyable(const std::shared_ptr<MessageData> &) {}
+
+private:
+	const std::array<unsigned long long, sizeof...(Messages)> m_commandIDs;
+	Handle m_marker;
+	std::atomic<int> m_registrationCounter;
+	std::atomic<unsigned long long> m_rejected;
+
+	void initMarker()
+	{
+		m_marker.commandID = NameRegistry::instance().intern("marker_deregister");
+		m_marker.messageParam = reinterpret_cast<unsigned long long>(this);
+		getDeregisterHandleNonConst() = m_marker;
+		addHandle(m_marker);
+		setStaticType(staticType());
+	}
+
+	void handleEvent(const std::shared_ptr<MessageData> &msg) override final
+	{
+		dispatch(msg);
+	}
+
+	void onRegister() override final
+	{
+		m_registrationCounter ++;
+	}
+
+	bool canRegister() override
+	{
+		return ( codecMatches<Messages>() && ... );
+	}
+
+	// кодека команды нет или он создаёт Message
+	template<typename Message>
+	static bool codecMatches()
+	{
+		const std::type_info *type = nullptr;
+
+		if ( ! MessageCodec::instance().getCodecType(Message::commandID(), type) ) {
+			return true;
+		}
+
+		return nullptr != type && typeid(Message) == *type;
+	}
+
+	// точный тип - сравнением type_info, наследник Message - через dynamic_cast
+	template<typename Message>
+	static bool isOfType(const ConstData &data)
+	{
+		return typeid(Message) == typeid(data) ||
+			   nullptr != dynamic_cast<const Message *>(&data);
+	}
+
+	inline void dispatch(const std::shared_ptr<MessageData> &msg)
+	{
+		const ConstData &data = *msg->getData();
+
+		if ( data.handle == m_marker ) {
+			if ( -- m_registrationCounter == 0 ) {
+				static_cast<Derived *>(this)->onDestroyable(msg);
+			}
+			return;
+		}
+
+		if ( isDeregistering() ) {
+			return;
+		}
+		multithread::AtomicCounter ac(m_threadsCounter);
+		dispatchMessage(data, std::index_sequence_for<Messages...>());
+	}
+
+	// первый тип, чей commandID и тип сообщения совпали
+	template<size_t... Index>
+	inline void dispatchMessage(const ConstData &data, std::index_sequence<Index...>)
+	{
+		bool dispatched = ( ... || ( data.handle.commandID == m_commandIDs[Index] &&
+									 isOfType<Messages>(data) &&
+									 (static_cast<Derived *>(this)->onMessage(
+										  static_cast<const Messages &>(data)), true) ) );
+
+		if ( ! dispatched ) {
+			++ m_rejected;
+		}
+	}
+
+	bool deregister(bool isBlocking)
+	{
+		std::unique_ptr<ConstData> cdata = std::make_unique<ConstData>();
+		cdata->handle = m_marker;
+
+		return AsyncOperProcessor::instance().deregisterHandler( this, isBlocking,
+			std::make_shared<MessageData>(cdata));
+	}
+};
+
+// Реактор, вызывающий обработчики типа Actor (наследники TypedActor) напрямую:
+// диспетчеризация их сообщений встраивается в цикл реактора.
+// Остальные обработчики и события обрабатываются как в Reactor.
+// Base - реактор с основным циклом Reactor::handleEvents().
+template<typename Actor, typename Base = DispatchReactorStoppable>
+class StaticReactor : public Base
+{
+	static_assert( std::is_base_of<Reactor, Base>::value,
+				   "Need class derived from 'Reactor'" );
+
+	typedef typename Actor::TypedActorBase ActorBase;
+
+public:
+	void handleEvents() override
+	{
+		ReactorEvent re;
+		const void *staticType = ActorBase::staticType();
+
+		while (!this->m_exit) {
+
+			re.message = nullptr;
+			this->m_events.waitAndPop(re);
+
+			if (this->m_exit) {
+				break;
+			}
+
+			if ( this->isDirectDelivery(re, staticType) ) {
+				static_cast<ActorBase *>(re.handler)->dispatch(re.message);
+			}
+			else {
+				this->dispatchEvent(re);
+			}
+		}
+	}
+};
+
+// Отправляет сообщение типа Message обработчикам TypedActor
+template<typename Message>
+bool postTypedMessage(Message message, unsigned long long messageParam = 0)
+{
+	static_assert( std::is_base_of<ConstData, Message>::value,
+				   "Need class derived from 'ConstData'" );
+
+	message.handle = {Message::commandID(), messageParam};
+	std::unique_ptr<ConstData> data = std::make_unique<Message>(std::move(message));
+
+	return AsyncOperProcessor::instance().postMessage(std::make_shared<MessageData>(data));
+}
+
+} // namespace andre
+
+#endif // TYPEDACTOR_H
@@ -0,0 +1,662 @@
+#ifndef AFFINITY_HPP
+#define AFFINITY_HPP
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "spinlockguard.hpp"
+
+namespace multithread
+{
+
+// Набор процессоров для привязки потоков
+class CpuSet
+{
+public:
+	CpuSet()
+	{
+		CPU_ZERO(&m_set);
+	}
+
+	// "0-3,8,10-11" - формат cpulist ядра и taskset
+	static CpuSet fromList(const std::string &list)
+	{
+		CpuSet result;
+		std::stringstream stream(list);
+		std::string item;
+
+		while ( std::getline(stream, item, ',') ) {
+			int from = -1;
+			int to = -1;
+			int count = std::sscanf(item.c_str(), "%d-%d", &from, &to);
+
+			if ( count < 1 || from < 0 ) {
+				continue;
+			}
+
+			if ( count < 2 ) {
+				to = from;
+			}
+
+			for ( int cpu = from; cpu <= to; ++cpu ) {
+				result.add(cpu);
+			}
+		}
+
+		return result;
+	}
+
+	// процессоры, на которых разрешено работать вызывающему потоку
+	static CpuSet current()
+	{
+		CpuSet result;
+		pthread_getaffinity_np(pthread_self(), sizeof(result.m_set), &result.m_set);
+		return result;
+	}
+
+	void add(int cpu)
+	{
+		if ( cpu >= 0 && cpu < CPU_SETSIZE ) {
+			CPU_SET(cpu, &m_set);
+		}
+	}
+
+	void remove(int cpu)
+	{
+		if ( cpu >= 0 && cpu < CPU_SETSIZE ) {
+			CPU_CLR(cpu, &m_set);
+		}
+	}
+
+	bool contains(int cpu) const
+	{
+		return cpu >= 0 && cpu < CPU_SETSIZE && CPU_ISSET(cpu, &m_set);
+	}
+
+	int count() const
+	{
+		return CPU_COUNT(&m_set);
+	}
+
+	bool empty() const
+	{
+		return 0 == count();
+	}
+
+	std::vector<int> cpus() const
+	{
+		std::vector<int> result;
+
+		for ( int cpu = 0; cpu < CPU_SETSIZE; ++cpu ) {
+			if ( CPU_ISSET(cpu, &m_set) ) {
+				result.push_back(cpu);
+			}
+		}
+
+		return result;
+	}
+
+	std::string toString() const
+	{
+		std::string result;
+		std::vector<int> list = cpus();
+
+		for ( size_t i = 0; i < list.size(); ) {
+			size_t j = i;
+
+			while ( j + 1 < list.size() && list[j + 1] == list[j] + 1 ) {
+				++j;
+			}
+
+			if ( ! result.empty() ) {
+				result += ",";
+			}
+			result += std::to_string(list[i]);
+
+			if ( j != i ) {
+				result += "-" + std::to_string(list[j]);
+			}
+			i = j + 1;
+		}
+
+		return result;
+	}
+
+	const cpu_set_t &native() const
+	{
+		return m_set;
+	}
+
+private:
+	cpu_set_t m_set;
+};
+
+inline bool pinThread(pthread_t thread, const CpuSet &cpus)
+{
+	return ! cpus.empty() &&
+			0 == pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpus.native());
+}
+
+inline bool pinCurrentThread(const CpuSet &cpus)
+{
+	return pinThread(pthread_self(), cpus);
+}
+
+// Топология NUMA по /sys/devices/system/node.
+// Если сведений нет (не Linux, контейнер без sysfs) - один узел со всеми процессорами.
+class Topology
+{
+public:
+	static const Topology &instance()
+	{
+		static Topology theSingleInstance;
+		return theSingleInstance;
+	}
+
+	int nodeCount() const
+	{
+		return int(m_nodes.size());
+	}
+
+	int cpuCount() const
+	{
+		return m_cpuCount;
+	}
+
+	const CpuSet &nodeCpus(int node) const
+	{
+		return m_nodes[size_t(node)].cpus;
+	}
+
+	// -1 - процессор неизвестен
+	int nodeOfCpu(int cpu) const
+	{
+		for ( size_t node = 0; node < m_nodes.size(); ++node ) {
+			if ( m_nodes[node].cpus.contains(cpu) ) {
+				return int(node);
+			}
+		}
+
+		return -1;
+	}
+
+	// Узел, которому целиком принадлежит набор процессоров; -1 - набор
+	// пуст или охватывает несколько узлов.
+	int nodeOfCpus(const CpuSet &cpus) const
+	{
+		int result = -1;
+
+		for ( int cpu : cpus.cpus() ) {
+			int node = nodeOfCpu(cpu);
+
+			if ( -1 == node || (-1 != result && node != result) ) {
+				return -1;
+			}
+			result = node;
+		}
+
+		return result;
+	}
+
+	// относительное расстояние между узлами (10 - локальный доступ)
+	int distance(int from, int to) const
+	{
+		const std::vector<int> &row = m_nodes[size_t(from)].distances;
+
+		if ( to < 0 || size_t(to) >= row.size() ) {
+			return from == to ? 10 : 20;
+		}
+
+		return row[size_t(to)];
+	}
+
+	// узел процессора, на котором сейчас выполняется вызывающий поток
+	int currentNode() const
+	{
+		return nodeOfCpu(sched_getcpu());
+	}
+
+	std::string toString() const
+	{
+		std::stringstream sstream;
+		sstream << "NUMA nodes: " << m_nodes.size()
+				<< ", CPUs: " << m_cpuCount << std::endl;
+
+		for ( size_t node = 0; node < m_nodes.size(); ++node ) {
+			sstream << "node " << m_nodes[node].id << ": cpus "
+					<< m_nodes[node].cpus.toString() << ", distances";
+
+			for ( int dist : m_nodes[node].distances ) {
+				sstream << " " << dist;
+			}
+			sstream << std::endl;
+		}
+
+		return sstream.str();
+	}
+
+private:
+	struct Node
+	{
+		int id;
+		CpuSet cpus;
+		std::vector<int> distances;
+	};
+
+	std::vector<Node> m_nodes;
+	int m_cpuCount;
+
+	Topology() : m_cpuCount(0)
+	{
+		// узлы нумеруются подряд; пропуски (отключённые узлы) не поддерживаются
+		for ( int id = 0; ; ++id ) {
+			std::string dir = "/sys/devices/system/node/node" + std::to_string(id);
+			std::string cpulist;
+
+			if ( ! readLine(dir + "/cpulist", cpulist) ) {
+				break;
+			}
+			Node node;
+			node.id = id;
+			node.cpus = CpuSet::fromList(cpulist);
+
+			std::string distances;
+
+			if ( readLine(dir + "/distance", distances) ) {
+				std::stringstream stream(distances);
+				int dist;
+
+				while ( stream >> dist ) {
+					node.distances.push_back(dist);
+				}
+			}
+			m_cpuCount += node.cpus.count();
+			m_nodes.push_back(node);
+		}
+
+		if ( m_nodes.empty() ) {
+			Node node;
+			node.id = 0;
+			int cpus = int(std::thread::hardware_concurrency());
+
+			for ( int cpu = 0; cpu < cpus; ++cpu ) {
+				node.cpus.add(cpu);
+			}
+			node.distances.push_back(10);
+			m_cpuCount = cpus;
+			m_nodes.push_back(node);
+		}
+	}
+
+	static bool readLine(const std::string &path, std::string &line)
+	{
+		FILE *file = std::fopen(path.c_str(), "r");
+
+		if ( nullptr == file ) {
+			return false;
+		}
+		char buffer[4096];
+		bool result = nullptr != std::fgets(buffer, sizeof(buffer), file);
+		std::fclose(file);
+
+		if ( result ) {
+			line = buffer;
+
+			while ( ! line.empty() && ('\n' == line.back() || ' ' == line.back()) ) {
+				line.pop_back();
+			}
+		}
+
+		return result;
+	}
+
+	Topology(const Topology &) = delete;
+	Topology &operator=(const Topology &) = delete;
+};
+
+// Память, размещённая на узле node (mmap + mbind с MPOL_PREFERRED).
+// Если mbind недоступен, страницы достанутся узлу потока, первым их тронувшего.
+inline void *numaAlloc(size_t size, int node)
+{
+	void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+						MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if ( MAP_FAILED == memory ) {
+		return nullptr;
+	}
+#ifdef SYS_mbind
+	const int mpolPreferred = 1;
+	const unsigned long maskBits = sizeof(unsigned long) * 8;
+
+	if ( node >= 0 && size_t(node) < maskBits ) {
+		unsigned long mask = 1UL << node;
+		syscall(SYS_mbind, memory, size, mpolPreferred, &mask, maskBits + 1, 0);
+	}
+#else
+	(void)node;
+#endif
+
+	return memory;
+}
+
+inline void numaFree(void *memory, size_t size)
+{
+	if ( nullptr != memory ) {
+		munmap(memory, size);
+	}
+}
+
+// Пул блоков памяти одного узла NUMA. Блоки кратны кэш-линии, до maxBlock байт;
+// больше - отдельными страницами узла (numaAlloc). Освобождённые большие блоки
+// (массивы растущих очередей) держатся в небольшом кэше и отдаются следующему
+// запросу того же размера без mmap/munmap; вытесненные из кэша возвращаются
+// системе. Память мелких блоков возвращается системе только при завершении процесса.
+class NumaPool
+{
+	static constexpr size_t kBlockStep = 64;
+	static constexpr size_t kMaxBlock = 1024;
+	static constexpr size_t kClassCount = kMaxBlock / kBlockStep;
+	static constexpr size_t kChunkSize = 256 * 1024;
+
+	// кэш больших блоков узла
+	static constexpr size_t kLargeCacheCount = 16;
+	static constexpr size_t kLargeCacheBytes = 32 * 1024 * 1024;
+
+	struct FreeBlock
+	{
+		FreeBlock *next;
+	};
+
+	struct SizeClass
+	{
+		std::atomic_flag lock = ATOMIC_FLAG_INIT;
+		FreeBlock *freeList = nullptr;
+	};
+
+	struct LargeBlock
+	{
+		void *memory;
+		size_t size;
+	};
+
+public:
+	// пул узла node; nullptr - узел неизвестен
+	static NumaPool *forNode(int node)
+	{
+		static std::vector<std::unique_ptr<NumaPool>> pools = createPools();
+
+		if ( node < 0 || size_t(node) >= pools.size() ) {
+			return nullptr;
+		}
+
+		return pools[size_t(node)].get();
+	}
+
+	~NumaPool()
+	{
+		for ( void *chunk : m_chunks ) {
+			numaFree(chunk, kChunkSize);
+		}
+
+		for ( const LargeBlock &block : m_largeBlocks ) {
+			numaFree(block.memory, block.size);
+		}
+	}
+
+	int getNode() const
+	{
+		return m_node;
+	}
+
+	void *allocate(size_t size)
+	{
+		if ( 0 == size ) {
+			return ::operator new(size);
+		}
+
+		// например, массив растущей очереди: он должен остаться на узле
+		if ( size > kMaxBlock ) {
+			return allocateLarge(size);
+		}
+		size_t index = (size - 1) / kBlockStep;
+		SizeClass &sizeClass = m_classes[index];
+		{
+			SpinLockGuard guard(sizeClass.lock);
+
+			if ( nullptr != sizeClass.freeList ) {
+				FreeBlock *block = sizeClass.freeList;
+				sizeClass.freeList = block->next;
+				return block;
+			}
+		}
+
+		return refill(sizeClass, (index + 1) * kBlockStep);
+	}
+
+	void deallocate(void *memory, size_t size)
+	{
+		if ( 0 == size ) {
+			::operator delete(memory);
+			return;
+		}
+
+		if ( size > kMaxBlock ) {
+			deallocateLarge(memory, size);
+			return;
+		}
+		SizeClass &sizeClass = m_classes[(size - 1) / kBlockStep];
+		FreeBlock *block = static_cast<FreeBlock *>(memory);
+
+		SpinLockGuard guard(sizeClass.lock);
+		block->next = sizeClass.freeList;
+		sizeClass.freeList = block;
+	}
+
+	// количество кусков памяти, взятых у системы
+	size_t getChunkCount()
+	{
+		SpinLockGuard guard(m_chunksLock);
+		return m_chunks.size();
+	}
+
+private:
+	int m_node;
+	SizeClass m_classes[kClassCount];
+
+	std::atomic_flag m_chunksLock = ATOMIC_FLAG_INIT;
+	std::vector<void *> m_chunks;
+
+	// место под kLargeCacheCount блоков выделено заранее:
+	// под спин-блокировкой вектор не перераспределяется
+	std::atomic_flag m_largeLock = ATOMIC_FLAG_INIT;
+	std::vector<LargeBlock> m_largeBlocks;
+	size_t m_largeBytes = 0;
+
+	explicit NumaPool(int node) : m_node(node)
+	{
+		m_largeBlocks.reserve(kLargeCacheCount);
+	}
+
+	void *allocateLarge(size_t size)
+	{
+		{
+			SpinLockGuard guard(m_largeLock);
+
+			for ( size_t i = 0; i < m_largeBlocks.size(); ++i ) {
+				if ( size == m_largeBlocks[i].size ) {
+					void *memory = m_largeBlocks[i].memory;
+					m_largeBlocks.erase(m_largeBlocks.begin() + long(i));
+					m_largeBytes -= size;
+					return memory;
+				}
+			}
+		}
+		void *memory = numaAlloc(size, m_node);
+
+		if ( nullptr == memory ) {
+			throw std::bad_alloc();
+		}
+
+		return memory;
+	}
+
+	// кэш полон - вытесняется самый старый блок
+	void deallocateLarge(void *memory, size_t size)
+	{
+		if ( size > kLargeCacheBytes ) {
+			numaFree(memory, size);
+			return;
+		}
+		LargeBlock evicted[kLargeCacheCount];
+		size_t evictedCount = 0;
+		{
+			SpinLockGuard guard(m_largeLock);
+
+			while ( ! m_largeBlocks.empty() &&
+					(kLargeCacheCount == m_largeBlocks.size() ||
+					 m_largeBytes + size > kLargeCacheBytes) ) {
+				evicted[evictedCount ++] = m_largeBlocks.front();
+				m_largeBytes -= m_largeBlocks.front().size;
+				m_largeBlocks.erase(m_largeBlocks.begin());
+			}
+			m_largeBlocks.push_back({memory, size});
+			m_largeBytes += size;
+		}
+
+		for ( size_t i = 0; i < evictedCount; ++i ) {
+			numaFree(evicted[i].memory, evicted[i].size);
+		}
+	}
+
+	static std::vector<std::unique_ptr<NumaPool>> createPools()
+	{
+		std::vector<std::unique_ptr<NumaPool>> pools;
+
+		for ( int node = 0; node < Topology::instance().nodeCount(); ++node ) {
+			pools.emplace_back(new NumaPool(node));
+		}
+
+		return pools;
+	}
+
+	// новый кусок режется на блоки одного размера: один отдаётся сразу,
+	// остальные - в список свободных
+	void *refill(SizeClass &sizeClass, size_t blockSize)
+	{
+		char *chunk = static_cast<char *>(numaAlloc(kChunkSize, m_node));
+
+		if ( nullptr == chunk ) {
+			throw std::bad_alloc();
+		}
+		{
+			SpinLockGuard guard(m_chunksLock);
+			m_chunks.push_back(chunk);
+		}
+		size_t count = kChunkSize / blockSize;
+		FreeBlock *first = nullptr;
+
+		for ( size_t i = count - 1; i > 0; --i ) {
+			FreeBlock *block = reinterpret_cast<FreeBlock *>(chunk + i * blockSize);
+			block->next = first;
+			first = block;
+		}
+
+		if ( nullptr != first ) {
+			FreeBlock *last = first;
+
+			while ( nullptr != last->next ) {
+				last = last->next;
+			}
+			SpinLockGuard guard(sizeClass.lock);
+			last->next = sizeClass.freeList;
+			sizeClass.freeList = first;
+		}
+
+		return chunk;
+	}
+
+	NumaPool(const NumaPool &) = delete;
+	NumaPool &operator=(const NumaPool &) = delete;
+};
+
+// Аллокатор STL поверх NumaPool узла. Без пула (узел неизвестен) - обычная куча.
+// Пример: std::allocate_shared<T>(NodeAllocator<T>(node), ...)
+template<typename T>
+class NodeAllocator
+{
+	template<typename U>
+	friend class NodeAllocator;
+
+public:
+	typedef T value_type;
+
+	NodeAllocator() : m_pool(nullptr)
+	{
+	}
+
+	explicit NodeAllocator(int node) : m_pool(NumaPool::forNode(node))
+	{
+	}
+
+	template<typename U>
+	NodeAllocator(const NodeAllocator<U> &other) : m_pool(other.m_pool)
+	{
+	}
+
+	T *allocate(size_t count)
+	{
+		static_assert(alignof(T) <= 64, "NodeAllocator supports alignment up to 64");
+		size_t size = count * sizeof(T);
+
+		if ( nullptr == m_pool ) {
+			return static_cast<T *>(::operator new(size));
+		}
+
+		return static_cast<T *>(m_pool->allocate(size));
+	}
+
+	void deallocate(T *memory, size_t count)
+	{
+		if ( nullptr == m_pool ) {
+			::operator delete(memory);
+			return;
+		}
+		m_pool->deallocate(memory, count * sizeof(T));
+	}
+
+	int getNode() const
+	{
+		return nullptr == m_pool ? -1 : m_pool->getNode();
+	}
+
+	template<typename U>
+	bool operator==(const NodeAllocator<U> &other) const
+	{
+		return m_pool == other.m_pool;
+	}
+
+	template<typename U>
+	bool operator!=(const NodeAllocator<U> &other) const
+	{
+		return m_pool != other.m_pool;
+	}
+
+private:
+	NumaPool *m_pool;
+};
+
+} //namespace multithread
+#endif // AFFINITY_HPP
@@ -0,0 +1,239 @@
+#ifndef BYTERING_HPP
+#define BYTERING_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+namespace multithread
+{
+
+// Неблокирующий ограниченный кольцевой буфер записей переменной длины
+// (алгоритм Д. Вьюкова). Подходит для SPSC и MPSC (и MPMC).
+// Размещается поверх готового блока памяти, в том числе разделяемой между
+// процессами: внутри нет указателей, только смещения и атомарные счётчики.
+//
+// Раскладка: [ByteRing][slot 0][slot 1]...[slot N-1],
+// слот: [sequence][length][data: slotSize байт], выровнен по кэш-линии.
+// Память должна быть выровнена по 64 байтам (mmap, aligned new).
+class ByteRing
+{
+	static_assert(std::atomic<uint64_t>::is_always_lock_free,
+				  "ByteRing needs lock-free 64-bit atomics");
+
+	static constexpr uint64_t kMagic = 0x42797465526e6731ULL; // метка инициализированного кольца
+	static constexpr size_t kCacheLine = 64;
+
+	struct Slot
+	{
+		std::atomic<uint64_t> sequence;
+		uint32_t length;
+		// далее - slotSize байт данных
+	};
+
+public:
+	// размер памяти, необходимой кольцу
+	static size_t memorySize(uint32_t slotCount, uint32_t slotSize)
+	{
+		return sizeof(ByteRing) + size_t(slotCount) * slotStride(slotSize);
+	}
+
+	// slotCount должен быть степенью двойки
+	static ByteRing *create(void *memory, uint32_t slotCount, uint32_t slotSize)
+	{
+		if ( 0 == slotCount || 0 != (slotCount & (slotCount - 1)) ) {
+			return nullptr;
+		}
+		ByteRing *ring = new (memory) ByteRing(slotCount, slotSize);
+
+		for ( uint32_t i = 0; i < slotCount; ++i ) {
+			Slot *slot = new (ring->slotAt(i)) Slot;
+			slot->sequence.store(i, std::memory_order_relaxed);
+			slot->length = 0;
+		}
+		// слоты видны всякому, кто увидел метку
+		std::atomic_thread_fence(std::memory_order_release);
+		ring->m_magic.store(kMagic, std::memory_order_relaxed);
+
+		return ring;
+	}
+
+	// подключается к кольцу, созданному другим процессом/потоком
+	static ByteRing *attach(void *memory)
+	{
+		ByteRing *ring = static_cast<ByteRing *>(memory);
+
+		if ( kMagic != ring->m_magic.load(std::memory_order_relaxed) ) {
+			return nullptr;
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		return ring;
+	}
+
+	uint32_t slotSize() const
+	{
+		return m_slotSize;
+	}
+
+	uint32_t slotCount() const
+	{
+		return m_mask + 1;
+	}
+
+	// false - кольцо заполнено, запись больше slotSize
+	// либо слот пропущен читателем, не дождавшимся публикации
+	bool tryPush(const void *data, size_t length)
+	{
+		return tryPush(data, length, nullptr, 0);
+	}
+
+	// записывает заголовок и тело одной записью, без промежуточного буфера
+	bool tryPush(const void *head, size_t headLength,
+				 const void *body, size_t bodyLength)
+	{
+		if ( headLength + bodyLength > m_slotSize ) {
+			return false;
+		}
+		uint64_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+		Slot *slot;
+
+		for (;;) {
+			slot = slotAt(pos & m_mask);
+			uint64_t seq = slot->sequence.load(std::memory_order_acquire);
+			int64_t diff = int64_t(seq) - int64_t(pos);
+
+			if ( 0 == diff ) {
+				if ( m_enqueuePos.compare_exchange_weak(pos, pos + 1,
+						std::memory_order_relaxed) ) {
+					break;
+				}
+			}
+			else if ( diff < 0 ) {
+				return false; // заполнено
+			}
+			else {
+				pos = m_enqueuePos.load(std::memory_order_relaxed);
+			}
+		}
+
+		char *dst = dataOf(slot);
+		if ( 0 != headLength ) {
+			std::memcpy(dst, head, headLength);
+		}
+		if ( 0 != bodyLength ) {
+			std::memcpy(dst + headLength, body, bodyLength);
+		}
+		slot->length = uint32_t(headLength + bodyLength);
+
+		// слот успел пропустить читатель (skipClaimed) - запись не принята
+		return slot->sequence.compare_exchange_strong(pos, pos + 1,
+				std::memory_order_release, std::memory_order_relaxed);
+	}
+
+	// Отдаёт запись в func(const char *data, size_t length) прямо из кольца,
+	// после чего освобождает слот. false - кольцо пусто.
+	template<typename Function>
+	bool tryConsume(Function func)
+	{
+		uint64_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+		Slot *slot;
+
+		for (;;) {
+			slot = slotAt(pos & m_mask);
+			uint64_t seq = slot->sequence.load(std::memory_order_acquire);
+			int64_t diff = int64_t(seq) - int64_t(pos + 1);
+
+			if ( 0 == diff ) {
+				if ( m_dequeuePos.compare_exchange_weak(pos, pos + 1,
+						std::memory_order_relaxed) ) {
+					break;
+				}
+			}
+			else if ( diff < 0 ) {
+				return false; // пусто
+			}
+			else {
+				pos = m_dequeuePos.load(std::memory_order_relaxed);
+			}
+		}
+
+		func(static_cast<const char *>(dataOf(slot)), size_t(slot->length));
+		slot->sequence.store(pos + m_mask + 1, std::memory_order_release);
+
+		return true;
+	}
+
+	// Голова кольца занята писателем, но ещё не опубликована: pos - её номер.
+	// Если писатель умер между захватом и публикацией, кольцо встанет
+	// на этом слоте - его можно пропустить skipClaimed().
+	bool isHeadClaimed(uint64_t &pos)
+	{
+		pos = m_dequeuePos.load(std::memory_order_relaxed);
+
+		return slotAt(pos & m_mask)->sequence.load(std::memory_order_acquire) == pos &&
+			   m_enqueuePos.load(std::memory_order_relaxed) > pos;
+	}
+
+	// Освобождает неопубликованный слот pos. Запоздавший писатель
+	// не сможет его опубликовать: его tryPush вернёт false.
+	bool skipClaimed(uint64_t pos)
+	{
+		Slot *slot = slotAt(pos & m_mask);
+		uint64_t expected = pos;
+
+		if ( ! slot->sequence.compare_exchange_strong(expected, pos + m_mask + 1,
+				std::memory_order_acq_rel, std::memory_order_relaxed) ) {
+			return false;
+		}
+		m_dequeuePos.compare_exchange_strong(pos, pos + 1, std::memory_order_relaxed);
+
+		return true;
+	}
+
+	// приблизительное количество записей
+	size_t size() const
+	{
+		uint64_t enq = m_enqueuePos.load(std::memory_order_relaxed);
+		uint64_t deq = m_dequeuePos.load(std::memory_order_relaxed);
+
+		return ( enq > deq ) ? size_t(enq - deq) : 0;
+	}
+
+private:
+	std::atomic<uint64_t> m_magic;
+	uint32_t m_mask;
+	uint32_t m_slotSize;
+	alignas(kCacheLine) std::atomic<uint64_t> m_enqueuePos;
+	alignas(kCacheLine) std::atomic<uint64_t> m_dequeuePos;
+
+	ByteRing(uint32_t slotCount, uint32_t slotSize)
+		: m_magic(0), m_mask(slotCount - 1), m_slotSize(slotSize),
+		  m_enqueuePos(0), m_dequeuePos(0)
+	{
+	}
+
+	static size_t slotStride(uint32_t slotSize)
+	{
+		size_t raw = sizeof(Slot) + slotSize;
+		return (raw + kCacheLine - 1) / kCacheLine * kCacheLine;
+	}
+
+	Slot *slotAt(uint64_t index)
+	{
+		char *base = reinterpret_cast<char *>(this) + sizeof(ByteRing);
+		return reinterpret_cast<Slot *>(base + index * slotStride(m_slotSize));
+	}
+
+	static char *dataOf(Slot *slot)
+	{
+		return reinterpret_cast<char *>(slot) + sizeof(Slot);
+	}
+
+	ByteRing(const ByteRing &) = delete;
+	ByteRing &operator=(const ByteRing &) = delete;
+};
+
+} //namespace multithread
+#endif // BYTERING_HPP
@@ -0,0 +1,583 @@
+#ifndef CONCURRENTMAP_HPP
+#define CONCURRENTMAP_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace multithread
+{
+
+// Освобождение памяти, которую читают без блокировок (epoch-based reclamation).
+//
+// Читатель на время чтения объявляет текущую эпоху в записи своего потока
+// (своя кэш-линия - общая память не пишется). Писатель, убрав объект из
+// общего доступа, помечает его эпохой (retireEpoch) и освобождает, когда
+// ни один читатель не объявил эпоху не больше этой (minActiveEpoch).
+class EpochReclaimer
+{
+	static constexpr uint64_t kIdle = std::numeric_limits<uint64_t>::max();
+
+	struct alignas(64) Record
+	{
+		std::atomic<uint64_t> epoch{kIdle};
+		unsigned int depth = 0;		// вложенные ReadGuard, только поток-владелец
+		bool inUse = false;
+	};
+
+public:
+	static EpochReclaimer &instance()
+	{
+		// не разрушается: записи нужны потокам до их завершения
+		static EpochReclaimer *theSingleInstance = new EpochReclaimer();
+		return *theSingleInstance;
+	}
+
+	class ReadGuard
+	{
+	public:
+		ReadGuard() : m_record(EpochReclaimer::instance().threadRecord())
+		{
+			if ( 0 == m_record->depth ++ ) {
+				m_record->epoch.store(EpochReclaimer::instance().m_epoch.load(
+										  std::memory_order_acquire),
+									  std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+			}
+		}
+
+		~ReadGuard()
+		{
+			if ( 0 == -- m_record->depth ) {
+				m_record->epoch.store(kIdle, std::memory_order_release);
+			}
+		}
+
+		ReadGuard(const ReadGuard &) = delete;
+		ReadGuard &operator=(const ReadGuard &) = delete;
+
+	private:
+		Record *m_record;
+	};
+
+	// вызывается после того, как объект убран из общего доступа
+	uint64_t retireEpoch()
+	{
+		return m_epoch.fetch_add(1, std::memory_order_seq_cst);
+	}
+
+	// Наименьшая эпоха, объявленная читателями; kIdle - читателей нет.
+	// Объект с эпохой замены меньше неё больше никто не читает.
+	uint64_t minActiveEpoch()
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		uint64_t result = kIdle;
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		for ( const std::unique_ptr<Record> &record : m_records ) {
+			uint64_t epoch = record->epoch.load(std::memory_order_acquire);
+
+			if ( epoch < result ) {
+				result = epoch;
+			}
+		}
+
+		return result;
+	}
+
+private:
+	std::atomic<uint64_t> m_epoch{1};
+	std::mutex m_mutex;
+	std::vector<std::unique_ptr<Record>> m_records;
+
+	// запись освобождается для другого потока при завершении владельца
+	struct RecordOwner
+	{
+		Record *record = nullptr;
+
+		~RecordOwner()
+		{
+			if ( nullptr != record ) {
+				EpochReclaimer::instance().release(record);
+			}
+		}
+	};
+
+	EpochReclaimer()
+	{
+	}
+
+	Record *threadRecord()
+	{
+		thread_local RecordOwner owner;
+
+		if ( nullptr == owner.record ) {
+			owner.record = acquire();
+		}
+
+		return owner.record;
+	}
+
+	Record *acquire()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		for ( const std::unique_ptr<Record> &record : m_records ) {
+			if ( ! record->inUse ) {
+				record->inUse = true;
+				return record.get();
+			}
+		}
+		m_records.emplace_back(new Record());
+		m_records.back()->inUse = true;
+
+		return m_records.back().get();
+	}
+
+	void release(Record *record)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		record->epoch.store(kIdle, std::memory_order_relaxed);
+		record->depth = 0;
+		record->inUse = false;
+	}
+};
+
+// Потокобезопасная хеш-таблица, разбитая на ShardCount независимых частей.
+// Интерфейс совместим с SimpleMap.
+//
+// Каждая часть - открытая адресация с линейным пробированием и своя блокировка
+// писателей. Если Key и Value тривиально копируемые, чтение не пишет в общую
+// память: оно идёт по seqlock'у части и повторяется, если во время чтения была
+// запись. Таблицы, заменённые при перестроении, в этом режиме освобождаются
+// через EpochReclaimer - когда их уже не может читать опоздавший читатель.
+// Иначе чтение идёт под shared_lock части.
+//
+// Key и Value должны иметь конструктор по умолчанию.
+template<typename Key, typename Value,
+		 typename Hash = std::hash<Key>, size_t ShardCount = 16>
+class ShardedMap
+{
+	static_assert(0 != ShardCount && 0 == (ShardCount & (ShardCount - 1)),
+				  "ShardCount must be a power of two");
+
+	static constexpr bool kOptimistic = std::is_trivially_copyable<Key>::value &&
+										std::is_trivially_copyable<Value>::value;
+
+	static constexpr size_t kMinCapacity = 16;
+
+	enum SlotState : uint8_t
+	{
+		Empty = 0,
+		Full,
+		Deleted		// удалённый элемент; пробирование идёт дальше
+	};
+
+	struct Slot
+	{
+		uint8_t state = Empty;
+		Key key;
+		Value value;
+	};
+
+	struct Table
+	{
+		explicit Table(size_t capacity)
+			: mask(capacity - 1), slots(new Slot[capacity])
+		{
+		}
+
+		size_t mask;
+		std::unique_ptr<Slot[]> slots;
+	};
+
+	struct alignas(64) Shard
+	{
+		std::atomic<uint64_t> sequence{0};	// нечётный - идёт запись
+		std::atomic<Table *> table{nullptr};
+		std::atomic<size_t> count{0};
+		size_t used = 0;					// Full + Deleted
+		mutable std::shared_mutex mutex;
+		std::unique_ptr<Table> current;
+
+		// заменённые таблицы и эпохи замены (EpochReclaimer)
+		std::vector<std::pair<uint64_t, std::unique_ptr<Table>>> retired;
+	};
+
+public:
+	ShardedMap()
+	{
+	}
+
+	~ShardedMap()
+	{
+	}
+
+	ShardedMap(const ShardedMap &other)
+	{
+		copyFrom(other);
+	}
+
+	ShardedMap &operator=(const ShardedMap &other)
+	{
+		if ( this != &other ) {
+			clear();
+			copyFrom(other);
+		}
+
+		return *this;
+	}
+
+	bool read(const Key &key, /*out*/ Value &value) const
+	{
+		size_t hash = mix(m_hasher(key));
+		const Shard &shard = shardOf(hash);
+
+		if ( kOptimistic ) {
+			return optimisticRead(shard, hash, key, value);
+		}
+		std::shared_lock<std::shared_mutex> lock(shard.mutex);
+		const Slot *slot = lookup(shard.current.get(), hash, key);
+
+		if ( nullptr == slot ) {
+			return false;
+		}
+		value = slot->value;
+
+		return true;
+	}
+
+	void write(const Key &key, const Value &value)
+	{
+		insert(key, value, true);
+	}
+
+	bool writeIfNotExist(const Key &key, const Value &value)
+	{
+		return insert(key, value, false);
+	}
+
+	void erase(const Key &key)
+	{
+		size_t hash = mix(m_hasher(key));
+		Shard &shard = shardOf(hash);
+		std::lock_guard<std::shared_mutex> lock(shard.mutex);
+
+		Slot *slot = const_cast<Slot *>(lookup(shard.current.get(), hash, key));
+
+		if ( nullptr == slot ) {
+			return;
+		}
+		WriteSection section(shard);
+		slot->state = Deleted;
+		slot->key = Key();
+		slot->value = Value();
+		-- shard.count;
+	}
+
+	std::size_t size() const
+	{
+		size_t result = 0;
+
+		for ( const Shard &shard : m_shards ) {
+			result += shard.count.load(std::memory_order_relaxed);
+		}
+
+		return result;
+	}
+
+	void clear()
+	{
+		for ( Shard &shard : m_shards ) {
+			std::lock_guard<std::shared_mutex> lock(shard.mutex);
+
+			if ( nullptr == shard.current ) {
+				continue;
+			}
+			WriteSection section(shard);
+			shard.table.store(nullptr, std::memory_order_release);
+			retire(shard, std::move(shard.current));
+			shard.count = 0;
+			shard.used = 0;
+		}
+	}
+
+	// pred вызывается для элементов, пока не вернёт true
+	template<typename Function>
+	Function find(Function pred)
+	{
+		forEachUntil([&pred](const std::pair<Key, Value> &item) {
+			return pred(item);
+		});
+
+		return pred;
+	}
+
+	bool find(std::function<bool (const std::pair<Key, Value>&) > pred, /*out*/ Key &key) const
+	{
+		return forEachUntil([&pred, &key](const std::pair<Key, Value> &item) {
+			if ( ! pred(item) ) {
+				return false;
+			}
+			key = item.first;
+			return true;
+		});
+	}
+
+private:
+	Shard m_shards[ShardCount];
+	Hash m_hasher;
+
+	// запись внутри seqlock'а части; вызывается под блокировкой писателя
+	class WriteSection
+	{
+	public:
+		explicit WriteSection(Shard &shard) : m_shard(shard)
+		{
+			m_shard.sequence.store(m_shard.sequence.load(std::memory_order_relaxed) + 1,
+								   std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+		}
+
+		~WriteSection()
+		{
+			m_shard.sequence.store(m_shard.sequence.load(std::memory_order_relaxed) + 1,
+								   std::memory_order_release);
+		}
+
+	private:
+		Shard &m_shard;
+	};
+
+	// перемешивание хеша: std::hash целых - тождественная функция
+	static size_t mix(size_t hash)
+	{
+		uint64_t value = hash;
+		value ^= value >> 33;
+		value *= 0xff51afd7ed558ccdULL;
+		value ^= value >> 33;
+		value *= 0xc4ceb9fe1a85ec53ULL;
+		value ^= value >> 33;
+
+		return size_t(value);
+	}
+
+	// старшие биты - часть, младшие - позиция в таблице
+	Shard &shardOf(size_t hash)
+	{
+		return m_shards[(hash >> 48) & (ShardCount - 1)];
+	}
+
+	const Shard &shardOf(size_t hash) const
+	{
+		return m_shards[(hash >> 48) & (ShardCount - 1)];
+	}
+
+	static const Slot *lookup(const Table *table, size_t hash, const Key &key)
+	{
+		if ( nullptr == table ) {
+			return nullptr;
+		}
+
+		for ( size_t i = 0, pos = hash & table->mask; i <= table->mask;
+			  ++i, pos = (pos + 1) & table->mask ) {
+			const Slot &slot = table->slots[pos];
+
+			if ( Empty == slot.state ) {
+				return nullptr;
+			}
+
+			if ( Full == slot.state && slot.key == key ) {
+				return &slot;
+			}
+		}
+
+		return nullptr;
+	}
+
+	bool optimisticRead(const Shard &shard, size_t hash, const Key &key, Value &value) const
+	{
+		EpochReclaimer::ReadGuard guard;
+
+		for (;;) {
+			uint64_t before = shard.sequence.load(std::memory_order_acquire);
+
+			if ( before & 1 ) {
+				std::this_thread::yield();
+				continue;
+			}
+			const Table *table = shard.table.load(std::memory_order_acquire);
+			bool found = false;
+
+			if ( nullptr != table ) {
+				for ( size_t i = 0, pos = hash & table->mask; i <= table->mask;
+					  ++i, pos = (pos + 1) & table->mask ) {
+					const Slot *slot = &table->slots[pos];
+					uint8_t state;
+					std::memcpy(&state, &slot->state, sizeof(state));
+
+					if ( Empty == state ) {
+						break;
+					}
+
+					if ( Full != state ) {
+						continue;
+					}
+					Key slotKey;
+					std::memcpy(static_cast<void *>(&slotKey), &slot->key, sizeof(Key));
+
+					if ( slotKey == key ) {
+						std::memcpy(static_cast<void *>(&value), &slot->value, sizeof(Value));
+						found = true;
+						break;
+					}
+				}
+			}
+			std::atomic_thread_fence(std::memory_order_acquire);
+
+			if ( shard.sequence.load(std::memory_order_relaxed) == before ) {
+				return found;
+			}
+		}
+	}
+
+	bool insert(const Key &key, const Value &value, bool overwrite)
+	{
+		size_t hash = mix(m_hasher(key));
+		Shard &shard = shardOf(hash);
+		std::lock_guard<std::shared_mutex> lock(shard.mutex);
+
+		Slot *existing = const_cast<Slot *>(lookup(shard.current.get(), hash, key));
+
+		if ( nullptr != existing ) {
+			if ( overwrite ) {
+				WriteSection section(shard);
+				existing->value = value;
+			}
+			return overwrite;
+		}
+
+		WriteSection section(shard);
+
+		// заполнение не больше 3/4, считая удалённые
+		if ( nullptr == shard.current ||
+			 (shard.used + 1) * 4 > (shard.current->mask + 1) * 3 ) {
+			rehash(shard);
+		}
+		Table *table = shard.current.get();
+		size_t pos = hash & table->mask;
+
+		while ( Full == table->slots[pos].state ) {
+			pos = (pos + 1) & table->mask;
+		}
+		Slot &slot = table->slots[pos];
+
+		if ( Empty == slot.state ) {
+			++ shard.used;
+		}
+		slot.key = key;
+		slot.value = value;
+		slot.state = Full;
+		++ shard.count;
+
+		return true;
+	}
+
+	// новая таблица вдвое больше живых элементов; удалённые не переносятся
+	void rehash(Shard &shard)
+	{
+		size_t capacity = kMinCapacity;
+
+		while ( capacity * 3 < (shard.count + 1) * 2 * 4 ) {
+			capacity *= 2;
+		}
+		std::unique_ptr<Table> fresh(new Table(capacity));
+
+		if ( nullptr != shard.current ) {
+			const Table &old = *shard.current;
+
+			for ( size_t i = 0; i <= old.mask; ++i ) {
+				const Slot &slot = old.slots[i];
+
+				if ( Full != slot.state ) {
+					continue;
+				}
+				size_t pos = mix(m_hasher(slot.key)) & fresh->mask;
+
+				while ( Full == fresh->slots[pos].state ) {
+					pos = (pos + 1) & fresh->mask;
+				}
+				fresh->slots[pos] = slot;
+			}
+		}
+		shard.used = shard.count;
+		shard.table.store(fresh.get(), std::memory_order_release);
+		retire(shard, std::move(shard.current));
+		shard.current = std::move(fresh);
+	}
+
+	// вызывается под блокировкой писателя, после замены shard.table
+	static void retire(Shard &shard, std::unique_ptr<Table> table)
+	{
+		if ( ! kOptimistic || nullptr == table ) {
+			return;
+		}
+		EpochReclaimer &reclaimer = EpochReclaimer::instance();
+		shard.retired.emplace_back(reclaimer.retireEpoch(), std::move(table));
+
+		// освобождаем все, что уже никто не читает, включая только что заменённую
+		uint64_t active = reclaimer.minActiveEpoch();
+		auto kept = shard.retired.begin();
+
+		for ( auto it = shard.retired.begin(); it != shard.retired.end(); ++it ) {
+			if ( it->first >= active ) {
+				*kept++ = std::move(*it);
+			}
+		}
+		shard.retired.erase(kept, shard.retired.end());
+	}
+
+	template<typename Function>
+	bool forEachUntil(Function func) const
+	{
+		for ( const Shard &shard : m_shards ) {
+			std::shared_lock<std::shared_mutex> lock(shard.mutex);
+			const Table *table = shard.current.get();
+
+			if ( nullptr == table ) {
+				continue;
+			}
+
+			for ( size_t i = 0; i <= table->mask; ++i ) {
+				const Slot &slot = table->slots[i];
+
+				if ( Full == slot.state &&
+					 func(std::pair<Key, Value>(slot.key, slot.value)) ) {
+					return true;
+				}
+			}
+		}
+
+		return false;
+	}
+
+	void copyFrom(const ShardedMap &other)
+	{
+		other.forEachUntil([this](const std::pair<Key, Value> &item) {
+			write(item.first, item.second);
+			return false;
+		});
+	}
+};
+
+}//namespace multithread
+#endif // CONCURRENTMAP_HPP
@@ -0,0 +1,622 @@
+#ifndef LOCKS_HPP
+#define LOCKS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+namespace multithread
+{
+
+// Подсказка процессору, что поток крутится в ожидании
+inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+	asm volatile("yield");
+#else
+	std::this_thread::yield();
+#endif
+}
+
+// Экспоненциальная пауза между попытками захвата.
+// После maxSpins холостых циклов поток уступает процессор.
+class Backoff
+{
+public:
+	explicit Backoff(uint32_t maxSpins = 1024) : m_spins(1), m_maxSpins(maxSpins)
+	{
+	}
+
+	// возвращает количество холостых циклов
+	uint32_t pause()
+	{
+		uint32_t spins = m_spins;
+
+		for ( uint32_t i = 0; i < spins; ++i ) {
+			cpuRelax();
+		}
+
+		if ( m_spins < m_maxSpins ) {
+			m_spins *= 2;
+		}
+		else {
+			std::this_thread::yield();
+		}
+
+		return spins;
+	}
+
+	void reset()
+	{
+		m_spins = 1;
+	}
+
+private:
+	uint32_t m_spins;
+	uint32_t m_maxSpins;
+};
+
+// Статистика блокировки, ничего не считающая
+struct NoLockStats
+{
+	static constexpr bool kEnabled = false;
+
+	void setName(const char *) {}
+	void onAcquire(bool, uint64_t, uint64_t) {}
+};
+
+class LockStats;
+
+// Именованные счётчики блокировок, видимые во время работы
+class LockRegistry
+{
+public:
+	static LockRegistry &instance()
+	{
+		static LockRegistry theSingleInstance;
+		return theSingleInstance;
+	}
+
+	void add(const std::string &name, const LockStats *stats)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stats.insert(std::make_pair(name, stats));
+	}
+
+	void remove(const LockStats *stats)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		for ( auto it = m_stats.begin(); it != m_stats.end(); ++it ) {
+			if ( it->second == stats ) {
+				m_stats.erase(it);
+				return;
+			}
+		}
+	}
+
+	// name -> статистика; функция вызывается под блокировкой реестра
+	template<typename Function>
+	void forEach(Function func) const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		for ( const auto &name_Stats : m_stats ) {
+			func(name_Stats.first, *name_Stats.second);
+		}
+	}
+
+	std::string toString() const;
+
+private:
+	mutable std::mutex m_mutex;
+	std::multimap<std::string, const LockStats *> m_stats;
+
+	LockRegistry() {}
+	LockRegistry(const LockRegistry &) = delete;
+	LockRegistry &operator=(const LockRegistry &) = delete;
+};
+
+// Счётчики конкуренции: захваты, захваты с ожиданием, холостые циклы,
+// суммарное время ожидания. Время меряется только при ожидании.
+class LockStats
+{
+public:
+	static constexpr bool kEnabled = true;
+
+	LockStats() : m_acquisitions(0), m_contended(0), m_spins(0), m_waitNs(0),
+		m_registered(false)
+	{
+	}
+
+	~LockStats()
+	{
+		if (m_registered) {
+			LockRegistry::instance().remove(this);
+		}
+	}
+
+	// регистрирует счётчики в LockRegistry под именем name
+	void setName(const char *name)
+	{
+		if ( nullptr == name || m_registered ) {
+			return;
+		}
+		LockRegistry::instance().add(name, this);
+		m_registered = true;
+	}
+
+	void onAcquire(bool contended, uint64_t spins, uint64_t waitNs)
+	{
+		m_acquisitions.fetch_add(1, std::memory_order_relaxed);
+
+		if (contended) {
+			m_contended.fetch_add(1, std::memory_order_relaxed);
+			m_spins.fetch_add(spins, std::memory_order_relaxed);
+			m_waitNs.fetch_add(waitNs, std::memory_order_relaxed);
+		}
+	}
+
+	uint64_t getAcquisitions() const { return m_acquisitions.load(std::memory_order_relaxed); }
+	uint64_t getContended() const { return m_contended.load(std::memory_order_relaxed); }
+	uint64_t getSpins() const { return m_spins.load(std::memory_order_relaxed); }
+	uint64_t getWaitNs() const { return m_waitNs.load(std::memory_order_relaxed); }
+
+	void reset()
+	{
+		m_acquisitions = 0;
+		m_contended = 0;
+		m_spins = 0;
+		m_waitNs = 0;
+	}
+
+private:
+	std::atomic<uint64_t> m_acquisitions;
+	std::atomic<uint64_t> m_contended;
+	std::atomic<uint64_t> m_spins;
+	std::atomic<uint64_t> m_waitNs;
+	bool m_registered;
+
+	LockStats(const LockStats &) = delete;
+	LockStats &operator=(const LockStats &) = delete;
+};
+
+inline std::string LockRegistry::toString() const
+{
+	std::stringstream sstream;
+
+	forEach([&sstream](const std::string &name, const LockStats &stats) {
+		sstream << name << ": acquisitions " << stats.getAcquisitions()
+				<< ", contended " << stats.getContended()
+				<< ", spins " << stats.getSpins()
+				<< ", wait ns " << stats.getWaitNs() << std::endl;
+	});
+
+	return sstream.str();
+}
+
+namespace lock_detail
+{
+
+inline uint64_t nowNs()
+{
+	return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// замер ожидания; без статистики ничего не делает
+template<typename Stats>
+class WaitTimer
+{
+public:
+	WaitTimer() : m_start(Stats::kEnabled ? nowNs() : 0)
+	{
+	}
+
+	uint64_t elapsed() const
+	{
+		return Stats::kEnabled ? nowNs() - m_start : 0;
+	}
+
+private:
+	uint64_t m_start;
+};
+
+} // namespace lock_detail
+
+// Все блокировки удовлетворяют Lockable (lock/try_lock/unlock) и используются
+// через std::lock_guard / std::unique_lock. Stats - NoLockStats или LockStats;
+// имя в конструкторе регистрирует статистику в LockRegistry.
+// Чтобы сменить тип блокировки, не трогая мест использования, заводите typedef.
+
+// test-and-test-and-set с экспоненциальной паузой.
+// Дёшев без конкуренции, не справедлив.
+template<typename Stats = NoLockStats>
+class TTASLock
+{
+public:
+	explicit TTASLock(const char *name = nullptr) : m_locked(false)
+	{
+		m_stats.setName(name);
+	}
+
+	void lock()
+	{
+		if ( ! m_locked.exchange(true, std::memory_order_acquire) ) {
+			m_stats.onAcquire(false, 0, 0);
+			return;
+		}
+		lock_detail::WaitTimer<Stats> timer;
+		Backoff backoff;
+		uint64_t spins = 0;
+
+		do {
+			// ждём чтением, не занимая кэш-линию на запись
+			while ( m_locked.load(std::memory_order_relaxed) ) {
+				spins += backoff.pause();
+			}
+		} while ( m_locked.exchange(true, std::memory_order_acquire) );
+
+		m_stats.onAcquire(true, spins, timer.elapsed());
+	}
+
+	bool try_lock()
+	{
+		if ( m_locked.load(std::memory_order_relaxed) ||
+			 m_locked.exchange(true, std::memory_order_acquire) ) {
+			return false;
+		}
+		m_stats.onAcquire(false, 0, 0);
+
+		return true;
+	}
+
+	void unlock()
+	{
+		m_locked.store(false, std::memory_order_release);
+	}
+
+	const Stats &getStats() const
+	{
+		return m_stats;
+	}
+
+private:
+	std::atomic<bool> m_locked;
+	Stats m_stats;
+
+	TTASLock(const TTASLock &) = delete;
+	TTASLock &operator=(const TTASLock &) = delete;
+};
+
+// Билетная блокировка: потоки получают её строго по очереди.
+// Пауза пропорциональна числу потоков впереди.
+// Как и MCS, плохо переносит потоков больше, чем процессоров: очередь ждёт
+// вытесненного владельца.
+template<typename Stats = NoLockStats>
+class TicketLock
+{
+public:
+	explicit TicketLock(const char *name = nullptr) : m_next(0), m_serving(0)
+	{
+		m_stats.setName(name);
+	}
+
+	void lock()
+	{
+		uint32_t ticket = m_next.fetch_add(1, std::memory_order_relaxed);
+		uint32_t serving = m_serving.load(std::memory_order_acquire);
+
+		if ( serving == ticket ) {
+			m_stats.onAcquire(false, 0, 0);
+			return;
+		}
+		lock_detail::WaitTimer<Stats> timer;
+		uint64_t spins = 0;
+
+		while ( serving != ticket ) {
+			uint32_t ahead = ticket - serving;
+
+			// очередь длинная или владелец вытеснен - уступаем процессор
+			if ( ahead > 8 || spins > 1024 ) {
+				std::this_thread::yield();
+			}
+			else {
+				for ( uint32_t i = 0; i < ahead * 32; ++i ) {
+					cpuRelax();
+				}
+				spins += ahead * 32;
+			}
+			serving = m_serving.load(std::memory_order_acquire);
+		}
+
+		m_stats.onAcquire(true, spins, timer.elapsed());
+	}
+
+	bool try_lock()
+	{
+		uint32_t serving = m_serving.load(std::memory_order_acquire);
+		uint32_t expected = serving;
+
+		if ( ! m_next.compare_exchange_strong(expected, serving + 1,
+											  std::memory_order_acquire,
+											  std::memory_order_relaxed) ) {
+			return false;
+		}
+		m_stats.onAcquire(false, 0, 0);
+
+		return true;
+	}
+
+	void unlock()
+	{
+		m_serving.store(m_serving.load(std::memory_order_relaxed) + 1,
+						std::memory_order_release);
+	}
+
+	const Stats &getStats() const
+	{
+		return m_stats;
+	}
+
+private:
+	alignas(64) std::atomic<uint32_t> m_next;
+	alignas(64) std::atomic<uint32_t> m_serving;
+	Stats m_stats;
+
+	TicketLock(const TicketLock &) = delete;
+	TicketLock &operator=(const TicketLock &) = delete;
+};
+
+namespace lock_detail
+{
+
+struct alignas(64) McsNode
+{
+	std::atomic<McsNode *> next;
+	std::atomic<bool> locked;
+};
+
+// узлы очереди MCS, принадлежащие потоку; одновременно удерживаемых
+// MCS-блокировок не больше kMaxNodes
+struct McsThreadNodes
+{
+	static constexpr uint32_t kMaxNodes = 32;
+
+	McsNode nodes[kMaxNodes];
+	uint32_t used = 0;	// битовая маска занятых узлов
+
+	McsNode *acquire()
+	{
+		for ( uint32_t i = 0; i < kMaxNodes; ++i ) {
+			if ( 0 == (used & (1u << i)) ) {
+				used |= 1u << i;
+				return &nodes[i];
+			}
+		}
+
+		return nullptr;
+	}
+
+	void release(McsNode *node)
+	{
+		used &= ~(1u << uint32_t(node - nodes));
+	}
+
+	static McsThreadNodes &current()
+	{
+		thread_local McsThreadNodes theNodes;
+		return theNodes;
+	}
+};
+
+} // namespace lock_detail
+
+// Очередь MCS: каждый ждущий поток крутится на собственной кэш-линии,
+// передача блокировки - строго по очереди. Лучше всего при сильной конкуренции.
+// Разблокировать должен захвативший поток.
+template<typename Stats = NoLockStats>
+class MCSLock
+{
+	typedef lock_detail::McsNode Node;
+
+public:
+	explicit MCSLock(const char *name = nullptr) : m_tail(nullptr), m_holder(nullptr)
+	{
+		m_stats.setName(name);
+	}
+
+	void lock()
+	{
+		Node *node = lock_detail::McsThreadNodes::current().acquire();
+
+		if ( nullptr == node ) {
+			std::terminate();	// слишком много вложенных MCS-блокировок
+		}
+		node->next.store(nullptr, std::memory_order_relaxed);
+		node->locked.store(true, std::memory_order_relaxed);
+
+		Node *previous = m_tail.exchange(node, std::memory_order_acq_rel);
+
+		if ( nullptr == previous ) {
+			m_holder = node;
+			m_stats.onAcquire(false, 0, 0);
+			return;
+		}
+		lock_detail::WaitTimer<Stats> timer;
+		Backoff backoff(64);
+		uint64_t spins = 0;
+		previous->next.store(node, std::memory_order_release);
+
+		while ( node->locked.load(std::memory_order_acquire) ) {
+			spins += backoff.pause();
+		}
+		m_holder = node;
+		m_stats.onAcquire(true, spins, timer.elapsed());
+	}
+
+	bool try_lock()
+	{
+		Node *node = lock_detail::McsThreadNodes::current().acquire();
+
+		if ( nullptr == node ) {
+			return false;
+		}
+		node->next.store(nullptr, std::memory_order_relaxed);
+		node->locked.store(true, std::memory_order_relaxed);
+		Node *expected = nullptr;
+
+		if ( ! m_tail.compare_exchange_strong(expected, node,
+											  std::memory_order_acq_rel,
+											  std::memory_order_relaxed) ) {
+			lock_detail::McsThreadNodes::current().release(node);
+			return false;
+		}
+		m_holder = node;
+		m_stats.onAcquire(false, 0, 0);
+
+		return true;
+	}
+
+	void unlock()
+	{
+		Node *node = m_holder;
+		Node *next = node->next.load(std::memory_order_acquire);
+
+		if ( nullptr == next ) {
+			Node *expected = node;
+
+			if ( m_tail.compare_exchange_strong(expected, nullptr,
+												std::memory_order_acq_rel,
+												std::memory_order_relaxed) ) {
+				lock_detail::McsThreadNodes::current().release(node);
+				return;
+			}
+
+			// следующий уже встал в очередь, но ещё не связался с нами
+			while ( nullptr == (next = node->next.load(std::memory_order_acquire)) ) {
+				cpuRelax();
+			}
+		}
+		next->locked.store(false, std::memory_order_release);
+		lock_detail::McsThreadNodes::current().release(node);
+	}
+
+	const Stats &getStats() const
+	{
+		return m_stats;
+	}
+
+private:
+	std::atomic<Node *> m_tail;
+	Node *m_holder;	// узел владельца; читается только владельцем
+	Stats m_stats;
+
+	MCSLock(const MCSLock &) = delete;
+	MCSLock &operator=(const MCSLock &) = delete;
+};
+
+// Сначала крутится (TTAS), затем засыпает на condition_variable.
+// Для критических секций неизвестной длины: короткие ожидания не уходят в ядро,
+// длинные не жгут процессор.
+template<typename Stats = NoLockStats>
+class SpinThenParkLock
+{
+	enum State : int
+	{
+		Free = 0,
+		Locked,
+		LockedWithWaiters
+	};
+
+public:
+	explicit SpinThenParkLock(const char *name = nullptr, uint32_t spinLimit = 4096)
+		: m_state(Free), m_spinLimit(spinLimit)
+	{
+		m_stats.setName(name);
+	}
+
+	void lock()
+	{
+		int expected = Free;
+
+		if ( m_state.compare_exchange_strong(expected, Locked, std::memory_order_acquire,
+											 std::memory_order_relaxed) ) {
+			m_stats.onAcquire(false, 0, 0);
+			return;
+		}
+		lock_detail::WaitTimer<Stats> timer;
+		Backoff backoff(256);
+		uint64_t spins = 0;
+
+		while ( spins < m_spinLimit ) {
+			if ( Free == m_state.load(std::memory_order_relaxed) ) {
+				expected = Free;
+
+				if ( m_state.compare_exchange_weak(expected, Locked,
+												   std::memory_order_acquire,
+												   std::memory_order_relaxed) ) {
+					m_stats.onAcquire(true, spins, timer.elapsed());
+					return;
+				}
+			}
+			spins += backoff.pause();
+		}
+
+		// засыпаем; LockedWithWaiters заставит unlock разбудить
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		while ( Free != m_state.exchange(LockedWithWaiters, std::memory_order_acquire) ) {
+			m_condition.wait(lock);
+		}
+		m_stats.onAcquire(true, spins, timer.elapsed());
+	}
+
+	bool try_lock()
+	{
+		int expected = Free;
+
+		if ( ! m_state.compare_exchange_strong(expected, Locked, std::memory_order_acquire,
+											   std::memory_order_relaxed) ) {
+			return false;
+		}
+		m_stats.onAcquire(false, 0, 0);
+
+		return true;
+	}
+
+	void unlock()
+	{
+		if ( LockedWithWaiters == m_state.exchange(Free, std::memory_order_release) ) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_condition.notify_one();
+		}
+	}
+
+	const Stats &getStats() const
+	{
+		return m_stats;
+	}
+
+private:
+	std::atomic<int> m_state;
+	uint32_t m_spinLimit;
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+	Stats m_stats;
+
+	SpinThenParkLock(const SpinThenParkLock &) = delete;
+	SpinThenParkLock &operator=(const SpinThenParkLock &) = delete;
+};
+
+} //namespace multithread
+#endif // LOCKS_HPP
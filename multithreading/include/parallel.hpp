@@ -0,0 +1,266 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include "threadpool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+// Параллельные алгоритмы над диапазонами на SimpleThreadPool.
+//
+// Диапазон делится на куски; куски разбирают потоки пула и вызывающий поток,
+// пока они не кончатся, поэтому более медленные потоки берут меньше кусков.
+// Вызывающий поток, дожидаясь чужих кусков, выполняет задачи из очереди пула -
+// вызов из потока того же пула (вложенный) не блокирует пул.
+// Если функция бросила исключение, оставшиеся куски не выполняются; вызов
+// дожидается уже начатых и перебрасывает первое исключение в вызывающем потоке.
+// Итераторы - произвольного доступа.
+// grain - размер куска; 0 - по размеру диапазона и числу потоков.
+
+namespace multithread
+{
+
+namespace parallel_detail
+{
+
+// кусков на поток при автоматическом размере куска
+const size_t kChunksPerThread = 8;
+
+inline size_t chunkSize(SimpleThreadPool &pool, size_t count, size_t grain)
+{
+	if ( 0 != grain ) {
+		return grain;
+	}
+	size_t threads = pool.getThreadsCount() + 1;
+
+	return std::max<size_t>(1, count / (threads * kChunksPerThread));
+}
+
+inline size_t chunkCount(size_t count, size_t grain)
+{
+	return (count + grain - 1) / grain;
+}
+
+// Состояние одного параллельного вызова. Задачи пула держат его через shared_ptr:
+// задача, начавшаяся после возврата из вызова, не найдёт свободных кусков.
+struct ChunkJob
+{
+	size_t count;
+	size_t grain;
+	size_t chunks;
+	std::function<void (size_t chunk, size_t first, size_t last)> func;
+
+	std::atomic<size_t> nextChunk{0};
+	std::atomic<size_t> doneChunks{0};
+	std::mutex doneMutex;
+	std::condition_variable doneCondition;
+
+	// первое исключение func; пишется под doneMutex до отметки куска
+	std::exception_ptr error;
+
+	void runChunks()
+	{
+		for (;;) {
+			size_t chunk = nextChunk.fetch_add(1);
+
+			if ( chunk >= chunks ) {
+				return;
+			}
+			size_t first = chunk * grain;
+			size_t done = 1;
+
+			try {
+				func(chunk, first, std::min(count, first + grain));
+			}
+			catch (...) {
+				// новых кусков не выдаём, ещё не взятые считаем завершёнными
+				size_t taken = std::min(chunks, nextChunk.exchange(chunks));
+				done += chunks - taken;
+
+				std::lock_guard<std::mutex> lock(doneMutex);
+
+				if ( nullptr == error ) {
+					error = std::current_exception();
+				}
+			}
+
+			if ( chunks == doneChunks.fetch_add(done) + done ) {
+				std::lock_guard<std::mutex> lock(doneMutex);
+				doneCondition.notify_all();
+			}
+		}
+	}
+
+	bool isDone() const
+	{
+		return chunks == doneChunks;
+	}
+};
+
+// func(chunk, first, last) для кусков [0, count) размера grain
+template<typename ChunkFunc>
+void runChunked(SimpleThreadPool &pool, size_t count, size_t grain, ChunkFunc func)
+{
+	if ( 0 == count ) {
+		return;
+	}
+	size_t chunks = chunkCount(count, grain);
+
+	if ( 1 == chunks ) {
+		func(0, 0, count);
+		return;
+	}
+	auto job = std::make_shared<ChunkJob>();
+	job->count = count;
+	job->grain = grain;
+	job->chunks = chunks;
+	job->func = std::ref(func);
+
+	size_t helpers = std::min<size_t>(pool.getThreadsCount(), chunks - 1);
+
+	for ( size_t i = 0; i < helpers; ++i ) {
+		pool.submit([job]() { job->runChunks(); });
+	}
+	job->runChunks();
+
+	// куски, взятые другими потоками
+	while ( ! job->isDone() ) {
+
+		if ( pool.runPendingTask() ) {
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(job->doneMutex);
+		job->doneCondition.wait_for(lock, std::chrono::milliseconds(1),
+									[&job]() { return job->isDone(); });
+	}
+
+	// все куски отмечены - func больше никто не вызовет
+	if ( nullptr != job->error ) {
+		std::rethrow_exception(job->error);
+	}
+}
+
+} // namespace parallel_detail
+
+// func(i) для каждого i из [first, last)
+template<typename Func>
+void parallelFor(SimpleThreadPool &pool, size_t first, size_t last, Func func,
+				 size_t grain = 0)
+{
+	if ( last <= first ) {
+		return;
+	}
+	size_t count = last - first;
+
+	parallel_detail::runChunked(pool, count, parallel_detail::chunkSize(pool, count, grain),
+		[first, &func](size_t, size_t from, size_t to) {
+			for ( size_t i = from; i < to; ++i ) {
+				func(first + i);
+			}
+		});
+}
+
+// init op x0 op x1 op ... ; op - ассоциативная, порядок операндов сохраняется
+template<typename Iterator, typename T, typename BinaryOp>
+T parallelReduce(SimpleThreadPool &pool, Iterator begin, Iterator end, T init, BinaryOp op,
+				 size_t grain = 0)
+{
+	size_t count = std::distance(begin, end);
+	grain = parallel_detail::chunkSize(pool, count, grain);
+
+	std::vector< std::optional<T> > partial(parallel_detail::chunkCount(count, grain));
+
+	parallel_detail::runChunked(pool, count, grain,
+		[begin, &op, &partial](size_t chunk, size_t from, size_t to) {
+			T sum = *(begin + from);
+
+			for ( size_t i = from + 1; i < to; ++i ) {
+				sum = op(std::move(sum), *(begin + i));
+			}
+			partial[chunk] = std::move(sum);
+		});
+
+	for ( std::optional<T> &sum : partial ) {
+		init = op(std::move(init), std::move(*sum));
+	}
+
+	return init;
+}
+
+// *(out + i) = func(*(begin + i)); возвращает конец выходного диапазона
+template<typename Iterator, typename OutIterator, typename Func>
+OutIterator parallelTransform(SimpleThreadPool &pool, Iterator begin, Iterator end,
+							  OutIterator out, Func func, size_t grain = 0)
+{
+	size_t count = std::distance(begin, end);
+
+	parallel_detail::runChunked(pool, count, parallel_detail::chunkSize(pool, count, grain),
+		[begin, out, &func](size_t, size_t from, size_t to) {
+			for ( size_t i = from; i < to; ++i ) {
+				*(out + i) = func(*(begin + i));
+			}
+		});
+
+	return out + count;
+}
+
+// Включающий префиксный скан: *(out + i) = x0 op ... op xi; op - ассоциативная.
+// Два прохода: скан внутри кусков, затем добавление суммы предыдущих кусков.
+// out может совпадать с begin.
+template<typename Iterator, typename OutIterator, typename BinaryOp>
+OutIterator parallelScan(SimpleThreadPool &pool, Iterator begin, Iterator end,
+						 OutIterator out, BinaryOp op, size_t grain = 0)
+{
+	typedef typename std::iterator_traits<Iterator>::value_type T;
+
+	size_t count = std::distance(begin, end);
+	grain = parallel_detail::chunkSize(pool, count, grain);
+	size_t chunks = parallel_detail::chunkCount(count, grain);
+
+	parallel_detail::runChunked(pool, count, grain,
+		[begin, out, &op](size_t, size_t from, size_t to) {
+			T sum = *(begin + from);
+			*(out + from) = sum;
+
+			for ( size_t i = from + 1; i < to; ++i ) {
+				sum = op(std::move(sum), *(begin + i));
+				*(out + i) = sum;
+			}
+		});
+
+	if ( chunks < 2 ) {
+		return out + count;
+	}
+
+	// offset[c] - сумма кусков до c (последний элемент скана предыдущего куска)
+	std::vector< std::optional<T> > offset(chunks);
+	offset[1] = *(out + (grain - 1));
+
+	for ( size_t chunk = 2; chunk < chunks; ++chunk ) {
+		offset[chunk] = op(*offset[chunk - 1], *(out + (chunk * grain - 1)));
+	}
+
+	parallel_detail::runChunked(pool, count - grain, grain,
+		[out, grain, &op, &offset](size_t chunk, size_t from, size_t to) {
+			const T &add = *offset[chunk + 1];
+
+			for ( size_t i = grain + from; i < grain + to; ++i ) {
+				*(out + i) = op(add, *(out + i));
+			}
+		});
+
+	return out + count;
+}
+
+} // namespace multithread
+
+#endif // PARALLEL_HPP
@@ -0,0 +1,579 @@
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+#include "threadpool.hpp"
+#include "threadsafequeue.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace multithread
+{
+
+// Ограниченный канал между стадиями конвейера. push блокируется, пока канал
+// полон (так давление передаётся вверх по конвейеру), pop - пока он пуст и не закрыт.
+template<typename T>
+class BoundedChannel
+{
+public:
+	explicit BoundedChannel(size_t capacity)
+		: m_closed(false), m_spaceWaiters(0)
+	{
+		m_queue.setMaxSize(0 == capacity ? 1 : capacity);
+	}
+
+	BoundedChannel(const BoundedChannel &) = delete;
+	BoundedChannel &operator=(const BoundedChannel &) = delete;
+
+	// false - канал закрыт
+	bool push(T value)
+	{
+		std::vector<T> single;
+		single.push_back(std::move(value));
+
+		return pushBulk(single);
+	}
+
+	// переносит все элементы items, ожидая места; false - канал закрыт
+	bool pushBulk(std::vector<T> &items)
+	{
+		auto first = items.begin();
+
+		while ( first != items.end() ) {
+			if (m_closed) {
+				return false;
+			}
+			first += m_queue.pushBulk(first, items.end());
+
+			if ( first != items.end() ) {
+				waitForSpace();
+			}
+		}
+		items.clear();
+
+		return true;
+	}
+
+	// Добавляет в out от 1 до maxCount элементов, ожидая первого.
+	// 0 - канал закрыт и пуст.
+	size_t popBatch(std::vector<T> &out, size_t maxCount)
+	{
+		for (;;) {
+			size_t count = m_queue.popBulk(out, maxCount);
+
+			if ( 0 != count ) {
+				notifySpace();
+				return count;
+			}
+
+			if ( m_closed && m_queue.empty() ) {
+				return 0;
+			}
+			T value;
+
+			// закрытие проверяется не реже kPollInterval
+			if ( m_queue.waitAndPop(value, kPollInterval) ) {
+				out.push_back(std::move(value));
+				count = 1 + m_queue.popBulk(out, maxCount - 1);
+				notifySpace();
+				return count;
+			}
+		}
+	}
+
+	// больше элементов не будет; оставшиеся можно дочитать
+	void close()
+	{
+		m_closed = true;
+		std::lock_guard<std::mutex> lock(m_spaceMutex);
+		m_spaceCondition.notify_all();
+	}
+
+	bool isClosed() const
+	{
+		return m_closed;
+	}
+
+	size_t size() const
+	{
+		return m_queue.size();
+	}
+
+	size_t capacity()
+	{
+		return m_queue.getMaxSize();
+	}
+
+private:
+	static constexpr std::chrono::milliseconds kPollInterval{5};
+
+	SimpleQueue<T> m_queue;
+	std::atomic<bool> m_closed;
+
+	std::mutex m_spaceMutex;
+	std::condition_variable m_spaceCondition;
+	std::atomic<int> m_spaceWaiters;
+
+	void waitForSpace()
+	{
+		std::unique_lock<std::mutex> lock(m_spaceMutex);
+		++ m_spaceWaiters;
+
+		// место могло освободиться до захвата m_spaceMutex
+		if ( m_queue.size() >= m_queue.getMaxSize() && ! m_closed ) {
+			m_spaceCondition.wait_for(lock, kPollInterval);
+		}
+		-- m_spaceWaiters;
+	}
+
+	void notifySpace()
+	{
+		if ( 0 != m_spaceWaiters ) {
+			std::lock_guard<std::mutex> lock(m_spaceMutex);
+			m_spaceCondition.notify_all();
+		}
+	}
+};
+
+struct PipelineStageOptions
+{
+	// потоков, обрабатывающих стадию
+	unsigned int parallelism = 1;
+
+	// выход стадии - в порядке входа конвейера, даже при parallelism > 1;
+	// у последней стадии порядок вызовов сохраняется только при parallelism = 1
+	bool ordered = false;
+
+	// сколько элементов стадия забирает и отдаёт за раз
+	size_t batchSize = 1;
+
+	// ёмкость входного канала стадии
+	size_t capacity = 1024;
+};
+
+struct PipelineStageStats
+{
+	std::string name;
+	unsigned int parallelism;
+	unsigned long long processed;
+	size_t queueDepth;			// во входном канале сейчас
+	size_t capacity;
+	unsigned long long busyNs;		// в функции стадии, суммарно по потокам
+	unsigned long long blockedNs;	// в ожидании места в следующем канале
+};
+
+namespace pipeline_detail
+{
+
+// элемент с номером по порядку входа в конвейер
+template<typename T>
+struct Sequenced
+{
+	uint64_t sequence;
+	T value;
+};
+
+struct NoOutput {};
+
+inline unsigned long long elapsedNs(std::chrono::steady_clock::time_point start)
+{
+	return static_cast<unsigned long long>(
+			std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - start).count());
+}
+
+class StageBase
+{
+public:
+	virtual ~StageBase() {}
+	virtual void start(SimpleThreadPool &pool) = 0;
+	virtual PipelineStageStats stats() const = 0;
+	virtual unsigned int parallelism() const = 0;
+
+	// конвейер отменён: вход закрывается, необработанное отбрасывается
+	virtual void cancel() = 0;
+};
+
+// In -> Out; Out = void - последняя стадия
+template<typename In, typename Out, typename Func>
+class Stage : public StageBase
+{
+	typedef typename std::conditional<std::is_void<Out>::value, NoOutput, Out>::type OutValue;
+
+public:
+	typedef BoundedChannel< Sequenced<In> > InputChannel;
+	typedef BoundedChannel< Sequenced<OutValue> > OutputChannel;
+
+	Stage(const std::string &name, Func func, const PipelineStageOptions &options,
+		  std::function<void ()> onDone, std::function<void (std::exception_ptr)> onError)
+		: m_name(name), m_func(std::move(func)), m_options(options),
+		  m_input(std::make_shared<InputChannel>(options.capacity)), m_onDone(onDone),
+		  m_onError(onError), m_cancelled(false),
+		  m_activeWorkers(0), m_processed(0), m_busyNs(0), m_blockedNs(0), m_nextSequence(0)
+	{
+		if ( 0 == m_options.parallelism ) {
+			m_options.parallelism = 1;
+		}
+
+		if ( 0 == m_options.batchSize ) {
+			m_options.batchSize = 1;
+		}
+	}
+
+	void start(SimpleThreadPool &pool) override
+	{
+		m_activeWorkers = m_options.parallelism;
+
+		for ( unsigned int i = 0; i < m_options.parallelism; ++i ) {
+			pool.submit([this]() { work(); });
+		}
+	}
+
+	PipelineStageStats stats() const override
+	{
+		return {m_name, m_options.parallelism, m_processed, m_input->size(),
+				m_options.capacity, m_busyNs, m_blockedNs};
+	}
+
+	unsigned int parallelism() const override
+	{
+		return m_options.parallelism;
+	}
+
+	void cancel() override
+	{
+		m_cancelled = true;
+		m_input->close();
+	}
+
+	const std::shared_ptr<InputChannel> &getInput() const
+	{
+		return m_input;
+	}
+
+	// вход следующей стадии; у последней стадии выхода нет
+	void setOutput(std::shared_ptr<OutputChannel> output)
+	{
+		m_output = std::move(output);
+	}
+
+private:
+	std::string m_name;
+	Func m_func;
+	PipelineStageOptions m_options;
+	std::shared_ptr<InputChannel> m_input;
+	std::shared_ptr<OutputChannel> m_output;
+	std::function<void ()> m_onDone;
+	std::function<void (std::exception_ptr)> m_onError;
+	std::atomic<bool> m_cancelled;
+
+	std::atomic<unsigned int> m_activeWorkers;
+	std::atomic<unsigned long long> m_processed;
+	std::atomic<unsigned long long> m_busyNs;
+	std::atomic<unsigned long long> m_blockedNs;
+
+	// сборка по порядку (ordered)
+	std::mutex m_reorderMutex;
+	std::map< uint64_t, OutValue > m_pending;
+	uint64_t m_nextSequence;
+
+	void work()
+	{
+		std::vector< Sequenced<In> > batch;
+		std::vector< Sequenced<OutValue> > results;
+
+		while ( ! m_cancelled && 0 != m_input->popBatch(batch, m_options.batchSize) ) {
+			auto start = std::chrono::steady_clock::now();
+
+			try {
+				for ( Sequenced<In> &item : batch ) {
+					if constexpr ( std::is_void<Out>::value ) {
+						m_func(std::move(item.value));
+					}
+					else {
+						results.push_back({item.sequence, m_func(std::move(item.value))});
+					}
+				}
+			}
+			catch (...) {
+				// отменяет весь конвейер, в том числе эту стадию
+				m_onError(std::current_exception());
+				break;
+			}
+			m_busyNs += elapsedNs(start);
+			m_processed += batch.size();
+			batch.clear();
+
+			if ( ! results.empty() ) {
+				start = std::chrono::steady_clock::now();
+				emit(results);
+				m_blockedNs += elapsedNs(start);
+			}
+		}
+
+		// последний поток стадии закрывает следующий канал
+		if ( 1 == m_activeWorkers.fetch_sub(1) ) {
+			if ( nullptr != m_output ) {
+				m_output->close();
+			}
+			m_onDone();
+		}
+	}
+
+	void emit(std::vector< Sequenced<OutValue> > &results)
+	{
+		if ( ! m_options.ordered ) {
+			m_output->pushBulk(results);
+			return;
+		}
+		// отдаём только непрерывный отрезок номеров; под блокировкой - чтобы
+		// отрезки разных потоков не перемешались в канале
+		std::lock_guard<std::mutex> lock(m_reorderMutex);
+
+		for ( Sequenced<OutValue> &result : results ) {
+			m_pending.emplace(result.sequence, std::move(result.value));
+		}
+		results.clear();
+
+		for ( auto it = m_pending.begin();
+			  it != m_pending.end() && it->first == m_nextSequence;
+			  it = m_pending.erase(it), ++ m_nextSequence ) {
+			results.push_back({it->first, std::move(it->second)});
+		}
+		m_output->pushBulk(results);
+	}
+};
+
+} // namespace pipeline_detail
+
+// Линейный конвейер: стадии соединены ограниченными каналами, каждая стадия
+// обрабатывается своим числом потоков общего SimpleThreadPool.
+// Создаётся PipelineBuilder'ом. Исключение из функции стадии отменяет конвейер:
+// каналы закрываются (push возвращает false), необработанное отбрасывается,
+// wait() возвращает false, а исключение - getError().
+template<typename In>
+class Pipeline
+{
+	template<typename, typename>
+	friend class PipelineBuilder;
+
+public:
+	~Pipeline()
+	{
+		close();
+		wait();
+	}
+
+	Pipeline(const Pipeline &) = delete;
+	Pipeline &operator=(const Pipeline &) = delete;
+
+	// блокируется, пока вход конвейера полон; false - конвейер закрыт
+	bool push(In value)
+	{
+		return m_input->push({m_nextSequence ++, std::move(value)});
+	}
+
+	// новых элементов не будет: стадии дообрабатывают оставшиеся и завершаются
+	void close()
+	{
+		m_input->close();
+	}
+
+	// ждёт завершения всех стадий (после close или отмены);
+	// false - стадия бросила исключение (getError)
+	bool wait()
+	{
+		std::unique_lock<std::mutex> lock(m_doneMutex);
+		m_doneCondition.wait(lock, [this]{ return m_doneStages == m_stages.size(); });
+
+		return nullptr == m_error;
+	}
+
+	// первое исключение стадии; nullptr - не было
+	std::exception_ptr getError()
+	{
+		std::lock_guard<std::mutex> lock(m_doneMutex);
+		return m_error;
+	}
+
+	std::vector<PipelineStageStats> stats() const
+	{
+		std::vector<PipelineStageStats> result;
+
+		for ( const auto &stage : m_stages ) {
+			result.push_back(stage->stats());
+		}
+
+		return result;
+	}
+
+	// Стадия с самым заполненным входным каналом - узкое место:
+	// стадии до неё упираются в её вход.
+	std::string toString() const
+	{
+		std::stringstream sstream;
+
+		for ( const PipelineStageStats &stage : stats() ) {
+			sstream << stage.name << " x" << stage.parallelism
+					<< ": processed " << stage.processed
+					<< ", queue " << stage.queueDepth << "/" << stage.capacity
+					<< ", busy " << stage.busyNs / 1000000 << " ms"
+					<< ", blocked " << stage.blockedNs / 1000000 << " ms" << std::endl;
+		}
+
+		return sstream.str();
+	}
+
+private:
+	typedef BoundedChannel< pipeline_detail::Sequenced<In> > InputChannel;
+
+	std::shared_ptr<InputChannel> m_input;
+	std::atomic<uint64_t> m_nextSequence;
+	std::vector< std::unique_ptr<pipeline_detail::StageBase> > m_stages;
+	std::unique_ptr<SimpleThreadPool> m_pool;
+
+	std::mutex m_doneMutex;
+	std::condition_variable m_doneCondition;
+	size_t m_doneStages;
+	std::exception_ptr m_error;
+
+	Pipeline() : m_nextSequence(0), m_doneStages(0) {}
+
+	void onStageDone()
+	{
+		std::lock_guard<std::mutex> lock(m_doneMutex);
+		++ m_doneStages;
+		m_doneCondition.notify_all();
+	}
+
+	// закрываем все каналы: ждущие места и данных потоки освобождаются
+	void onStageError(std::exception_ptr error)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_doneMutex);
+
+			if ( nullptr != m_error ) {
+				return;
+			}
+			m_error = error;
+		}
+
+		for ( const auto &stage : m_stages ) {
+			stage->cancel();
+		}
+	}
+
+	void start()
+	{
+		unsigned int threads = 0;
+
+		for ( const auto &stage : m_stages ) {
+			threads += stage->parallelism();
+		}
+		m_pool.reset(new SimpleThreadPool(threads));
+
+		for ( const auto &stage : m_stages ) {
+			stage->start(*m_pool);
+		}
+	}
+};
+
+// Собирает Pipeline<In>: stage() добавляет стадию Tail -> результат func,
+// sink() - последнюю стадию и запускает конвейер.
+//
+//   auto pipeline = PipelineBuilder<std::string>()
+//       .stage("parse", parse, {4, true, 64})
+//       .stage("enrich", enrich)
+//       .sink("publish", publish);
+template<typename In, typename Tail = In>
+class PipelineBuilder
+{
+	template<typename, typename>
+	friend class PipelineBuilder;
+
+	typedef BoundedChannel< pipeline_detail::Sequenced<Tail> > TailChannel;
+
+public:
+	PipelineBuilder()
+		: m_pipeline(new Pipeline<In>())
+	{
+		static_assert( std::is_same<In, Tail>::value, "Use stage() to change the type" );
+		Pipeline<In> *pipeline = m_pipeline.get();
+
+		// вход конвейера - вход первой стадии
+		m_connect = [pipeline](const std::shared_ptr<TailChannel> &input) {
+			pipeline->m_input = input;
+		};
+	}
+
+	template<typename Func>
+	PipelineBuilder<In, typename std::invoke_result<Func, Tail &&>::type>
+	stage(const std::string &name, Func func,
+		  const PipelineStageOptions &options = PipelineStageOptions())
+	{
+		typedef typename std::invoke_result<Func, Tail &&>::type Out;
+		static_assert( ! std::is_void<Out>::value, "Use sink() for the last stage" );
+		typedef pipeline_detail::Stage<Tail, Out, Func> StageType;
+
+		StageType *added = addStage<StageType>(name, std::move(func), options);
+
+		return PipelineBuilder<In, Out>(std::move(m_pipeline),
+			[added](const std::shared_ptr<typename StageType::OutputChannel> &output) {
+				added->setOutput(output);
+			});
+	}
+
+	// последняя стадия; конвейер запускается
+	template<typename Func>
+	std::unique_ptr< Pipeline<In> > sink(const std::string &name, Func func,
+			const PipelineStageOptions &options = PipelineStageOptions())
+	{
+		typedef pipeline_detail::Stage<Tail, void, Func> StageType;
+
+		addStage<StageType>(name, std::move(func), options);
+		m_pipeline->start();
+
+		return std::move(m_pipeline);
+	}
+
+private:
+	std::unique_ptr< Pipeline<In> > m_pipeline;
+	// подключает вход следующей стадии к выходу последней добавленной
+	std::function<void (const std::shared_ptr<TailChannel> &)> m_connect;
+
+	PipelineBuilder(std::unique_ptr< Pipeline<In> > pipeline,
+					std::function<void (const std::shared_ptr<TailChannel> &)> connect)
+		: m_pipeline(std::move(pipeline)), m_connect(std::move(connect))
+	{
+	}
+
+	template<typename StageType, typename Func>
+	StageType *addStage(const std::string &name, Func func, const PipelineStageOptions &options)
+	{
+		Pipeline<In> *pipeline = m_pipeline.get();
+		StageType *stage = new StageType(name, std::move(func), options,
+			[pipeline]() { pipeline->onStageDone(); },
+			[pipeline](std::exception_ptr error) { pipeline->onStageError(error); });
+
+		m_pipeline->m_stages.emplace_back(stage);
+		m_connect(stage->getInput());
+
+		return stage;
+	}
+};
+
+} // namespace multithread
+
+#endif // PIPELINE_HPP
@@ -4,6 +4,8 @@
 #include <atomic>
 #include <thread>
 
+#include "locks.hpp"
+
 namespace multithread
 {
 
@@ -12,12 +14,14 @@ class SpinLockGuard
 public:
 	SpinLockGuard(std::atomic_flag &flag) : m_flag{flag}
 	{
-		while (m_flag.test_and_set()) {std::this_thread::yield();}
+		Backoff backoff;
+		
+		while (m_flag.test_and_set(std::memory_order_acquire)) {backoff.pause();}
 	}
 
 	~SpinLockGuard()
 	{
-		m_flag.clear();
+		m_flag.clear(std::memory_order_release);
 	}
 
 	SpinLockGuard() = delete;
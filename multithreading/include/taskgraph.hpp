@@ -0,0 +1,314 @@
+#ifndef TASKGRAPH_HPP
+#define TASKGRAPH_HPP
+
+#include "threadpool.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <vector>
+
+namespace multithread
+{
+
+// Граф зависимых задач (DAG), исполняемый на SimpleThreadPool.
+//
+// Узел запускается, как только завершились все его предшественники:
+// у каждого узла атомарный счётчик незавершённых входов, последний
+// завершившийся предшественник запускает узел. Один из готовых узлов
+// выполняется тем же потоком, остальные отправляются в пул.
+//
+// Граф можно запускать многократно; узлы и рёбра меняются только между запусками.
+// Исключение из функции узла отменяет запуск (как cancel()); первое из них
+// возвращает getError(), runAndWait перебрасывает его после завершения запуска.
+//
+//   TaskGraph graph;
+//   auto load = graph.addNode(loadFunc);
+//   auto a = graph.addNode(transformA);
+//   auto b = graph.addNode(transformB);
+//   auto join = graph.addNode(joinFunc);
+//   graph.addEdge(load, a); graph.addEdge(load, b);
+//   graph.addEdge(a, join); graph.addEdge(b, join);
+//   graph.runAndWait(pool);
+class TaskGraph
+{
+public:
+	typedef size_t NodeID;
+
+	static constexpr NodeID kInvalidNode = std::numeric_limits<size_t>::max();
+
+	TaskGraph()
+		: m_pool(nullptr), m_validated(true), m_isRunning(false),
+		  m_remaining(0), m_cancelled(false), m_executed(0)
+	{}
+
+	// ждёт завершения запуска
+	~TaskGraph()
+	{
+		wait();
+	}
+
+	TaskGraph(const TaskGraph &) = delete;
+	TaskGraph &operator=(const TaskGraph &) = delete;
+
+	// kInvalidNode - граф запущен
+	NodeID addNode(std::function<void()> func)
+	{
+		if ( isRunning() ) {
+			return kInvalidNode;
+		}
+		m_nodes.emplace_back();
+		m_nodes.back().func = std::move(func);
+		m_validated = false;
+
+		return m_nodes.size() - 1;
+	}
+
+	// to выполняется после from
+	bool addEdge(NodeID from, NodeID to)
+	{
+		if ( from >= m_nodes.size() || to >= m_nodes.size() || from == to || isRunning() ) {
+			return false;
+		}
+		m_nodes[from].successors.push_back(to);
+		++ m_nodes[to].dependencies;
+		m_validated = false;
+
+		return true;
+	}
+
+	size_t size() const
+	{
+		return m_nodes.size();
+	}
+
+	// Запускает граф и возвращается сразу.
+	// false - граф уже запущен или содержит цикл.
+	bool run(SimpleThreadPool &pool)
+	{
+		if ( ! validate() ) {
+			return false;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_doneMutex);
+
+			if (m_isRunning) {
+				return false;
+			}
+			m_isRunning = true;
+		}
+		m_pool = &pool;
+		m_cancelled = false;
+		m_executed = 0;
+		m_error = nullptr;
+		m_remaining = m_nodes.size();
+
+		if ( m_nodes.empty() ) {
+			finishRun();
+			return true;
+		}
+
+		for ( Node &node : m_nodes ) {
+			node.pending = node.dependencies;
+		}
+
+		for ( NodeID root : m_roots ) {
+			Node *node = &m_nodes[root];
+			pool.submit([this, node]() { execute(node); });
+		}
+
+		return true;
+	}
+
+	// Ждёт завершения запуска, выполняя задачи пула в вызывающем потоке
+	// (ожидание в потоке того же пула не блокирует граф).
+	void wait()
+	{
+		while ( isRunning() ) {
+
+			if ( m_pool->runPendingTask() ) {
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(m_doneMutex);
+			m_doneCondition.wait_for(lock, std::chrono::milliseconds(1),
+									 [this]() { return ! m_isRunning; });
+		}
+	}
+
+	// true - все узлы выполнены (запуск не отменён);
+	// узел бросил исключение - оно перебрасывается
+	bool runAndWait(SimpleThreadPool &pool)
+	{
+		if ( ! run(pool) ) {
+			return false;
+		}
+		wait();
+		std::exception_ptr error = getError();
+
+		if ( nullptr != error ) {
+			std::rethrow_exception(error);
+		}
+
+		return ! m_cancelled;
+	}
+
+	// Ещё не начатые узлы текущего запуска не выполняются.
+	// Уже выполняющиеся - дорабатывают; wait() дожидается их.
+	void cancel()
+	{
+		m_cancelled = true;
+	}
+
+	bool isCancelled() const
+	{
+		return m_cancelled;
+	}
+
+	bool isRunning()
+	{
+		std::lock_guard<std::mutex> lock(m_doneMutex);
+		return m_isRunning;
+	}
+
+	// выполнено узлов в последнем запуске
+	size_t getExecutedCount() const
+	{
+		return m_executed;
+	}
+
+	// первое исключение узла последнего запуска; nullptr - не было.
+	// Окончательно после завершения запуска.
+	std::exception_ptr getError()
+	{
+		std::lock_guard<std::mutex> lock(m_doneMutex);
+		return m_error;
+	}
+
+private:
+	struct Node
+	{
+		std::function<void()> func;
+		std::vector<NodeID> successors;
+		unsigned int dependencies = 0;
+		std::atomic<unsigned int> pending{0};
+	};
+
+	// deque - адреса узлов не меняются при добавлении
+	std::deque<Node> m_nodes;
+	std::vector<NodeID> m_roots;
+	SimpleThreadPool *m_pool;
+	bool m_validated;
+
+	std::mutex m_doneMutex;
+	std::condition_variable m_doneCondition;
+	bool m_isRunning;
+
+	std::atomic<size_t> m_remaining;
+	std::atomic<bool> m_cancelled;
+	std::atomic<size_t> m_executed;
+	std::exception_ptr m_error;		// под m_doneMutex
+
+	// находит корни и проверяет отсутствие циклов (алгоритм Кана);
+	// пересчитывается только после изменения графа
+	bool validate()
+	{
+		if (m_validated) {
+			return true;
+		}
+		m_roots.clear();
+		std::vector<unsigned int> pending(m_nodes.size());
+		std::vector<NodeID> ready;
+
+		for ( NodeID id = 0; id < m_nodes.size(); ++id ) {
+			pending[id] = m_nodes[id].dependencies;
+
+			if ( 0 == pending[id] ) {
+				m_roots.push_back(id);
+				ready.push_back(id);
+			}
+		}
+		size_t visited = 0;
+
+		while ( ! ready.empty() ) {
+			NodeID id = ready.back();
+			ready.pop_back();
+			++ visited;
+
+			for ( NodeID next : m_nodes[id].successors ) {
+				if ( 0 == -- pending[next] ) {
+					ready.push_back(next);
+				}
+			}
+		}
+		m_validated = ( visited == m_nodes.size() );
+
+		return m_validated;
+	}
+
+	void execute(Node *node)
+	{
+		while ( nullptr != node ) {
+
+			if ( ! m_cancelled ) {
+				try {
+					node->func();
+					++ m_executed;
+				}
+				catch (...) {
+					fail(std::current_exception());
+				}
+			}
+			Node *next = nullptr;
+
+			// при отмене узлы не выполняются, но проходятся - чтобы запуск завершился
+			for ( NodeID id : node->successors ) {
+				Node *successor = &m_nodes[id];
+
+				if ( 1 != successor->pending.fetch_sub(1) ) {
+					continue;
+				}
+
+				if ( nullptr == next ) {
+					next = successor;
+				}
+				else {
+					m_pool->submit([this, successor]() { execute(successor); });
+				}
+			}
+
+			// после последнего узла граф может быть уже уничтожен
+			if ( 1 == m_remaining.fetch_sub(1) ) {
+				finishRun();
+				return;
+			}
+			node = next;
+		}
+	}
+
+	void fail(std::exception_ptr error)
+	{
+		std::lock_guard<std::mutex> lock(m_doneMutex);
+
+		if ( nullptr == m_error ) {
+			m_error = error;
+		}
+		m_cancelled = true;
+	}
+
+	void finishRun()
+	{
+		std::lock_guard<std::mutex> lock(m_doneMutex);
+		m_isRunning = false;
+		m_doneCondition.notify_all();
+	}
+};
+
+} // namespace multithread
+
+#endif // TASKGRAPH_HPP
@@ -2,6 +2,7 @@
 #define THREADPOOL_H
 
 #include "threadsafequeue.hpp"
+#include "affinity.hpp"
 
 
 #include <functional>
@@ -74,13 +75,13 @@ public:
 			if (false == m_intensity) {
 				
 				for (unsigned i = 0; i < threadsCount; ++i) {
-					m_threads.push_back(std::thread(&ThreadPool::workerThread, this));
+					m_threads.push_back(std::thread(&SimpleThreadPool::workerThread, this));
 				}
 			}
 			else {
 				
 				for (unsigned i = 0; i < threadsCount; ++i) {
-					m_threads.push_back(std::thread(&ThreadPool::workerThread_intense, this));
+					m_threads.push_back(std::thread(&SimpleThreadPool::workerThread_intense, this));
 				}
 			}
 		}
@@ -101,6 +102,63 @@ public:
 	{
 	    return m_workQueue.size();
 	}
+
+	// выполняет одну задачу из очереди в вызывающем потоке (помощь пулу,
+	// пока поток ждёт результата); false - очередь пуста
+	bool runPendingTask()
+	{
+		std::function<void()> task;
+
+		if ( ! m_workQueue.tryAndPop(task) ) {
+			return false;
+		}
+
+		if ( nullptr != task ) {
+
+			try {
+				task();
+			}
+			catch (const std::bad_function_call& e) {
+				std::cerr << e.what() << std::endl;
+			}
+		}
+
+		return true;
+	}
+	
+	// привязывает поток index к процессорам cpus
+	bool pinWorker(unsigned int index, const CpuSet &cpus)
+	{
+		if ( index >= m_threads.size() ) {
+			return false;
+		}
+		
+		return pinThread(m_threads[index].native_handle(), cpus);
+	}
+	
+	// spread == true - потоки по одному на процессор из cpus по кругу,
+	// иначе каждый поток может работать на любом процессоре из cpus
+	bool pinWorkers(const CpuSet &cpus, bool spread = true)
+	{
+		std::vector<int> list = cpus.cpus();
+		
+		if ( list.empty() ) {
+			return false;
+		}
+		bool result = true;
+		
+		for (unsigned int i = 0; i < m_threads.size(); ++i) {
+			CpuSet target = cpus;
+			
+			if (spread) {
+				target = CpuSet();
+				target.add(list[i % list.size()]);
+			}
+			result = pinWorker(i, target) && result;
+		}
+		
+		return result;
+	}
 	
 private:
 	int m_intensity;
@@ -133,13 +191,13 @@ private:
 	void workerThread()
 	{
 		while (!m_done) {
-			std::shared_ptr< std::function<void()> > func;
-			func = m_workQueue.waitAndPop( );
+			std::function<void()> func;
+			m_workQueue.waitAndPop(func);
 			
 			if ( nullptr != func ){
 				
 				try {
-					(*func)();
+					func();
 				}
 				catch (const std::bad_function_call& e) {
 					std::cerr << e.what() << std::endl;
@@ -4,6 +4,7 @@
 #include <shared_mutex>
 #include <map>
 #include <algorithm>
+#include <functional>
 
 namespace multithread
 {
@@ -1,119 +1,357 @@
 #ifndef THREADSAFEQUEUE_H
 #define THREADSAFEQUEUE_H
 
+#include <algorithm>
 #include <mutex>
-#include <queue>
 #include <memory>
+#include <new>
 #include <condition_variable>
 #include <atomic>
+#include <chrono>
+#include <vector>
 
 
 namespace multithread
 {
-template<typename T>
+// Ограниченная очередь на кольцевом массиве. Элементы хранятся по значению
+// (подходят и только перемещаемые типы); массив растёт по мере надобности
+// до maxSize и сжимается, когда после всплеска долго остаётся почти пустым
+// (см. shrink).
+// Ожидающие потоки будятся только если они есть.
+//
+// Allocator - память массива (например, NodeAllocator узла потребителя)
+template<typename T, typename Allocator = std::allocator<T> >
 class SimpleQueue
 {
 private:
-    mutable std::mutex m_mutex;
-    std::queue< std::shared_ptr<T> > m_dataQueue;
-    std::condition_variable m_dataCondition;
-    std::atomic<size_t> m_maxSize;
-    
+	typedef std::allocator_traits<Allocator> AllocatorTraits;
+
+	static const size_t kMinCapacity = 16;
+
+	// меньше массив не сжимается: колебания очереди в этих пределах
+	// не перераспределяют память
+	static const size_t kShrinkFloor = 1024;
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_dataCondition;
+	std::atomic<size_t> m_maxSize;
+	Allocator m_allocator;
+
+	T *m_buffer;
+	size_t m_capacity;	// степень двойки
+	size_t m_head;
+	size_t m_count;
+	size_t m_waiters;	// потоков, ждущих в waitAndPop
+
+	// наибольшее заполнение и число извлечений с начала окна сжатия
+	size_t m_peak;
+	size_t m_windowPops;
+
 public:
-        SimpleQueue(): m_maxSize(2147483647)
+	explicit SimpleQueue(const Allocator &allocator = Allocator())
+		: m_maxSize(2147483647), m_allocator(allocator),
+		  m_buffer(nullptr), m_capacity(0), m_head(0), m_count(0), m_waiters(0),
+		  m_peak(0), m_windowPops(0)
 	{
 	}
-	
-        void setMaxSize(size_t size)
+
+	~SimpleQueue()
+	{
+		destroyAll();
+		deallocate(m_buffer, m_capacity);
+	}
+
+	SimpleQueue(const SimpleQueue &) = delete;
+	SimpleQueue &operator=(const SimpleQueue &) = delete;
+
+	void setMaxSize(size_t size)
 	{
 	    m_maxSize = size;
 	}
-	
-        size_t getMaxSize()
+
+	size_t getMaxSize()
 	{
 	    return m_maxSize;
 	}
-	
-	// достает элемент из очереди, но если очередь пуста - заставляет поток ждать 
+
+	// достает элемент из очереди, но если очередь пуста - заставляет поток ждать
 	void waitAndPop(T& value)
 	{
 		std::unique_lock<std::mutex> lock(m_mutex);
-		m_dataCondition.wait(lock, [this]{ return !m_dataQueue.empty(); });
-		value = std::move(*m_dataQueue.front());
-		m_dataQueue.pop();
+		waitForData(lock);
+		value = popFront();
 	}
-	
-	// достает элемент из очереди, но если очередь пуста - заставляет поток ждать 
+
+	// достает элемент из очереди, но если очередь пуста - заставляет поток ждать
 	std::shared_ptr<T> waitAndPop()
 	{
 		std::unique_lock<std::mutex> lock(m_mutex);
-		m_dataCondition.wait(lock, [this]{ return !m_dataQueue.empty(); });
-		std::shared_ptr<T> result = m_dataQueue.front();
-		m_dataQueue.pop();
-		return result;
+		waitForData(lock);
+		return std::make_shared<T>(popFront());
 	}
-	
-	// достает элемент из очереди, но если очередь пуста - не будет заставлять поток ждать 
+
+	// ждёт не дольше timeout; false - очередь так и осталась пустой
+	template<typename Rep, typename Period>
+	bool waitAndPop(T& value, const std::chrono::duration<Rep, Period> &timeout)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		if ( 0 == m_count ) {
+			++ m_waiters;
+			m_dataCondition.wait_for(lock, timeout, [this]{ return 0 != m_count; });
+			-- m_waiters;
+
+			if ( 0 == m_count ) {
+				return false;
+			}
+		}
+		value = popFront();
+
+		return true;
+	}
+
+	// достает элемент из очереди, но если очередь пуста - не будет заставлять поток ждать
 	// вернёт успешность операции
 	bool tryAndPop(T& value)
 	{
 		std::lock_guard<std::mutex> guard(m_mutex);
-		bool result = false;
-		
-		if (!m_dataQueue.empty()) {
-			value = std::move(*m_dataQueue.front());
-			m_dataQueue.pop();
-			result = true;
-		}
-		
-		return result;
+
+		if ( 0 == m_count ) {
+			return false;
+		}
+		value = popFront();
+
+		return true;
 	}
-	
-	// достает элемент из очереди, но если очередь пуста - не будет заставлять поток ждать 
+
+	// достает элемент из очереди, но если очередь пуста - не будет заставлять поток ждать
 	// возвращает результат, если он есть, либо пустой поинтер
 	std::shared_ptr<T> tryAndPop()
 	{
 		std::lock_guard<std::mutex> guard(m_mutex);
-		
-		if (m_dataQueue.empty()) {
+
+		if ( 0 == m_count ) {
 			return std::shared_ptr<T>();
 		}
-		std::shared_ptr<T> result = m_dataQueue.front();
-		m_dataQueue.pop();
-		return result;
+
+		return std::make_shared<T>(popFront());
 	}
-	
-	
+
 	bool push(T new_value)
 	{
-		std::shared_ptr<T> data( std::make_shared<T>(std::move(new_value)) );
 		std::lock_guard<std::mutex> guard(m_mutex);
-	
-                if (m_dataQueue.size() >= m_maxSize) {
-		    return false;
+
+		if ( ! reserveOne() ) {
+			return false;
 		}
-		m_dataQueue.push(data);
-		m_dataCondition.notify_one();
+		new (&m_buffer[(m_head + m_count) & (m_capacity - 1)]) T(std::move(new_value));
+		++ m_count;
+
+		if ( 0 != m_waiters ) {
+			m_dataCondition.notify_one();
+		}
+
 		return true;
 	}
-	
+
+	// Как push, но если достигнут maxSize и canEvict(голова) - true,
+	// голова вытесняется в evicted (isEvicted = true), а новый элемент добавляется
+	template<typename Predicate>
+	bool pushEvictFront(T new_value, Predicate canEvict, T &evicted, bool &isEvicted)
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+		isEvicted = false;
+
+		if ( ! reserveOne() ) {
+			if ( 0 == m_count || ! canEvict(static_cast<const T &>(m_buffer[m_head])) ) {
+				return false;
+			}
+			evicted = popFront(false);
+			isEvicted = true;
+			reserveOne();
+		}
+		new (&m_buffer[(m_head + m_count) & (m_capacity - 1)]) T(std::move(new_value));
+		++ m_count;
+
+		if ( 0 != m_waiters ) {
+			m_dataCondition.notify_one();
+		}
+
+		return true;
+	}
+
+	// Перемещает в очередь элементы [first, last), сколько поместится до maxSize.
+	// Возвращает их количество.
+	template<typename Iterator>
+	size_t pushBulk(Iterator first, Iterator last)
+	{
+		size_t pushed = 0;
+		std::lock_guard<std::mutex> guard(m_mutex);
+
+		for ( ; first != last && reserveOne(); ++first, ++pushed ) {
+			new (&m_buffer[(m_head + m_count) & (m_capacity - 1)]) T(std::move(*first));
+			++ m_count;
+		}
+
+		if ( 0 != m_waiters && 0 != pushed ) {
+			if ( 1 == pushed ) {
+				m_dataCondition.notify_one();
+			}
+			else {
+				m_dataCondition.notify_all();
+			}
+		}
+
+		return pushed;
+	}
+
+	// Добавляет в out не больше maxCount элементов, не ожидая.
+	// Возвращает их количество.
+	size_t popBulk(std::vector<T> &out, size_t maxCount)
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+		size_t count = std::min(maxCount, m_count);
+		out.reserve(out.size() + count);
+
+		for ( size_t i = 0; i < count; ++i ) {
+			out.push_back(popFront(false));
+		}
+		shrink(count);
+
+		return count;
+	}
+
+	// Забирает всё содержимое очереди в out
+	size_t drainAll(std::vector<T> &out)
+	{
+		return popBulk(out, size_t(-1));
+	}
+
 	bool empty() const
 	{
 		std::lock_guard<std::mutex> guard(m_mutex);
-		return m_dataQueue.empty();
+		return 0 == m_count;
 	}
 
 	size_t size() const
 	{
 		std::lock_guard<std::mutex> guard(m_mutex);
-		return m_dataQueue.size();
+		return m_count;
+	}
+
+	// размер массива; для наблюдения за сжатием
+	size_t capacity() const
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+		return m_capacity;
 	}
 
 	void clear()
 	{
 		std::lock_guard<std::mutex> guard(m_mutex);
-		std::queue<std::shared_ptr<T>> emptyQueue;
-		std::swap(m_dataQueue, emptyQueue);
+		destroyAll();
+		deallocate(m_buffer, m_capacity);
+		m_buffer = nullptr;
+		m_capacity = 0;
+		m_peak = 0;
+		m_windowPops = 0;
+	}
+
+private:
+	void waitForData(std::unique_lock<std::mutex> &lock)
+	{
+		if ( 0 != m_count ) {
+			return;
+		}
+		++ m_waiters;
+		m_dataCondition.wait(lock, [this]{ return 0 != m_count; });
+		-- m_waiters;
+	}
+
+	T popFront(bool allowShrink = true)
+	{
+		T &front = m_buffer[m_head];
+		T result(std::move(front));
+		front.~T();
+		m_head = (m_head + 1) & (m_capacity - 1);
+		-- m_count;
+
+		if (allowShrink) {
+			shrink();
+		}
+
+		return result;
+	}
+
+	// место под ещё один элемент; false - достигнут maxSize
+	bool reserveOne()
+	{
+		if ( m_count >= m_maxSize ) {
+			return false;
+		}
+
+		if ( m_count == m_capacity ) {
+			relocate(0 == m_capacity ? kMinCapacity : m_capacity * 2);
+		}
+		m_peak = std::max(m_peak, m_count + 1);
+
+		return true;
+	}
+
+	// Массив больше kShrinkFloor уменьшается вдвое, если за окно из kShrinkFloor
+	// извлечений очередь ни разу не была заполнена больше чем на 1/8.
+	// Очередь, которая то растёт, то пустеет, остаётся при своём массиве.
+	void shrink(size_t pops = 1)
+	{
+		if ( m_capacity <= kShrinkFloor ) {
+			return;
+		}
+		m_windowPops += pops;
+
+		if ( m_windowPops < kShrinkFloor ) {
+			return;
+		}
+
+		if ( m_peak <= m_capacity / 8 ) {
+			relocate(m_capacity / 2);
+			return;
+		}
+		m_windowPops = 0;
+		m_peak = m_count;
+	}
+
+	void relocate(size_t capacity)
+	{
+		T *buffer = AllocatorTraits::allocate(m_allocator, capacity);
+
+		for ( size_t i = 0; i < m_count; ++i ) {
+			T &item = m_buffer[(m_head + i) & (m_capacity - 1)];
+			new (&buffer[i]) T(std::move(item));
+			item.~T();
+		}
+		deallocate(m_buffer, m_capacity);
+
+		m_buffer = buffer;
+		m_capacity = capacity;
+		m_head = 0;
+		m_peak = m_count;
+		m_windowPops = 0;
+	}
+
+	void destroyAll()
+	{
+		for ( ; 0 != m_count; --m_count ) {
+			m_buffer[m_head].~T();
+			m_head = (m_head + 1) & (m_capacity - 1);
+		}
+		m_head = 0;
+	}
+
+	void deallocate(T *buffer, size_t capacity)
+	{
+		if ( nullptr != buffer ) {
+			AllocatorTraits::deallocate(m_allocator, buffer, capacity);
+		}
 	}
 };
 
@@ -1,11 +1,26 @@
 #include "AsyncOperProcessor.h"
+#include "MessageJournal.h"
 #include <thread>
 
-static std::atomic_flag destroyReactorSpinlock = ATOMIC_FLAG_INIT;
+#include "locks.hpp"
 
 namespace andre
 {
 
+namespace
+{
+
+// тип блокировки меняется здесь; статистика - в LockRegistry
+typedef multithread::TTASLock<multithread::LockStats> DestroyReactorLock;
+
+DestroyReactorLock &destroyReactorLock()
+{
+	static DestroyReactorLock lock("AsyncOperProcessor::destroyReactor");
+	return lock;
+}
+
+} // namespace
+
 void AsyncOperProcessor::startReactorDispatcher()
 {
 	size_t reactorID;
@@ -13,15 +28,15 @@ void AsyncOperProcessor::startReactorDispatcher()
 
 	if ( getReactorID(reactorID, threadID) ) {
 		getReactor(reactorID)->handleEvents();
+		
+		// цикл мог завершиться без shutdownReactorDispatcher (Reactor::abortDrain)
+		shutdownReactorDispatcher();
 	
-		while ( destroyReactorSpinlock.test_and_set() ) {
-			;
-		}
-		{	
+		{
+			std::lock_guard<DestroyReactorLock> guard(destroyReactorLock());
 			std::shared_lock<std::shared_mutex> lk(m_reactorsMutex);
 			m_reactors[reactorID] = nullptr; // потокобезопасное самоуничтожение Реактора
 		}
-		destroyReactorSpinlock.clear();
 	}
 }
 
@@ -40,19 +55,137 @@ void AsyncOperProcessor::shutdownReactorDispatcher()
 	//удаляем всё относящееся к реактору-диспетчеру из m_mainMap
 	{
 		std::lock_guard<std::shared_mutex> lk(m_mainMapMutex);
+		m_mainMap.removeReactor(reactorID);
+		invalidateRoutes();
+	}
+}
+
+size_t AsyncOperProcessor::registerHandlers(size_t reactId,
+											const std::vector<EventHandler *> &handlers)
+{
+	if ( kNoReactor == reactId ) {
+		return 0;
+	}
+	std::vector<EventHandler *> accepted;
+	accepted.reserve(handlers.size());
+	size_t exactCount = 0;
+	size_t rangeCount = 0;
+	
+	// как AtomicCounter в registerHandler, но до конца публикации всех
+	for ( EventHandler *handler : handlers ) {
+		if (handler->m_deregistering) {
+			continue;
+		}
+		++ handler->m_registeringThreadsCounter;
 		
-		for ( auto itMain = m_mainMap.begin(); itMain != m_mainMap.end(); ) {
-			std::map<size_t, std::set<EventHandler*>> &reactMap = itMain->second;
-			reactMap.erase(reactorID);
-			
-			if ( reactMap.empty() ) {
-				m_mainMap.erase(itMain ++);
-			}
-			else {
-				++ itMain;
-			}
+		if ( handler->m_deregistering || ! handler->canRegister() ) {
+			-- handler->m_registeringThreadsCounter;
+			continue;
+		}
+		accepted.push_back(handler);
+		exactCount += handler->getHandles().size();
+		rangeCount += handler->getHandleRanges().size();
+	}
+	
+	RoutingBatch batch;
+	batch.reserve(exactCount, rangeCount);
+	
+	for ( EventHandler *handler : accepted ) {
+		handler->onRegister();
+		
+		for ( const Handle &handle : handler->getHandles() ) {
+			batch.add(handle, reactId, handler);
+		}
+		
+		for ( const HandleRange &range : handler->getHandleRanges() ) {
+			batch.add(range, reactId, handler);
+		}
+	}
+	batch.prepare();
+	
+	{
+		std::lock_guard<std::shared_mutex> lk(m_mainMapMutex);
+		m_mainMap.addBatch(batch);
+		invalidateRoutes();
+	}
+	
+	for ( EventHandler *handler : accepted ) {
+		-- handler->m_registeringThreadsCounter;
+	}
+	
+	return accepted.size();
+}
+
+size_t AsyncOperProcessor::attachReactor(const std::shared_ptr<Reactor> &reactor,
+										 size_t threadID)
+{
+	std::lock_guard<std::shared_mutex> lk(m_reactorsMutex);
+	size_t reactorID = m_reactors.size();
+	
+	for ( size_t id = 0; id < m_reactors.size(); id++ ) {
+		if ( nullptr == m_reactors[id] ) {
+			reactorID = id;
+			break;
 		}
 	}
+	
+	if ( reactorID == m_reactors.size() ) {
+		m_reactors.push_back(reactor);
+	}
+	else {
+		m_reactors[reactorID] = reactor;
+	}
+	m_threadToReactor.write(threadID, reactorID);
+	reactor->m_attached = true;
+	
+	return reactorID;
+}
+
+void AsyncOperProcessor::detachReactor(size_t threadID)
+{
+	size_t reactorID = 0;
+	
+	if ( ! m_threadToReactor.read(threadID, reactorID) ) {
+		return;
+	}
+	getReactor(reactorID)->exit();
+	m_threadToReactor.erase(threadID);
+	
+	{
+		std::lock_guard<std::shared_mutex> lk(m_mainMapMutex);
+		m_mainMap.removeReactor(reactorID);
+		invalidateRoutes();
+	}
+	
+	std::lock_guard<DestroyReactorLock> guard(destroyReactorLock());
+	std::shared_lock<std::shared_mutex> lk(m_reactorsMutex);
+	m_reactors[reactorID] = nullptr;
+}
+
+bool AsyncOperProcessor::addHandlerRoute(EventHandler *handler, const HandleRange &range)
+{
+	std::lock_guard<std::shared_mutex> lk(m_mainMapMutex);
+
+	if ( handler->m_deregistering ) {
+		return false;
+	}
+	std::set<size_t> reactors = m_mainMap.reactorsOf(handler);
+
+	if ( reactors.empty() ) {
+		return false;
+	}
+
+	for ( size_t reactorID : reactors ) {
+		if ( range.paramFrom == range.paramTo ) {
+			m_mainMap.add(Handle{range.commandID, range.paramFrom}, reactorID, handler);
+		}
+		else {
+			m_mainMap.add(range, reactorID, handler);
+		}
+	}
+	invalidateRoutes();
+
+	return true;
 }
 
 bool AsyncOperProcessor::deregisterHandler(EventHandler *handler, bool isBlocking,
@@ -77,34 +210,17 @@ bool AsyncOperProcessor::deregisterHandler(EventHandler *handler, bool isBlockin
 		}
 
 		for ( const auto &handle : handles ) {
-			auto itMain = m_mainMap.find(handle);
-
-			if ( m_mainMap.end() == itMain ) {
-				continue;
-			}
-			std::map<size_t, std::set<EventHandler*>> &reactMap = itMain->second;
-
-			for ( auto itReact = reactMap.begin(); itReact != reactMap.end(); ) {
-				std::set<EventHandler*> &handlerSet = itReact->second;
-
-				handlerSet.erase(handler);
-
-				if ( handlerSet.empty() ) {
-					reactMap.erase(itReact ++);
-				}
-				else {
-					++ itReact;
-				}
-			}
+			m_mainMap.remove(handle, handler);
+		}
 
-			if ( reactMap.empty() ) {
-				m_mainMap.erase(itMain);
-			}
+		for ( const auto &range : handler->getHandleRanges() ) {
+			m_mainMap.remove(range, handler);
 		}
 
 		if ( nullptr != marker ) {
 			unlockedRemoveHandle(marker->getData()->handle);
 		}
+		invalidateRoutes();
 	}
 
 	if (isBlocking) {
@@ -119,42 +235,132 @@ bool AsyncOperProcessor::deregisterHandler(EventHandler *handler, bool isBlockin
 bool AsyncOperProcessor::postMessage(const std::shared_ptr<MessageData> &msg,
 				std::map<unsigned long long, std::set<EventHandler *>> *overflows)
 {
+	if ( ! m_accepting.load(std::memory_order_relaxed) ) {
+		return false;
+	}
+	journalMessage(msg);
+	
 	std::shared_lock<std::shared_mutex> lk(m_mainMapMutex);
 	
+	// проверка выше - без блокировки; drainAndShutdown меняет флаг под ней
+	if ( ! m_accepting.load(std::memory_order_relaxed) ) {
+		return false;
+	}
+	
 	return unlockedPostMessage(msg, overflows);
 }
 
-bool AsyncOperProcessor::unlockedPostMessage(const std::shared_ptr<MessageData> &msg,
-				std::map<unsigned long long,  std::set<EventHandler *>> *overflows)
+bool AsyncOperProcessor::postMessage(Route &route, const std::shared_ptr<MessageData> &msg,
+				std::map<unsigned long long, std::set<EventHandler *>> *overflows)
 {
-	auto &dataPtr = *msg->getData();
-	auto it = m_mainMap.find(dataPtr.handle);
+	if ( msg->getData()->handle != route.m_handle ) {
+		return postMessage(msg, overflows);
+	}
 	
-	if ( it == m_mainMap.end() ) {
-		return false;
+	for (;;) {
+		{
+			// пока поток здесь, invalidateRoutes() не вернётся
+			multithread::AtomicCounter ac(m_routeUsers);
+			
+			if ( ! m_accepting ) {
+				return false;
+			}
+			
+			if ( route.m_version == m_routingVersion ) {
+				journalMessage(msg);
+				
+				for ( Route::Target &target : route.m_targets ) {
+					if ( ( nullptr == target.reactor ||
+						   ! target.reactor->addEvent(target.handler, msg, route.m_mailbox) ) &&
+						 overflows ) {
+						(*overflows)[target.reactorID].insert(target.handler);
+					}
+				}
+				
+				return route.m_found;
+			}
+		}
+		// без m_routeUsers: иначе invalidateRoutes() под блокировкой ждал бы нас
+		resolveRoute(route);
+	}
+}
+
+void AsyncOperProcessor::resolveRoute(Route &route)
+{
+	std::shared_lock<std::shared_mutex> lk(m_mainMapMutex);
+	route.m_version = m_routingVersion;
+	route.m_targets.clear();
+	route.m_mailbox = nullptr;
+	
+	if ( m_hasMailboxPolicies ) {
+		m_mailboxes.read(route.m_handle, route.m_mailbox);
 	}
 	
-	for ( const auto &reactId_HandlerSet : it->second ) {
-		size_t reactID = reactId_HandlerSet.first;
-		const std::set<EventHandler *> &handlerSet = reactId_HandlerSet.second;
-		
-		for ( EventHandler *handler : handlerSet ) {
-			if ( !eventToReactor(reactID, handler, msg) && overflows ) {
-				(*overflows)[reactID].insert(handler);
+	route.m_found = m_mainMap.forEachTarget(route.m_handle,
+		[&](size_t reactID, EventHandler *handler) {
+			if ( nullptr != handler->m_shardGroup && ! isShardTarget(handler, route.m_handle) ) {
+				return;
 			}
+			route.m_targets.push_back({getReactor(reactID), reactID, handler});
+		});
+}
+
+void AsyncOperProcessor::invalidateRoutes()
+{
+	++ m_routingVersion;
+	
+	while (m_routeUsers) {
+		std::this_thread::yield();
+	}
+}
+
+void AsyncOperProcessor::journalMessage(const std::shared_ptr<MessageData> &msg)
+{
+	// без журнала - одно чтение указателя
+	if ( nullptr != m_journal.load(std::memory_order_relaxed) ) {
+		multithread::AtomicCounter ac(m_journalUsers);
+		MessageJournal *journal = m_journal.load();
+		
+		if ( nullptr != journal ) {
+			journal->append(msg);
 		}
 	}
+}
+
+void AsyncOperProcessor::setJournal(MessageJournal *journal)
+{
+	m_journal.store(journal);
 	
-	return true;
+	while (m_journalUsers) {
+		std::this_thread::yield();
+	}
 }
 
-void AsyncOperProcessor::unlockedRemoveHandle(const Handle &handle)
+bool AsyncOperProcessor::unlockedPostMessage(const std::shared_ptr<MessageData> &msg,
+				std::map<unsigned long long,  std::set<EventHandler *>> *overflows)
 {
-	auto it = m_mainMap.find(handle);
+	auto &dataPtr = *msg->getData();
+	MailboxState *mailbox = nullptr;
 	
-	if ( it != m_mainMap.end() ) {
-		m_mainMap.erase(it);
+	if ( m_hasMailboxPolicies.load(std::memory_order_relaxed) ) {
+		m_mailboxes.read(dataPtr.handle, mailbox);
 	}
+	
+	return m_mainMap.forEachTarget(dataPtr.handle,
+		[&](size_t reactID, EventHandler *handler) {
+			if ( nullptr != handler->m_shardGroup && ! isShardTarget(handler, dataPtr.handle) ) {
+				return;
+			}
+			
+			if ( !eventToReactor(reactID, handler, msg, mailbox) && overflows ) {
+				(*overflows)[reactID].insert(handler);
+			}
+		});
+}
+
+void AsyncOperProcessor::unlockedRemoveHandle(const Handle &handle)
+{
+	m_mainMap.removeHandle(handle);
 }
 
 bool AsyncOperProcessor::isHandlerRegistered(EventHandler *handler, const Handle &handle)
@@ -167,40 +373,397 @@ bool AsyncOperProcessor::isHandlerRegistered(EventHandler *handler, const Handle
 	}
 
 	std::shared_lock<std::shared_mutex> lk(m_mainMapMutex);
-	auto it = m_mainMap.find(handle);
 	
-	if ( it == m_mainMap.end() ) {
+	return m_mainMap.contains(handle, reactorID, handler);
+}
+
+bool AsyncOperProcessor::isHandlerRouted(EventHandler *handler)
+{
+	std::shared_lock<std::shared_mutex> lk(m_mainMapMutex);
+	
+	return ! m_mainMap.reactorsOf(handler).empty();
+}
+
+void AsyncOperProcessor::setHandlerBlocking(EventHandler *handler, bool blocking)
+{
+	handler->m_blocking = blocking;
+}
+
+bool AsyncOperProcessor::migrateHandler(EventHandler *handler, size_t toReactorID)
+{
+	if ( ! handler->isMigratable() ) {
+		return false;
+	}
+	std::shared_ptr<Reactor> target;
+	{
+		std::shared_lock<std::shared_mutex> lk(m_reactorsMutex);
+		
+		if ( toReactorID >= m_reactors.size() ) {
+			return false;
+		}
+		target = m_reactors[toReactorID];
+	}
+	
+	if ( nullptr == target ) {
+		return false;
+	}
+	
+	// пока маршруты обработчика в таблице, он не уничтожен
+	std::lock_guard<std::shared_mutex> lk(m_mainMapMutex);
+	std::set<size_t> reactors = m_mainMap.reactorsOf(handler);
+	
+	if ( 1 != reactors.size() || toReactorID == *reactors.begin() ) {
+		return false;
+	}
+	size_t fromReactorID = *reactors.begin();
+	std::shared_ptr<Reactor> source = getReactor(fromReactorID);
+	
+	if ( nullptr == source || typeid(*source) != typeid(*target) ||
+		 handler->m_deregistering ) {
 		return false;
 	}
+	Reactor *expected = nullptr;
+	
+	if ( ! handler->m_migrationTarget.compare_exchange_strong(expected, target.get()) ) {
+		return false;
+	}
+	m_mainMap.moveHandler(handler, fromReactorID, toReactorID);
+	invalidateRoutes();
+	
+	handler->m_pendingHandoffs = 1;
 	
-	auto &handlerSet = it->second[reactorID];
+	// под исключительной блокировкой: все прежние сообщения обработчика
+	// уже в очереди source и стоят перед Handoff
+	ReactorEvent handoff = {handler, nullptr, ReactorEventKind::Handoff, toReactorID};
 	
-	if ( handlerSet.find(handler) != handlerSet.end() ) {
-		return true; 
+	if ( ! source->addEvent(handoff) ) {
+		m_mainMap.moveHandler(handler, toReactorID, fromReactorID);
+		invalidateRoutes();
+		handler->m_migrationTarget = nullptr;
+		return false;
 	}
 	
-	return false;
+	return true;
 }
 
-bool AsyncOperProcessor::eventToReactor(size_t reactId, EventHandler *handler,
-										const std::shared_ptr<MessageData> &message)
+void AsyncOperProcessor::resumeMigrated(size_t targetReactorID, EventHandler *handler)
 {
-	bool result = false;
+	// ждём последний из прежних реакторов
+	if ( 1 != handler->m_pendingHandoffs.fetch_sub(1) ) {
+		return;
+	}
+	ReactorEvent resume = {handler, nullptr, ReactorEventKind::Resume, targetReactorID};
+	
+	for (;;) {
+		std::shared_ptr<Reactor> target = getReactor(targetReactorID);
+		
+		if ( nullptr == target ) {
+			// новый реактор остановлен - маршрутов обработчика уже нет
+			handler->m_migrationTarget = nullptr;
+			return;
+		}
+		
+		if ( target->addEvent(resume) ) {
+			return;
+		}
+		std::this_thread::yield();
+	}
+}
 
-	if ( reactId < m_reactors.size() ) {
+ShardGroup *AsyncOperProcessor::createShardGroup(const std::vector<EventHandler *> &shards,
+												 size_t activeCount)
+{
+	std::set<EventHandler *> unique(shards.begin(), shards.end());
+	
+	if ( shards.empty() || unique.size() != shards.size() ) {
+		return nullptr;
+	}
+	
+	if ( 0 == activeCount || activeCount > shards.size() ) {
+		activeCount = shards.size();
+	}
+	std::lock_guard<std::shared_mutex> lk(m_mainMapMutex);
+	
+	for ( EventHandler *shard : shards ) {
+		if ( nullptr != shard->m_shardGroup ) {
+			return nullptr;
+		}
+	}
+	m_shardGroups.emplace_back(new ShardGroup());
+	ShardGroup *group = m_shardGroups.back().get();
+	
+	for ( size_t index = 0; index < shards.size(); ++index ) {
+		shards[index]->m_shardGroup = group;
+		shards[index]->m_shardIndex = ShardGroup::kStandby;
+		
+		if ( index < activeCount ) {
+			shards[index]->m_shardIndex = index;
+			group->m_shards.push_back(shards[index]);
+		}
+	}
+	invalidateRoutes();
+	
+	return group;
+}
+
+bool AsyncOperProcessor::addShard(ShardGroup *group, EventHandler *shard)
+{
+	std::vector< std::pair<size_t, EventHandler *> > unheld;
+	{
+		std::lock_guard<std::shared_mutex> lk(m_mainMapMutex);
+		
+		// не в группе или резервный в этой
+		if ( nullptr != shard->m_shardGroup &&
+			 ( group != shard->m_shardGroup || shard->m_shardIndex < group->size() ) ) {
+			return false;
+		}
+		std::vector<EventHandler *> losers = group->m_shards;
+		
+		// при росте ключи переходят только к новому шарду
+		if ( ! holdShards({shard}, losers) ) {
+			return false;
+		}
+		shard->m_shardGroup = group;
+		shard->m_shardIndex = group->m_shards.size();
+		group->m_shards.push_back(shard);
+		invalidateRoutes();
+		
+		handoffShards(losers, {shard}, unheld);
+	}
 	
-		while ( destroyReactorSpinlock.test_and_set() ) {
-            std::this_thread::yield();
+	for ( const auto &reactorID_Handler : unheld ) {
+		resumeMigrated(reactorID_Handler.first, reactorID_Handler.second);
+	}
+	
+	return true;
+}
+
+EventHandler *AsyncOperProcessor::removeShard(ShardGroup *group)
+{
+	std::vector< std::pair<size_t, EventHandler *> > unheld;
+	EventHandler *removed = nullptr;
+	{
+		std::lock_guard<std::shared_mutex> lk(m_mainMapMutex);
+		
+		if ( group->size() < 2 ) {
+			return nullptr;
 		}
-		{//spinlocked
-			std::shared_ptr<Reactor> reactor = nullptr;
-			reactor = getReactor(reactId);
+		removed = group->m_shards.back();
+		std::vector<EventHandler *> gainers(group->m_shards.begin(), group->m_shards.end() - 1);
+		
+		if ( ! holdShards(gainers, {removed}) ) {
+			return nullptr;
+		}
+		group->m_shards.pop_back();
+		
+		removed->m_shardIndex = ShardGroup::kStandby;
+		invalidateRoutes();
+		
+		handoffShards({removed}, gainers, unheld);
+	}
+	
+	for ( const auto &reactorID_Handler : unheld ) {
+		resumeMigrated(reactorID_Handler.first, reactorID_Handler.second);
+	}
+	
+	return removed;
+}
+
+bool AsyncOperProcessor::holdShards(const std::vector<EventHandler *> &gainers,
+									const std::vector<EventHandler *> &losers)
+{
+	// отложенные сообщения переносимого шарда ещё не обработаны
+	for ( EventHandler *loser : losers ) {
+		if ( 1 != m_mainMap.reactorsOf(loser).size() || nullptr != loser->m_migrationTarget ) {
+			return false;
+		}
+	}
+	std::vector<EventHandler *> held;
+	
+	for ( EventHandler *gainer : gainers ) {
+		std::set<size_t> reactors = m_mainMap.reactorsOf(gainer);
+		std::shared_ptr<Reactor> reactor;
+		Reactor *expected = nullptr;
+		
+		if ( 1 == reactors.size() ) {
+			reactor = getReactor(*reactors.begin());
+		}
+		if ( nullptr == reactor ||
+			 ! gainer->m_migrationTarget.compare_exchange_strong(expected, reactor.get()) ) {
 			
-			if ( nullptr != reactor ) {
-				result = reactor->addEvent(handler, message);
+			for ( EventHandler *handler : held ) {
+				handler->m_migrationTarget = nullptr;
 			}
+			return false;
+		}
+		gainer->m_pendingHandoffs = static_cast<int>(losers.size());
+		held.push_back(gainer);
+	}
+	
+	return true;
+}
+
+void AsyncOperProcessor::handoffShards(const std::vector<EventHandler *> &losers,
+									   const std::vector<EventHandler *> &gainers,
+									   std::vector< std::pair<size_t, EventHandler *> > &unheld)
+{
+	for ( EventHandler *loser : losers ) {
+		std::shared_ptr<Reactor> source = getReactor(*m_mainMap.reactorsOf(loser).begin());
+		
+		for ( EventHandler *gainer : gainers ) {
+			size_t targetReactorID = *m_mainMap.reactorsOf(gainer).begin();
+			ReactorEvent handoff = {gainer, nullptr, ReactorEventKind::Handoff, targetReactorID};
+			
+			if ( nullptr == source || ! source->addEvent(handoff) ) {
+				unheld.push_back({targetReactorID, gainer});
+			}
+		}
+	}
+}
+
+void AsyncOperProcessor::setMailboxPolicy(const Handle &handle, const MailboxPolicy &policy)
+{
+	std::lock_guard<std::mutex> guard(m_mailboxStatesMutex);
+	m_mailboxStates.emplace_back(new MailboxState(policy));
+	m_mailboxes.write(handle, m_mailboxStates.back().get());
+	m_hasMailboxPolicies = true;
+	invalidateRoutes();
+}
+
+void AsyncOperProcessor::clearMailboxPolicy(const Handle &handle)
+{
+	m_mailboxes.erase(handle);
+	invalidateRoutes();
+}
+
+bool AsyncOperProcessor::getMailboxCounters(const Handle &handle, MailboxCounters &counters)
+{
+	MailboxState *mailbox = nullptr;
+	
+	if ( ! m_mailboxes.read(handle, mailbox) ) {
+		return false;
+	}
+	counters = mailbox->getCounters();
+	
+	return true;
+}
+
+DrainReport AsyncOperProcessor::drainAndShutdown(std::chrono::steady_clock::time_point deadline)
+{
+	// postMessage проверяет флаг под разделяемой блокировкой: после этого
+	// ни одно сообщение не встанет в очередь за меткой конца
+	{
+		std::lock_guard<std::shared_mutex> lk(m_mainMapMutex);
+		m_accepting = false;
+	}
+	
+	while (m_routeUsers) {
+		std::this_thread::yield();
+	}
+	
+	std::vector< std::shared_ptr<Reactor> > reactors;
+	{
+		std::shared_lock<std::shared_mutex> lk(m_reactorsMutex);
+		reactors = m_reactors;
+	}
+	
+	// реакторы разбирают очереди параллельно, каждый в своём потоке
+	for ( const std::shared_ptr<Reactor> &reactor : reactors ) {
+		if ( nullptr != reactor ) {
+			reactor->beginDrain(deadline);
+		}
+	}
+	
+	// у реакторов SimExecutor потока нет - их очереди разбираем здесь
+	for ( const std::shared_ptr<Reactor> &reactor : reactors ) {
+		if ( nullptr != reactor && reactor->m_attached ) {
+			reactor->runDrain();
+		}
+	}
+	
+	for ( const std::shared_ptr<Reactor> &reactor : reactors ) {
+		while ( nullptr != reactor && ! reactor->isDrained() &&
+				std::chrono::steady_clock::now() < deadline ) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+	
+	DrainReport report = {{}, true, 0};
+	
+	for ( size_t id = 0; id < reactors.size(); ++id ) {
+		const std::shared_ptr<Reactor> &reactor = reactors[id];
+		
+		if ( nullptr == reactor ) {
+			continue;
+		}
+		// обработчик так и не вернул управление
+		bool completed = reactor->isDrained() && 0 == reactor->getDrainDiscarded();
+		reactor->abortDrain();
+		
+		report.reactors.push_back({id, reactor->getDrainProcessed(),
+								   reactor->getDrainDiscarded(), completed});
+		report.completed = report.completed && completed;
+	}
+	
+	// реакторы остановлены - новых сообщений блокирующим обработчикам не будет
+	if ( BlockingExecutor::isStarted() ) {
+		BlockingExecutor &executor = BlockingExecutor::instance();
+		auto left = deadline - std::chrono::steady_clock::now();
+		
+		if ( left.count() > 0 ) {
+			executor.waitIdle(left);
+		}
+		report.blockingPending = executor.getPendingCount();
+		report.completed = report.completed && 0 == report.blockingPending;
+	}
+	
+	return report;
+}
+
+std::vector<ReactorLoad> AsyncOperProcessor::getReactorLoads()
+{
+	std::vector<ReactorLoad> result;
+	std::shared_lock<std::shared_mutex> lk(m_mainMapMutex);
+	std::vector< std::shared_ptr<Reactor> > reactors;
+	{
+		std::shared_lock<std::shared_mutex> lkReactors(m_reactorsMutex);
+		reactors = m_reactors;
+	}
+	
+	for ( size_t id = 0; id < reactors.size(); ++id ) {
+		const std::shared_ptr<Reactor> &reactor = reactors[id];
+		
+		if ( nullptr == reactor ) {
+			continue;
+		}
+		ReactorLoad load = {id, &typeid(*reactor), reactor->getQueueSize(),
+							reactor->getBusyNs(), reactor->getHandledCount(), {}};
+		
+		for ( EventHandler *handler : m_mainMap.handlersOf(id) ) {
+			load.handlers.push_back({handler, handler->getBusyNs(),
+									 handler->getHandledCount()});
+		}
+		result.push_back(std::move(load));
+	}
+	
+	return result;
+}
+
+bool AsyncOperProcessor::eventToReactor(size_t reactId, EventHandler *handler,
+										const std::shared_ptr<MessageData> &message,
+										MailboxState *mailbox)
+{
+	bool result = false;
+
+	if ( reactId < m_reactors.size() ) {
+	
+		std::lock_guard<DestroyReactorLock> guard(destroyReactorLock());
+		std::shared_ptr<Reactor> reactor = nullptr;
+		reactor = getReactor(reactId);
+		
+		if ( nullptr != reactor ) {
+			result = reactor->addEvent(handler, message, mailbox);
 		}
-		destroyReactorSpinlock.clear();
 	}
 
 	return result;
@@ -0,0 +1,190 @@
+#include "BlockingExecutor.h"
+#include "EventHandler.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace andre
+{
+
+namespace
+{
+
+thread_local bool t_executorThread = false;
+
+long long nowNs()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace
+
+std::atomic<bool> BlockingExecutor::s_started(false);
+
+BlockingExecutor::BlockingExecutor()
+	: m_pending(0), m_completed(0), m_overBudget(0), m_budget(0),
+	  m_pool(std::max(kMinThreads, std::thread::hardware_concurrency()))
+{
+	s_started = true;
+}
+
+BlockingExecutor::~BlockingExecutor()
+{
+	stopWatchdog();
+}
+
+bool BlockingExecutor::isExecutorThread()
+{
+	return t_executorThread;
+}
+
+void BlockingExecutor::submit(EventHandler *handler, const std::shared_ptr<MessageData> &msg)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		std::unique_ptr<Strand> &strand = m_strands[handler];
+
+		if ( nullptr == strand ) {
+			strand.reset(new Strand());
+		}
+		strand->queue.push_back(msg);
+		++ m_pending;
+
+		// очередь уже разбирает задача пула
+		if ( 1 != strand->queue.size() ) {
+			return;
+		}
+	}
+	m_pool.submit([this, handler]() { runStrand(handler); });
+}
+
+void BlockingExecutor::runStrand(EventHandler *handler)
+{
+	t_executorThread = true;
+
+	Strand *strand;
+	std::shared_ptr<MessageData> msg;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		strand = m_strands[handler].get();
+		msg = strand->queue.front();
+	}
+
+	for ( unsigned int count = 1; ; ++count ) {
+		// сообщение остаётся в очереди, пока выполняется: submit не запустит вторую задачу
+		strand->startedNs = nowNs();
+		handler->handleEvent(msg);
+		strand->startedNs = 0;
+		++ m_completed;
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		strand->queue.pop_front();
+		strand->reported = false;
+
+		if ( 0 == -- m_pending ) {
+			m_idleCondition.notify_all();
+		}
+
+		if ( strand->queue.empty() ) {
+			m_strands.erase(handler);
+			return;
+		}
+
+		// остальные - следующей задачей, чтобы не занимать поток пула надолго
+		if ( kBatch == count ) {
+			m_pool.submit([this, handler]() { runStrand(handler); });
+			return;
+		}
+		msg = strand->queue.front();
+	}
+}
+
+void BlockingExecutor::increaseThreads(unsigned int threadCount)
+{
+	m_pool.increaseThreads(threadCount);
+}
+
+unsigned int BlockingExecutor::getThreadsCount()
+{
+	return m_pool.getThreadsCount();
+}
+
+bool BlockingExecutor::waitIdle(std::chrono::nanoseconds timeout)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	return m_idleCondition.wait_for(lock, timeout, [this]() { return 0 == m_pending; });
+}
+
+size_t BlockingExecutor::getPendingCount()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_pending;
+}
+
+void BlockingExecutor::setWatchdog(std::chrono::nanoseconds budget, OverBudgetCallback callback)
+{
+	stopWatchdog();
+
+	if ( 0 >= budget.count() ) {
+		return;
+	}
+	m_budget = budget;
+	m_callback = callback;
+	m_watchdog = std::thread(&BlockingExecutor::watch, this);
+}
+
+void BlockingExecutor::stopWatchdog()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_watchdogMutex);
+		m_budget = std::chrono::nanoseconds(0);
+		m_watchdogCondition.notify_all();
+	}
+
+	if ( m_watchdog.joinable() ) {
+		m_watchdog.join();
+	}
+}
+
+void BlockingExecutor::watch()
+{
+	std::unique_lock<std::mutex> watchdogLock(m_watchdogMutex);
+
+	while ( 0 != m_budget.count() ) {
+		m_watchdogCondition.wait_for(watchdogLock, m_budget / 2);
+
+		if ( 0 == m_budget.count() ) {
+			break;
+		}
+		std::vector< std::pair<EventHandler *, std::chrono::nanoseconds> > overBudget;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			long long now = nowNs();
+
+			for ( auto &handler_Strand : m_strands ) {
+				Strand &strand = *handler_Strand.second;
+				long long started = strand.startedNs;
+
+				if ( 0 == started || strand.reported ||
+					 now - started <= m_budget.count() ) {
+					continue;
+				}
+				strand.reported = true;
+				overBudget.push_back({handler_Strand.first,
+									  std::chrono::nanoseconds(now - started)});
+			}
+		}
+
+		for ( const auto &handler_Elapsed : overBudget ) {
+			++ m_overBudget;
+
+			if ( nullptr != m_callback ) {
+				m_callback(handler_Elapsed.first, handler_Elapsed.second);
+			}
+		}
+	}
+}
+
+} // namespace andre
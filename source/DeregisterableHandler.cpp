@@ -1,5 +1,6 @@
 #include "AsyncOperProcessor.h"
 #include "DeregisterableHandler.h"
+#include "NameRegistry.h"
 #include <chrono>
 
 namespace andre
@@ -7,9 +8,8 @@ namespace andre
 
 DeregisterableHandler::DeregisterableHandler() : m_registrationCounter(0)
 {
-	std::hash<std::string> hasher;
-
-	getDeregisterHandleNonConst().commandID = hasher(getMarkerCommand());
+	getDeregisterHandleNonConst().commandID =
+			NameRegistry::instance().intern(getMarkerCommand());
 	getDeregisterHandleNonConst().messageParam = getMarkerParam();
 
 	addHandle(getDeregistrationHandle());
@@ -18,9 +18,7 @@ DeregisterableHandler::DeregisterableHandler() : m_registrationCounter(0)
 DeregisterableHandler::DeregisterableHandler(const std::string &marker)
 	: m_registrationCounter(0)
 {
-	std::hash<std::string> hasher;
-
-	getDeregisterHandleNonConst().commandID = hasher(marker);
+	getDeregisterHandleNonConst().commandID = NameRegistry::instance().intern(marker);
 	getDeregisterHandleNonConst().messageParam = getMarkerParam();
 
 	addHandle(getDeregistrationHandle());
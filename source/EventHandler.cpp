@@ -5,7 +5,11 @@ namespace andre
 {
 
 EventHandler::EventHandler() : 
-	m_registeringThreadsCounter(0), m_deregistering(false), m_threadsCounter(0)
+	m_registeringThreadsCounter(0), m_deregistering(false),
+	m_migrationTarget(nullptr), m_pendingHandoffs(0),
+	m_shardGroup(nullptr), m_shardIndex(0), m_busyNs(0), m_handledCount(0), m_staticType(nullptr),
+	m_blocking(false), m_migratable(true),
+	m_threadsCounter(0)
 {
 }
 
@@ -0,0 +1,61 @@
+#include "FlatMessage.h"
+#include "MessageCodec.h"
+
+#include <chrono>
+
+namespace andre
+{
+
+uint64_t flatTimestamp()
+{
+	return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+FlatData::FlatData() : m_size(0)
+{
+}
+
+bool FlatData::assign(const char *data, size_t size)
+{
+	if ( size < sizeof(FlatHeader) ) {
+		return false;
+	}
+	FlatHeader header;
+	std::memcpy(&header, data, sizeof(header));
+
+	if ( header.getSize() != size ) {
+		return false;
+	}
+
+	m_buffer.assign((size + sizeof(uint64_t) - 1) / sizeof(uint64_t), 0);
+	std::memcpy(m_buffer.data(), data, size);
+	m_size = size;
+	handle = header.getHandle();
+
+	return true;
+}
+
+void FlatData::registerCodec(unsigned long long commandID)
+{
+	MessageCodec::instance().registerCodec(commandID,
+		[](const ConstData &data, std::string &out) {
+			const FlatData *flat = dynamic_cast<const FlatData *>(&data);
+
+			if ( nullptr == flat || 0 == flat->getSize() ) {
+				return false;
+			}
+			out.append(flat->getBuffer(), flat->getSize());
+			return true;
+		},
+		[](const char *payload, size_t length) {
+			std::unique_ptr<FlatData> flat = std::make_unique<FlatData>();
+
+			if ( ! flat->assign(payload, length) ) {
+				return std::unique_ptr<ConstData>();
+			}
+			return std::unique_ptr<ConstData>(std::move(flat));
+		});
+}
+
+} // namespace andre
@@ -0,0 +1,185 @@
+#include "IoReactor.h"
+#include "AsyncOperProcessor.h"
+
+#include <cerrno>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace andre
+{
+
+IoReactor::IoReactor() : Reactor(), m_epollFd(-1), m_eventFd(-1), m_initError(0),
+	m_needWake(false)
+{
+	m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+
+	if ( m_epollFd < 0 ) {
+		m_initError = errno;
+		return;
+	}
+	m_eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if ( m_eventFd < 0 ) {
+		m_initError = errno;
+		return;
+	}
+
+	epoll_event ev = {};
+	ev.events = EPOLLIN;
+	ev.data.fd = m_eventFd;
+
+	if ( 0 != epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_eventFd, &ev) ) {
+		m_initError = errno;
+	}
+}
+
+IoReactor::~IoReactor()
+{
+	if ( m_eventFd >= 0 ) {
+		close(m_eventFd);
+	}
+
+	if ( m_epollFd >= 0 ) {
+		close(m_epollFd);
+	}
+}
+
+IoReactor *IoReactor::current()
+{
+	std::shared_ptr<Reactor> reactor = AsyncOperProcessor::instance().getCurrentReactor();
+
+	// реактор живёт, пока его цикл не завершится в этом же потоке
+	return dynamic_cast<IoReactor *>(reactor.get());
+}
+
+bool IoReactor::watch(int fd, uint32_t events, IoHandler *handler)
+{
+	epoll_event ev = {};
+	ev.events = events;
+	ev.data.fd = fd;
+
+	if ( 0 != epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &ev) ) {
+		return false;
+	}
+	m_ioHandlers[fd] = handler;
+
+	return true;
+}
+
+bool IoReactor::modify(int fd, uint32_t events)
+{
+	epoll_event ev = {};
+	ev.events = events;
+	ev.data.fd = fd;
+
+	return 0 == epoll_ctl(m_epollFd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+bool IoReactor::unwatch(int fd)
+{
+	m_ioHandlers.erase(fd);
+
+	return 0 == epoll_ctl(m_epollFd, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+void IoReactor::handleEvents()
+{
+	const int maxReady = 64;
+	epoll_event ready[maxReady];
+	bool pending = false;
+
+	while (!m_exit) {
+		int timeout = -1;
+
+		if ( pending ) {
+			timeout = 0;
+		}
+		else {
+			m_needWake = true;
+
+			// сообщение могло прийти до взвода m_needWake
+			if ( ! m_events.empty() ) {
+				m_needWake = false;
+				timeout = 0;
+			}
+		}
+
+		int count = epoll_wait(m_epollFd, ready, maxReady, timeout);
+		m_needWake = false;
+
+		if ( count < 0 && EINTR != errno ) {
+			break;
+		}
+
+		for ( int i = 0; i < count && !m_exit; ++i ) {
+			int fd = ready[i].data.fd;
+
+			if ( fd == m_eventFd ) {
+				drainDoorbell();
+				continue;
+			}
+			// дескриптор мог быть снят обработчиком в этой же пачке
+			auto it = m_ioHandlers.find(fd);
+
+			if ( m_ioHandlers.end() != it ) {
+				it->second->handleIoEvent(fd, ready[i].events);
+			}
+		}
+
+		if (!m_exit) {
+			pending = drainMailbox();
+		}
+	}
+}
+
+void IoReactor::exit()
+{
+	Reactor::exit();
+	ringDoorbell();
+}
+
+void IoReactor::wakeUp()
+{
+	if ( m_needWake.load() && m_needWake.exchange(false) ) {
+		ringDoorbell();
+	}
+}
+
+void IoReactor::ringDoorbell()
+{
+	uint64_t one = 1;
+
+	if ( sizeof(one) != write(m_eventFd, &one, sizeof(one)) ) {
+		// счётчик eventfd переполнен - цикл и так будет разбужен
+	}
+}
+
+void IoReactor::drainDoorbell()
+{
+	uint64_t value;
+
+	while ( sizeof(value) == read(m_eventFd, &value, sizeof(value)) ) {
+		;
+	}
+}
+
+// возвращает true, если в очереди ещё остались сообщения
+bool IoReactor::drainMailbox()
+{
+	ReactorEvent re;
+
+	for ( int i = 0; i < maxEventsPerPoll && !m_exit; ++i ) {
+		re.message = nullptr;
+
+		if ( ! m_events.tryAndPop(re) ) {
+			return false;
+		}
+		dispatchEvent(re);
+	}
+
+	return ! m_events.empty();
+}
+
+} // namespace andre
@@ -0,0 +1,121 @@
+#include "MessageCodec.h"
+
+#include <cstdint>
+#include <mutex>
+
+namespace andre
+{
+
+namespace
+{
+
+const size_t kPrefixSize = 8 + 8;
+
+// поля префикса - little-endian независимо от порядка байт узла
+void appendUint64(std::string &out, uint64_t value)
+{
+	for ( int shift = 0; shift < 64; shift += 8 ) {
+		out.push_back(char(uint8_t(value >> shift)));
+	}
+}
+
+uint64_t readUint64(const char *data)
+{
+	uint64_t value = 0;
+
+	for ( int i = 7; i >= 0; -- i ) {
+		value = (value << 8) | uint8_t(data[i]);
+	}
+	return value;
+}
+
+} // namespace
+
+void MessageCodec::registerCodec(unsigned long long commandID,
+								 const Encoder &encoder, const Decoder &decoder,
+								 const std::type_info *type)
+{
+	std::lock_guard<std::shared_mutex> lk(m_codecsMutex);
+	m_codecs[commandID] = Codec{encoder, decoder, type};
+}
+
+void MessageCodec::unregisterCodec(unsigned long long commandID)
+{
+	std::lock_guard<std::shared_mutex> lk(m_codecsMutex);
+	m_codecs.erase(commandID);
+}
+
+bool MessageCodec::getCodecType(unsigned long long commandID,
+								 const std::type_info *&type) const
+{
+	std::shared_lock<std::shared_mutex> lk(m_codecsMutex);
+	auto it = m_codecs.find(commandID);
+
+	if ( m_codecs.end() == it ) {
+		return false;
+	}
+	type = it->second.type;
+
+	return true;
+}
+
+bool MessageCodec::encode(const ConstData &data, std::string &out) const
+{
+	out.clear();
+	appendUint64(out, data.handle.commandID);
+	appendUint64(out, data.handle.messageParam);
+
+	std::shared_lock<std::shared_mutex> lk(m_codecsMutex);
+	auto it = m_codecs.find(data.handle.commandID);
+
+	// наследник без кодека потерял бы свои поля: не отправляем
+	if ( m_codecs.end() == it ) {
+		return typeid(data) == typeid(ConstData);
+	}
+
+	return it->second.encoder(data, out);
+}
+
+std::shared_ptr<MessageData> MessageCodec::decode(const char *data, size_t length) const
+{
+	Handle handle;
+
+	if ( ! peekHandle(data, length, handle) ) {
+		return nullptr;
+	}
+	const char *payload = data + kPrefixSize;
+	size_t payloadLength = length - kPrefixSize;
+
+	std::unique_ptr<ConstData> result;
+	{
+		std::shared_lock<std::shared_mutex> lk(m_codecsMutex);
+		auto it = m_codecs.find(handle.commandID);
+
+		if ( m_codecs.end() == it ) {
+			result = std::make_unique<ConstData>();
+		}
+		else {
+			result = it->second.decoder(payload, payloadLength);
+		}
+	}
+
+	if ( nullptr == result ) {
+		return nullptr;
+	}
+	result->handle = handle;
+
+	return std::make_shared<MessageData>(result);
+}
+
+bool MessageCodec::peekHandle(const char *data, size_t length, Handle &handle)
+{
+	if ( length < kPrefixSize ) {
+		return false;
+	}
+	handle.commandID = readUint64(data);
+	handle.messageParam = readUint64(data + 8);
+
+	return true;
+}
+
+} // namespace andre
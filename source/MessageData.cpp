@@ -8,8 +8,7 @@ ConstData::ConstData()
 	
 }
 
-ConstData::ConstData(const ConstData &data) : handle(data.handle),
-	strCommandID(data.strCommandID), strMessageParam(data.strMessageParam)
+ConstData::ConstData(const ConstData &data) : handle(data.handle)
 {
 	
 }
@@ -22,8 +21,6 @@ ConstData::~ConstData()
 ConstData &ConstData::operator=(const ConstData &data)
 {
 	handle = data.handle;
-	strCommandID = data.strCommandID;
-	strMessageParam = data.strMessageParam;
 	return *this;
 }
 
@@ -0,0 +1,453 @@
+#include "MessageJournal.h"
+#include "AsyncOperProcessor.h"
+#include "MessageCodec.h"
+
+#include "bytering.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace andre
+{
+
+namespace
+{
+
+const char *kSegmentPrefix = "journal-";
+const char *kSegmentSuffix = ".seg";
+
+struct RecordHeader
+{
+	uint32_t length;
+	uint32_t checksum;
+	uint64_t timestamp;
+};
+
+size_t alignRecord(size_t size)
+{
+	return (size + 7) / 8 * 8;
+}
+
+uint32_t checksum(uint64_t timestamp, const char *data, size_t length)
+{
+	uint32_t hash = 2166136261u;
+	const unsigned char *bytes = reinterpret_cast<const unsigned char *>(&timestamp);
+
+	for ( size_t i = 0; i < sizeof(timestamp); ++i ) {
+		hash = (hash ^ bytes[i]) * 16777619u;
+	}
+
+	for ( size_t i = 0; i < length; ++i ) {
+		hash = (hash ^ static_cast<unsigned char>(data[i])) * 16777619u;
+	}
+
+	return hash;
+}
+
+uint64_t wallClockNow()
+{
+	return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+} // namespace
+
+MessageJournal::MessageJournal(const MessageJournalConfig &config)
+	: m_config(config), m_running(false), m_ring(nullptr),
+	  m_segmentFd(-1), m_segment(nullptr), m_segmentPos(0), m_syncedPos(0),
+	  m_segmentIndex(0), m_appended(0), m_dropped(0), m_written(0), m_commits(0)
+{
+}
+
+MessageJournal::~MessageJournal()
+{
+	stop();
+}
+
+bool MessageJournal::addHandle(const Handle &handle)
+{
+	if ( m_running ) {
+		return false;
+	}
+	m_handles.insert(handle);
+
+	return true;
+}
+
+bool MessageJournal::addHandleRange(const HandleRange &range)
+{
+	if ( m_running ) {
+		return false;
+	}
+	m_ranges.push_back(range);
+
+	return true;
+}
+
+bool MessageJournal::start()
+{
+	if ( m_running ) {
+		return true;
+	}
+	std::error_code error;
+	std::filesystem::create_directories(m_config.directory, error);
+
+	if ( error ) {
+		return false;
+	}
+
+	unsigned int lastIndex = 0;
+
+	for ( const std::string &name : listSegments() ) {
+		unsigned int index = 0;
+
+		if ( 1 == std::sscanf(name.c_str() + std::strlen(kSegmentPrefix), "%u", &index) ) {
+			lastIndex = std::max(lastIndex, index);
+		}
+	}
+
+	if ( ! openSegment(lastIndex + 1) ) {
+		return false;
+	}
+
+	size_t ringSize = multithread::ByteRing::memorySize(m_config.ringSlots,
+														m_config.slotSize);
+	// с запасом под выравнивание по кэш-линии
+	m_ringMemory.reset(new uint64_t[ringSize / sizeof(uint64_t) + 16]);
+	uintptr_t aligned = (reinterpret_cast<uintptr_t>(m_ringMemory.get()) + 63) & ~uintptr_t(63);
+	m_ring = multithread::ByteRing::create(reinterpret_cast<void *>(aligned),
+										   m_config.ringSlots, m_config.slotSize);
+
+	if ( nullptr == m_ring ) {
+		closeSegment();
+		m_ringMemory.reset();
+		return false;
+	}
+
+	m_running = true;
+	m_writerThread = std::thread(&MessageJournal::writerLoop, this);
+	AsyncOperProcessor::instance().setJournal(this);
+
+	return true;
+}
+
+void MessageJournal::stop()
+{
+	if ( ! m_running ) {
+		return;
+	}
+	// после возврата setJournal новых append() не будет
+	AsyncOperProcessor::instance().setJournal(nullptr);
+
+	m_running = false;
+	m_writerThread.join();
+
+	closeSegment();
+	m_ring = nullptr;
+	m_ringMemory.reset();
+}
+
+bool MessageJournal::isSelected(const Handle &handle) const
+{
+	if ( m_handles.find(handle) != m_handles.end() ) {
+		return true;
+	}
+
+	for ( const HandleRange &range : m_ranges ) {
+		if ( range.contains(handle) ) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool MessageJournal::append(const std::shared_ptr<MessageData> &msg)
+{
+	if ( getOriginTag() == msg->getOrigin() || ! isSelected(msg->getData()->handle) ) {
+		return false;
+	}
+	thread_local std::string buffer;
+
+	if ( ! MessageCodec::instance().encode(*msg->getData(), buffer) ) {
+		++ m_dropped;
+		return false;
+	}
+	uint64_t timestamp = wallClockNow();
+
+	if ( ! m_ring->tryPush(&timestamp, sizeof(timestamp), buffer.data(), buffer.size()) ) {
+		++ m_dropped;
+		return false;
+	}
+	++ m_appended;
+
+	return true;
+}
+
+size_t MessageJournal::replay(JournalReplayMode mode, double speed)
+{
+	size_t posted = 0;
+	uint64_t firstTimestamp = 0;
+	auto replayStart = std::chrono::steady_clock::now();
+
+	for ( const std::string &name : listSegments() ) {
+		std::string path = m_config.directory + "/" + name;
+
+		// текущий сегмент ещё пишется
+		if ( m_running && path == segmentPath(m_segmentIndex) ) {
+			continue;
+		}
+		int fd = open(path.c_str(), O_RDONLY);
+
+		if ( -1 == fd ) {
+			continue;
+		}
+		struct stat st;
+
+		if ( 0 != fstat(fd, &st) || 0 == st.st_size ) {
+			close(fd);
+			continue;
+		}
+		size_t size = size_t(st.st_size);
+		void *memory = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+
+		if ( MAP_FAILED == memory ) {
+			continue;
+		}
+		const char *segment = static_cast<const char *>(memory);
+		size_t pos = 0;
+
+		while ( pos + sizeof(RecordHeader) <= size ) {
+			RecordHeader header;
+			std::memcpy(&header, segment + pos, sizeof(header));
+
+			if ( 0 == header.length ||
+				 pos + sizeof(RecordHeader) + header.length > size ) {
+				break;
+			}
+			const char *body = segment + pos + sizeof(RecordHeader);
+
+			// оборванная запись
+			if ( header.checksum != checksum(header.timestamp, body, header.length) ) {
+				break;
+			}
+			pos += alignRecord(sizeof(RecordHeader) + header.length);
+
+			std::shared_ptr<MessageData> msg =
+					MessageCodec::instance().decode(body, header.length);
+
+			if ( nullptr == msg ) {
+				continue;
+			}
+
+			if ( JournalReplayMode::RecordedTiming == mode && speed > 0 ) {
+				if ( 0 == firstTimestamp ) {
+					firstTimestamp = header.timestamp;
+				}
+				uint64_t offset = header.timestamp > firstTimestamp ?
+								  header.timestamp - firstTimestamp : 0;
+				std::this_thread::sleep_until(replayStart +
+					std::chrono::nanoseconds(uint64_t(double(offset) / speed)));
+			}
+
+			msg->setOrigin(getOriginTag());
+			AsyncOperProcessor::instance().postMessage(msg);
+			++ posted;
+		}
+		munmap(memory, size);
+	}
+
+	return posted;
+}
+
+void MessageJournal::writerLoop()
+{
+	m_lastSync = std::chrono::steady_clock::now();
+
+	for (;;) {
+		// m_running читается до опустошения кольца: после остановки
+		// производителей кольцо дочитывается до конца
+		bool running = m_running;
+		size_t batch = 0;
+
+		while ( batch < m_config.maxBatch &&
+				m_ring->tryConsume([this](const char *data, size_t length) {
+					writeRecord(data, length);
+				}) ) {
+			++ batch;
+		}
+
+		if ( 0 != batch ) {
+			commit(false);
+			continue;
+		}
+
+		if ( ! running ) {
+			break;
+		}
+
+		if ( JournalFsync::Interval == m_config.fsyncPolicy ) {
+			commit(false);
+		}
+		std::this_thread::sleep_for(m_config.idleSleep);
+	}
+
+	commit(true);
+}
+
+bool MessageJournal::writeRecord(const char *data, size_t length)
+{
+	if ( length < sizeof(uint64_t) ) {
+		++ m_dropped;
+		return false;
+	}
+	RecordHeader header;
+	std::memcpy(&header.timestamp, data, sizeof(header.timestamp));
+	const char *body = data + sizeof(uint64_t);
+	header.length = uint32_t(length - sizeof(uint64_t));
+	header.checksum = checksum(header.timestamp, body, header.length);
+
+	size_t recordSize = alignRecord(sizeof(RecordHeader) + header.length);
+
+	if ( recordSize + sizeof(RecordHeader) > m_config.segmentSize ) {
+		++ m_dropped;
+		return false;
+	}
+
+	// остаток сегмента заполнен нулями - это и есть признак конца
+	if ( m_segmentPos + recordSize + sizeof(RecordHeader) > m_config.segmentSize ) {
+		commit(true);
+		closeSegment();
+
+		if ( ! openSegment(m_segmentIndex + 1) ) {
+			++ m_dropped;
+			return false;
+		}
+	}
+
+	char *dst = m_segment + m_segmentPos;
+	std::memcpy(dst + sizeof(RecordHeader), body, header.length);
+	std::memcpy(dst, &header, sizeof(header));
+	m_segmentPos += recordSize;
+	++ m_written;
+
+	return true;
+}
+
+void MessageJournal::commit(bool force)
+{
+	if ( nullptr == m_segment || m_syncedPos == m_segmentPos ) {
+		return;
+	}
+	auto now = std::chrono::steady_clock::now();
+	bool sync = force;
+
+	switch ( m_config.fsyncPolicy ) {
+	case JournalFsync::Never:
+		break;
+	case JournalFsync::EveryCommit:
+		sync = true;
+		break;
+	case JournalFsync::Interval:
+		sync = sync || ( now - m_lastSync >= m_config.fsyncInterval );
+		break;
+	}
+
+	if ( ! sync ) {
+		return;
+	}
+	size_t pageSize = size_t(sysconf(_SC_PAGESIZE));
+	size_t from = m_syncedPos / pageSize * pageSize;
+
+	msync(m_segment + from, m_segmentPos - from, MS_SYNC);
+	m_syncedPos = m_segmentPos;
+	m_lastSync = now;
+	++ m_commits;
+}
+
+bool MessageJournal::openSegment(unsigned int index)
+{
+	std::string path = segmentPath(index);
+	int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+	if ( -1 == fd ) {
+		return false;
+	}
+
+	if ( 0 != ftruncate(fd, off_t(m_config.segmentSize)) ) {
+		close(fd);
+		return false;
+	}
+	void *memory = mmap(nullptr, m_config.segmentSize, PROT_READ | PROT_WRITE,
+						MAP_SHARED, fd, 0);
+
+	if ( MAP_FAILED == memory ) {
+		close(fd);
+		return false;
+	}
+
+	m_segmentFd = fd;
+	m_segment = static_cast<char *>(memory);
+	m_segmentPos = 0;
+	m_syncedPos = 0;
+	m_segmentIndex = index;
+
+	return true;
+}
+
+void MessageJournal::closeSegment()
+{
+	if ( nullptr == m_segment ) {
+		return;
+	}
+	munmap(m_segment, m_config.segmentSize);
+
+	// обрезаем незаполненный хвост, оставляя место под признак конца
+	if ( 0 != ftruncate(m_segmentFd, off_t(m_segmentPos + sizeof(RecordHeader))) ) {
+		// сегмент останется полного размера, это не мешает чтению
+	}
+	close(m_segmentFd);
+
+	m_segment = nullptr;
+	m_segmentFd = -1;
+}
+
+std::vector<std::string> MessageJournal::listSegments() const
+{
+	std::vector<std::string> result;
+	std::error_code error;
+
+	for ( const auto &entry :
+		  std::filesystem::directory_iterator(m_config.directory, error) ) {
+		std::string name = entry.path().filename().string();
+
+		if ( 0 == name.compare(0, std::strlen(kSegmentPrefix), kSegmentPrefix) &&
+			 name.size() > std::strlen(kSegmentSuffix) &&
+			 0 == name.compare(name.size() - std::strlen(kSegmentSuffix),
+							   std::string::npos, kSegmentSuffix) ) {
+			result.push_back(name);
+		}
+	}
+	// номера с ведущими нулями - лексикографический порядок совпадает с порядком записи
+	std::sort(result.begin(), result.end());
+
+	return result;
+}
+
+std::string MessageJournal::segmentPath(unsigned int index) const
+{
+	char name[64];
+	std::snprintf(name, sizeof(name), "%s%010u%s", kSegmentPrefix, index, kSegmentSuffix);
+
+	return m_config.directory + "/" + name;
+}
+
+} // namespace andre
@@ -0,0 +1,131 @@
+#include "NameRegistry.h"
+
+#include <mutex>
+
+namespace andre
+{
+
+unsigned long long NameRegistry::hashOf(std::string_view name)
+{
+	// FNV-1a: не зависит от реализации std::hash
+	uint64_t hash = 14695981039346656037ULL;
+
+	for ( char c : name ) {
+		hash ^= static_cast<unsigned char>(c);
+		hash *= 1099511628211ULL;
+	}
+
+	// перемешивание: у FNV-1a коротких строк плохо распределены старшие биты
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+
+	return hash | kNameBit;
+}
+
+unsigned long long NameRegistry::intern(std::string_view name)
+{
+	unsigned long long id;
+
+	if ( find(name, id) ) {
+		return id;
+	}
+	std::lock_guard<std::shared_mutex> lk(m_mutex);
+	auto it = m_ids.find(std::string(name));
+
+	if ( m_ids.end() != it ) {
+		return it->second;
+	}
+
+	// коллизия: идентификатор занят другим именем
+	for ( id = hashOf(name); nullptr != unlockedNameOf(id); id = (id + 1) | kNameBit ) {
+	}
+	unlockedAdd(name, id);
+
+	return id;
+}
+
+bool NameRegistry::bind(std::string_view name, unsigned long long id)
+{
+	if ( kInvalidID == id ) {
+		return false;
+	}
+	std::lock_guard<std::shared_mutex> lk(m_mutex);
+	auto it = m_ids.find(std::string(name));
+
+	if ( m_ids.end() != it ) {
+		return it->second == id;
+	}
+
+	if ( nullptr != unlockedNameOf(id) ) {
+		return false;
+	}
+	unlockedAdd(name, id);
+
+	return true;
+}
+
+bool NameRegistry::find(std::string_view name, unsigned long long &id) const
+{
+	std::shared_lock<std::shared_mutex> lk(m_mutex);
+	auto it = m_ids.find(std::string(name));
+
+	if ( m_ids.end() == it ) {
+		return false;
+	}
+	id = it->second;
+
+	return true;
+}
+
+bool NameRegistry::nameOf(unsigned long long id, std::string &name) const
+{
+	std::shared_lock<std::shared_mutex> lk(m_mutex);
+	const std::string *found = unlockedNameOf(id);
+
+	if ( nullptr == found ) {
+		return false;
+	}
+	name = *found;
+
+	return true;
+}
+
+std::string NameRegistry::toString(const Handle &handle) const
+{
+	std::string command;
+	std::string param;
+
+	if ( ! nameOf(handle.commandID, command) ) {
+		command = std::to_string(handle.commandID);
+	}
+
+	if ( ! nameOf(handle.messageParam, param) ) {
+		param = std::to_string(handle.messageParam);
+	}
+
+	return command + "/" + param;
+}
+
+size_t NameRegistry::size() const
+{
+	std::shared_lock<std::shared_mutex> lk(m_mutex);
+	return m_ids.size();
+}
+
+const std::string *NameRegistry::unlockedNameOf(unsigned long long id) const
+{
+	auto it = m_names.find(id);
+
+	return m_names.end() == it ? nullptr : it->second;
+}
+
+void NameRegistry::unlockedAdd(std::string_view name, unsigned long long id)
+{
+	m_storage.emplace_back(name);
+	const std::string *stored = &m_storage.back();
+	m_ids.emplace(*stored, id);
+	m_names.emplace(id, stored);
+}
+
+} // namespace andre
@@ -1,12 +1,23 @@
+#include <chrono>
 #include <thread>
 
 #include "Reactor.h"
 #include "AsyncOperProcessor.h"
+#include "BlockingExecutor.h"
 
 namespace andre
 {
 
-Reactor::Reactor() : m_exit(false)
+std::atomic<bool> Reactor::s_measureBusyTime(false);
+
+Reactor::Reactor()
+	: m_exit(false),
+	  m_numaNode(multithread::Topology::instance().nodeOfCpus(multithread::CpuSet::current())),
+	  m_affinityNode(-1),
+	  m_events(multithread::NodeAllocator<ReactorEvent>(m_numaNode)),
+	  m_busyNs(0), m_handledCount(0),
+	  m_draining(false), m_drainClaimed(false), m_drainDone(false),
+	  m_drainProcessed(0), m_drainDiscarded(0), m_attached(false)
 {
 	m_events.setMaxSize(maxQueueSize);
 }
@@ -23,7 +34,7 @@ void Reactor::handleEvents()
 		m_events.waitAndPop(re);
 		
 		if (!m_exit) { 
-			handleEvent(re.handler,re.message);
+			dispatchEvent(re);
 		}
 	}
 }
@@ -45,12 +56,31 @@ std::shared_ptr<MessageData> Reactor::waitInLoop(EventHandler *handler,
 		m_events.waitAndPop(re);
 		
 		if (!m_exit) {
+			if ( ReactorEventKind::Conflated == re.kind && ! takeConflated(re) ) {
+				continue;
+			}
+			
+			// реактор останавливается - ожидание прерывается
+			if ( ReactorEventKind::Drain == re.kind ) {
+				m_events.push(re);
+				return nullptr;
+			}
+			
+			// служебные события обрабатываются основным циклом, по порядку
+			if ( ReactorEventKind::Message != re.kind ) {
+				m_events.push(re);
+				std::this_thread::yield();
+				continue;
+			}
 			const auto &searchingHandle = re.message->getData()->handle;
 			const auto &deregistrationHandle = handler->getDeregisterHandleNonConst();
 
 			if (re.handler == handler) {
 
 				if ( searchingHandle == handle ) {
+					if ( dropIfExpired(re) ) {
+						continue;
+					}
 					return re.message; 
 				}
 
@@ -85,7 +115,215 @@ std::shared_ptr<MessageData> Reactor::waitInLoop(EventHandler *handler,
 bool Reactor::addEvent(EventHandler *handler, const std::shared_ptr<MessageData> &message)
 {
 	ReactorEvent re = {handler, message};
-	return m_events.push(re);
+	
+	return addEvent(re);
+}
+
+bool Reactor::addEvent(EventHandler *handler, const std::shared_ptr<MessageData> &message,
+					   MailboxState *mailbox)
+{
+	ReactorEvent re = {handler, message};
+	
+	if ( nullptr == mailbox ) {
+		return addEvent(re);
+	}
+	const MailboxPolicy &policy = mailbox->getPolicy();
+	re.mailbox = mailbox;
+	
+	if ( policy.ttl.count() > 0 ) {
+		re.deadline = std::chrono::steady_clock::now() + policy.ttl;
+	}
+	
+	if (policy.conflate) {
+		return addConflated(re);
+	}
+	
+	return addEvent(re);
+}
+
+bool Reactor::addEvent(const ReactorEvent &event)
+{
+	bool pushed;
+	
+	if ( nullptr != event.mailbox && event.mailbox->getPolicy().dropOldest ) {
+		ReactorEvent evicted;
+		bool isEvicted;
+		
+		// вытесняются только такие же сообщения: служебные события и
+		// сообщения без политики (маркеры дерегистрации и т.п.) не теряются
+		pushed = m_events.pushEvictFront(event,
+			[](const ReactorEvent &head) {
+				return ReactorEventKind::Message == head.kind && nullptr != head.mailbox &&
+					   head.mailbox->getPolicy().dropOldest;
+			}, evicted, isEvicted);
+		
+		if (isEvicted) {
+			evicted.mailbox->onEvicted();
+		}
+	}
+	else {
+		pushed = m_events.push(event);
+	}
+	
+	if ( ! pushed ) {
+		return false;
+	}
+	wakeUp();
+	
+	return true;
+}
+
+bool Reactor::addConflated(const ReactorEvent &event)
+{
+	ConflationKey key = {event.handler, event.message->getData()->handle};
+	std::lock_guard<std::mutex> guard(m_conflationMutex);
+	auto it = m_conflated.find(key);
+	
+	// место в очереди уже есть - заменяем ждущее сообщение
+	if ( m_conflated.end() != it ) {
+		it->second.message = event.message;
+		it->second.deadline = event.deadline;
+		event.mailbox->onConflated();
+		return true;
+	}
+	m_conflated.emplace(key, ConflatedMessage{event.message, event.deadline});
+	
+	ReactorEvent slot = event;
+	slot.kind = ReactorEventKind::Conflated;
+	
+	if ( ! addEvent(slot) ) {
+		m_conflated.erase(key);
+		return false;
+	}
+	
+	return true;
+}
+
+bool Reactor::takeConflated(ReactorEvent &event)
+{
+	// сообщение Conflated-события - первое из заменённых, по нему находится ключ
+	ConflationKey key = {event.handler, event.message->getData()->handle};
+	std::lock_guard<std::mutex> guard(m_conflationMutex);
+	auto it = m_conflated.find(key);
+	
+	if ( m_conflated.end() == it ) {
+		return false;
+	}
+	event.message = std::move(it->second.message);
+	event.deadline = it->second.deadline;
+	event.kind = ReactorEventKind::Message;
+	m_conflated.erase(it);
+	
+	return true;
+}
+
+bool Reactor::dropIfExpired(const ReactorEvent &event)
+{
+	if ( nullptr == event.mailbox ||
+		 std::chrono::steady_clock::time_point() == event.deadline ||
+		 std::chrono::steady_clock::now() <= event.deadline ) {
+		return false;
+	}
+	event.mailbox->onExpired();
+	
+	return true;
+}
+
+void Reactor::setMeasureBusyTime(bool measure)
+{
+	s_measureBusyTime = measure;
+}
+
+void Reactor::dispatchEvent(ReactorEvent &event)
+{
+	if ( m_draining.load(std::memory_order_acquire) && ! drainStep(event) ) {
+		return;
+	}
+	
+	switch ( event.kind ) {
+	case ReactorEventKind::Conflated:
+		if ( ! takeConflated(event) ) {
+			return;
+		}
+		[[fallthrough]];
+		
+	case ReactorEventKind::Message:
+		// обработчик переносится сюда, а прежний реактор ещё не закончил с ним
+		if ( event.handler->m_migrationTarget.load(std::memory_order_acquire) == this ) {
+			m_held[event.handler].push_back(std::move(event));
+			return;
+		}
+		deliver(event);
+		return;
+		
+	case ReactorEventKind::Handoff:
+		// все сообщения обработчика, пришедшие сюда до переноса, обработаны
+		AsyncOperProcessor::instance().resumeMigrated(event.targetReactor, event.handler);
+		return;
+		
+	case ReactorEventKind::Resume:
+		resumeHeld(event.handler);
+		return;
+		
+	case ReactorEventKind::Drain:
+		return;
+	}
+}
+
+void Reactor::deliver(ReactorEvent &event)
+{
+	if ( dropIfExpired(event) ) {
+		return;
+	}
+	
+	if ( m_draining.load(std::memory_order_relaxed) ) {
+		++ m_drainProcessed;
+	}
+
+	if ( event.handler->m_blocking.load(std::memory_order_relaxed) ) {
+		BlockingExecutor::instance().submit(event.handler, event.message);
+		return;
+	}
+	invokeHandler(event.handler, event.message);
+}
+
+void Reactor::invokeHandler(EventHandler *handler, const std::shared_ptr<MessageData> &msg)
+{
+	if ( ! s_measureBusyTime.load(std::memory_order_relaxed) ) {
+		handleEvent(handler, msg);
+		return;
+	}
+	auto start = std::chrono::steady_clock::now();
+	handleEvent(handler, msg);
+	unsigned long long elapsed = static_cast<unsigned long long>(
+			std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - start).count());
+	
+	handler->m_busyNs.fetch_add(elapsed, std::memory_order_relaxed);
+	handler->m_handledCount.fetch_add(1, std::memory_order_relaxed);
+	m_busyNs.fetch_add(elapsed, std::memory_order_relaxed);
+	m_handledCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Reactor::resumeHeld(EventHandler *handler)
+{
+	handler->m_migrationTarget.store(nullptr, std::memory_order_release);
+	
+	auto it = m_held.find(handler);
+	
+	if ( m_held.end() == it ) {
+		return;
+	}
+	std::deque<ReactorEvent> held;
+	held.swap(it->second);
+	m_held.erase(it);
+	
+	for ( ReactorEvent &event : held ) {
+		if (m_exit) {
+			return;
+		}
+		deliver(event);
+	}
 }
 
 void Reactor::exit()
@@ -93,4 +331,170 @@ void Reactor::exit()
 	m_exit = true;
 }
 
+bool Reactor::beginDrain(std::chrono::steady_clock::time_point deadline)
+{
+	if (m_draining) {
+		return false;
+	}
+	m_drainDeadline = deadline;
+	m_draining.store(true, std::memory_order_release);
+	
+	// конец очереди реактора без потока находит runDrain
+	if (m_attached) {
+		return true;
+	}
+	
+	// пока очередь полна, места для метки конца нет - ждём, пока реактор её разберёт
+	ReactorEvent drain = {nullptr, nullptr, ReactorEventKind::Drain};
+	
+	while ( ! addEvent(drain) ) {
+		if ( m_exit || std::chrono::steady_clock::now() > deadline ) {
+			return false;
+		}
+		std::this_thread::yield();
+	}
+	
+	return true;
+}
+
+void Reactor::abortDrain()
+{
+	if ( ! claimDrain() ) {
+		// поток реактора сам дописывает счётчики
+		while ( ! m_drainDone ) {
+			std::this_thread::yield();
+		}
+		return;
+	}
+	exit();
+	m_drainDiscarded += discardPending();
+	
+	// у реактора без потока m_held никто больше не трогает
+	if (m_attached) {
+		m_drainDiscarded += discardHeld();
+	}
+	m_drainDone = true;
+	
+	// будим поток, ждущий на пустой очереди
+	ReactorEvent drain = {nullptr, nullptr, ReactorEventKind::Drain};
+	addEvent(drain);
+}
+
+bool Reactor::drainStep(ReactorEvent &event)
+{
+	if ( ReactorEventKind::Drain == event.kind ) {
+		if ( claimDrain() ) {
+			// переносимые сюда обработчики так и не получили Resume
+			m_drainDiscarded += discardHeld();
+			finishDrain();
+		}
+		return false;
+	}
+	
+	if ( std::chrono::steady_clock::now() > m_drainDeadline ) {
+		if ( ! claimDrain() ) {
+			return false;
+		}
+		m_drainDiscarded += ( carriesMessage(event) ? 1 : 0 ) + discardPending() +
+							discardHeld();
+		finishDrain();
+		return false;
+	}
+	
+	return true;
+}
+
+bool Reactor::carriesMessage(const ReactorEvent &event)
+{
+	switch ( event.kind ) {
+	case ReactorEventKind::Message:
+		return true;
+	
+	// место в очереди, сообщение могло уже уйти в waitInLoop
+	case ReactorEventKind::Conflated: {
+		ConflationKey key = {event.handler, event.message->getData()->handle};
+		std::lock_guard<std::mutex> guard(m_conflationMutex);
+		
+		return 0 != m_conflated.count(key);
+	}
+	
+	default:
+		return false;
+	}
+}
+
+bool Reactor::claimDrain()
+{
+	return ! m_drainClaimed.exchange(true);
+}
+
+void Reactor::finishDrain()
+{
+	m_drainDone = true;
+	
+	// маршруты реактора без потока убирает detachReactor
+	if (m_attached) {
+		exit();
+		return;
+	}
+	
+	// вызывается в потоке реактора: убираем его маршруты и выходим из цикла
+	AsyncOperProcessor::instance().shutdownReactorDispatcher();
+}
+
+void Reactor::runDrain()
+{
+	ReactorEvent re;
+	
+	while ( ! m_drainDone && m_events.tryAndPop(re) ) {
+		dispatchEvent(re);
+	}
+	
+	if ( claimDrain() ) {
+		m_drainDiscarded += discardHeld();
+		finishDrain();
+	}
+}
+
+unsigned long long Reactor::discardPending()
+{
+	std::vector<ReactorEvent> pending;
+	m_events.drainAll(pending);
+	unsigned long long discarded = 0;
+	
+	for ( const ReactorEvent &event : pending ) {
+		if ( carriesMessage(event) ) {
+			++ discarded;
+		}
+	}
+	
+	return discarded;
+}
+
+unsigned long long Reactor::discardHeld()
+{
+	unsigned long long discarded = 0;
+	
+	for ( const auto &handler_Events : m_held ) {
+		for ( const ReactorEvent &event : handler_Events.second ) {
+			if ( carriesMessage(event) ) {
+				++ discarded;
+			}
+		}
+	}
+	m_held.clear();
+	
+	return discarded;
+}
+
+bool Reactor::setAffinity(const multithread::CpuSet &cpus)
+{
+	if ( ! multithread::pinCurrentThread(cpus) ) {
+		return false;
+	}
+	m_affinityNode = multithread::Topology::instance().nodeOfCpus(cpus);
+	
+	return true;
+}
+
 } // namespace andre
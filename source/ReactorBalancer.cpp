@@ -0,0 +1,207 @@
+#include "ReactorBalancer.h"
+
+#include <algorithm>
+#include <typeindex>
+
+namespace andre
+{
+
+ReactorBalancer::ReactorBalancer(const ReactorBalancerConfig &config)
+	: m_config(config), m_running(false), m_tick(0), m_migrations(0)
+{
+}
+
+ReactorBalancer::~ReactorBalancer()
+{
+	stop();
+}
+
+bool ReactorBalancer::migrate(EventHandler *handler, size_t toReactorID)
+{
+	if ( ! AsyncOperProcessor::instance().migrateHandler(handler, toReactorID) ) {
+		return false;
+	}
+	++ m_migrations;
+
+	return true;
+}
+
+bool ReactorBalancer::start()
+{
+	if ( m_running ) {
+		return true;
+	}
+	Reactor::setMeasureBusyTime(true);
+	m_running = true;
+	m_thread = std::thread(&ReactorBalancer::threadLoop, this);
+
+	return true;
+}
+
+void ReactorBalancer::stop()
+{
+	if ( ! m_running ) {
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lk(m_mutex);
+		m_running = false;
+	}
+	m_condition.notify_all();
+	m_thread.join();
+	Reactor::setMeasureBusyTime(false);
+}
+
+void ReactorBalancer::threadLoop()
+{
+	std::unique_lock<std::mutex> lk(m_mutex);
+
+	while (m_running) {
+		m_condition.wait_for(lk, m_config.interval, [this]{ return ! m_running; });
+
+		if (m_running) {
+			lk.unlock();
+			rebalance();
+			lk.lock();
+		}
+	}
+}
+
+size_t ReactorBalancer::rebalance()
+{
+	++ m_tick;
+	std::vector<ReactorLoad> loads = AsyncOperProcessor::instance().getReactorLoads();
+
+	// прирост счётчиков с прошлого шага
+	std::map<size_t, unsigned long long> reactorBusy;
+	std::map<EventHandler *, unsigned long long> handlerBusy;
+	std::map<EventHandler *, unsigned long long> handlerCount;
+	m_reactorDelta.clear();
+	m_busyDelta.clear();
+	m_countDelta.clear();
+
+	for ( const ReactorLoad &load : loads ) {
+		reactorBusy[load.reactorID] = load.busyNs;
+		m_reactorDelta[load.reactorID] = load.busyNs - std::min(load.busyNs,
+				m_lastReactorBusy.count(load.reactorID) ? m_lastReactorBusy[load.reactorID] : 0);
+
+		for ( const HandlerLoad &handler : load.handlers ) {
+			auto itBusy = m_lastHandlerBusy.find(handler.handler);
+			auto itCount = m_lastHandlerCount.find(handler.handler);
+			unsigned long long lastBusy = m_lastHandlerBusy.end() == itBusy ? 0 : itBusy->second;
+			unsigned long long lastCount = m_lastHandlerCount.end() == itCount ? 0 : itCount->second;
+
+			handlerBusy[handler.handler] = handler.busyNs;
+			handlerCount[handler.handler] = handler.handledCount;
+			m_busyDelta[handler.handler] = handler.busyNs - std::min(handler.busyNs, lastBusy);
+			m_countDelta[handler.handler] = handler.handledCount -
+										  std::min(handler.handledCount, lastCount);
+		}
+	}
+	m_lastReactorBusy.swap(reactorBusy);
+	m_lastHandlerBusy.swap(handlerBusy);
+	m_lastHandlerCount.swap(handlerCount);
+
+	for ( auto it = m_cooldown.begin(); it != m_cooldown.end(); ) {
+		if ( it->second <= m_tick ) {
+			it = m_cooldown.erase(it);
+		}
+		else {
+			++ it;
+		}
+	}
+
+	// переносы - только между реакторами одного типа
+	std::map<std::type_index, std::vector<const ReactorLoad *> > groups;
+
+	for ( const ReactorLoad &load : loads ) {
+		groups[std::type_index(*load.type)].push_back(&load);
+	}
+
+	size_t migrated = 0;
+
+	for ( auto &type_Group : groups ) {
+		if ( type_Group.second.size() >= 2 && rebalanceGroup(type_Group.second) ) {
+			++ migrated;
+		}
+	}
+
+	return migrated;
+}
+
+bool ReactorBalancer::rebalanceGroup(const std::vector<const ReactorLoad *> &group)
+{
+	auto score = [this](const ReactorLoad *load) {
+		return std::make_pair(load->queueSize, m_reactorDelta[load->reactorID]);
+	};
+	const ReactorLoad *hot = group.front();
+	const ReactorLoad *cold = group.front();
+
+	for ( const ReactorLoad *load : group ) {
+		if ( score(load) > score(hot) ) {
+			hot = load;
+		}
+
+		if ( score(load) < score(cold) ) {
+			cold = load;
+		}
+	}
+
+	// единственный обработчик реактора переносить бесполезно - перекос переедет с ним;
+	// служебные (не переносимые) обработчики не в счёт
+	size_t migratable = 0;
+
+	for ( const HandlerLoad &handler : hot->handlers ) {
+		migratable += handler.handler->isMigratable() ? 1 : 0;
+	}
+
+	if ( hot == cold || migratable < 2 ) {
+		return false;
+	}
+	unsigned long long hotBusy = m_reactorDelta[hot->reactorID];
+	unsigned long long coldBusy = m_reactorDelta[cold->reactorID];
+	const double intervalNs = double(std::chrono::duration_cast<std::chrono::nanoseconds>(
+										 m_config.interval).count());
+
+	bool queueSkew = hot->queueSize >= m_config.minQueueDepth &&
+					 double(hot->queueSize) > m_config.queueRatio * double(cold->queueSize + 1);
+	bool busySkew = hotBusy > coldBusy &&
+					double(hotBusy - coldBusy) > m_config.busyImbalance * intervalNs;
+
+	if ( ! queueSkew && ! busySkew ) {
+		return false;
+	}
+	unsigned long long gap = hotBusy > coldBusy ? hotBusy - coldBusy : 0;
+
+	// самый занятый обработчик, перенос которого не перевернёт перекос;
+	// без замеров времени - самый нагруженный по количеству сообщений
+	EventHandler *candidate = nullptr;
+	std::pair<unsigned long long, unsigned long long> best(0, 0);
+
+	for ( const HandlerLoad &handler : hot->handlers ) {
+		if ( ! handler.handler->isMigratable() || m_cooldown.count(handler.handler) ) {
+			continue;
+		}
+		unsigned long long busy = m_busyDelta[handler.handler];
+
+		if ( 0 != gap && busy * 2 > gap ) {
+			continue;
+		}
+		std::pair<unsigned long long, unsigned long long> key(busy,
+				m_countDelta[handler.handler]);
+
+		if ( nullptr == candidate || key > best ) {
+			candidate = handler.handler;
+			best = key;
+		}
+	}
+
+	if ( nullptr == candidate || ! migrate(candidate, cold->reactorID) ) {
+		return false;
+	}
+	m_cooldown[candidate] = m_tick + m_config.cooldownIntervals;
+
+	return true;
+}
+
+} // namespace andre
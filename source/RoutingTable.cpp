@@ -0,0 +1,419 @@
+#include "RoutingTable.h"
+
+#include <algorithm>
+#include <functional>
+
+namespace andre
+{
+
+void RoutingBatch::reserve(size_t exactCount, size_t rangeCount)
+{
+	m_exact.reserve(exactCount);
+	m_ranges.reserve(rangeCount);
+}
+
+void RoutingBatch::add(const Handle &handle, size_t reactorID, EventHandler *handler)
+{
+	m_exact.push_back({handle, reactorID, handler});
+}
+
+void RoutingBatch::add(const HandleRange &range, size_t reactorID, EventHandler *handler)
+{
+	m_ranges.push_back({range.commandID,
+						{range.paramFrom, range.paramTo, reactorID, handler}});
+}
+
+void RoutingBatch::prepare()
+{
+	std::sort(m_exact.begin(), m_exact.end(),
+		[](const ExactEntry &left, const ExactEntry &right) {
+			if ( left.handle != right.handle ) {
+				return left.handle < right.handle;
+			}
+			if ( left.reactorID != right.reactorID ) {
+				return left.reactorID < right.reactorID;
+			}
+			return std::less<EventHandler *>()(left.handler, right.handler);
+		});
+
+	std::stable_sort(m_ranges.begin(), m_ranges.end(),
+		[](const RangeEntry &left, const RangeEntry &right) {
+			return left.commandID < right.commandID;
+		});
+}
+
+void RoutingTable::add(const Handle &handle, size_t reactorID, EventHandler *handler)
+{
+	m_commands[handle.commandID].exact[handle.messageParam][reactorID].insert(handler);
+}
+
+void RoutingTable::add(const HandleRange &range, size_t reactorID, EventHandler *handler)
+{
+	std::vector<RangeSubscription> &ranges = m_commands[range.commandID].ranges;
+
+	for ( const RangeSubscription &sub : ranges ) {
+		if ( sub.paramFrom == range.paramFrom && sub.paramTo == range.paramTo &&
+			 sub.reactorID == reactorID && sub.handler == handler ) {
+			return;
+		}
+	}
+
+	RangeSubscription sub = {range.paramFrom, range.paramTo, reactorID, handler};
+	auto itPos = std::upper_bound(ranges.begin(), ranges.end(), sub,
+		[](const RangeSubscription &left, const RangeSubscription &right) {
+			return left.paramFrom < right.paramFrom;
+		});
+	ranges.insert(itPos, sub);
+}
+
+void RoutingTable::addBatch(const RoutingBatch &batch)
+{
+	typedef std::vector<RoutingBatch::ExactEntry>::const_iterator ExactIterator;
+	typedef std::vector<RoutingBatch::RangeEntry>::const_iterator RangeIterator;
+
+	size_t commandCount = 0;
+
+	for ( ExactIterator it = batch.m_exact.begin(); it != batch.m_exact.end(); ++ it ) {
+		if ( batch.m_exact.begin() == it || (it - 1)->handle.commandID != it->handle.commandID ) {
+			++ commandCount;
+		}
+	}
+	m_commands.reserve(m_commands.size() + commandCount + batch.m_ranges.size());
+
+	for ( ExactIterator it = batch.m_exact.begin(); it != batch.m_exact.end(); ) {
+		unsigned long long commandID = it->handle.commandID;
+		ExactIterator itEnd = it;
+		size_t paramCount = 0;
+
+		for ( ; itEnd != batch.m_exact.end() && itEnd->handle.commandID == commandID; ++ itEnd ) {
+			if ( it == itEnd || (itEnd - 1)->handle.messageParam != itEnd->handle.messageParam ) {
+				++ paramCount;
+			}
+		}
+		CommandRoute &route = m_commands[commandID];
+		route.exact.reserve(route.exact.size() + paramCount);
+
+		while ( it != itEnd ) {
+			ReactorHandlers &reactMap = route.exact[it->handle.messageParam];
+			unsigned long long messageParam = it->handle.messageParam;
+
+			// внутри параметра - по возрастанию reactorID и handler: вставка в конец
+			for ( ; it != itEnd && it->handle.messageParam == messageParam; ++ it ) {
+				std::set<EventHandler *> &handlerSet =
+						reactMap.emplace_hint(reactMap.end(), it->reactorID,
+											  std::set<EventHandler *>())->second;
+				handlerSet.insert(handlerSet.end(), it->handler);
+			}
+		}
+	}
+
+	for ( RangeIterator it = batch.m_ranges.begin(); it != batch.m_ranges.end(); ) {
+		unsigned long long commandID = it->commandID;
+		std::vector<RangeSubscription> &ranges = m_commands[commandID].ranges;
+
+		for ( ; it != batch.m_ranges.end() && it->commandID == commandID; ++ it ) {
+			ranges.push_back(it->subscription);
+		}
+
+		std::sort(ranges.begin(), ranges.end(),
+			[](const RangeSubscription &left, const RangeSubscription &right) {
+				if ( left.paramFrom != right.paramFrom ) {
+					return left.paramFrom < right.paramFrom;
+				}
+				if ( left.paramTo != right.paramTo ) {
+					return left.paramTo < right.paramTo;
+				}
+				if ( left.reactorID != right.reactorID ) {
+					return left.reactorID < right.reactorID;
+				}
+				return std::less<EventHandler *>()(left.handler, right.handler);
+			});
+		ranges.erase(std::unique(ranges.begin(), ranges.end(),
+			[](const RangeSubscription &left, const RangeSubscription &right) {
+				return left.paramFrom == right.paramFrom && left.paramTo == right.paramTo &&
+					   left.reactorID == right.reactorID && left.handler == right.handler;
+			}), ranges.end());
+	}
+}
+
+void RoutingTable::remove(const Handle &handle, EventHandler *handler)
+{
+	auto itCommand = m_commands.find(handle.commandID);
+
+	if ( m_commands.end() == itCommand ) {
+		return;
+	}
+	CommandRoute &route = itCommand->second;
+	auto itExact = route.exact.find(handle.messageParam);
+
+	if ( route.exact.end() == itExact ) {
+		return;
+	}
+	ReactorHandlers &reactMap = itExact->second;
+
+	for ( auto itReact = reactMap.begin(); itReact != reactMap.end(); ) {
+		std::set<EventHandler*> &handlerSet = itReact->second;
+
+		handlerSet.erase(handler);
+
+		if ( handlerSet.empty() ) {
+			reactMap.erase(itReact ++);
+		}
+		else {
+			++ itReact;
+		}
+	}
+
+	if ( reactMap.empty() ) {
+		route.exact.erase(itExact);
+	}
+
+	if ( route.empty() ) {
+		m_commands.erase(itCommand);
+	}
+}
+
+void RoutingTable::remove(const HandleRange &range, EventHandler *handler)
+{
+	auto itCommand = m_commands.find(range.commandID);
+
+	if ( m_commands.end() == itCommand ) {
+		return;
+	}
+	CommandRoute &route = itCommand->second;
+
+	route.ranges.erase(std::remove_if(route.ranges.begin(), route.ranges.end(),
+		[&](const RangeSubscription &sub) {
+			return sub.handler == handler && sub.paramFrom == range.paramFrom &&
+				   sub.paramTo == range.paramTo;
+		}), route.ranges.end());
+
+	if ( route.empty() ) {
+		m_commands.erase(itCommand);
+	}
+}
+
+void RoutingTable::removeHandle(const Handle &handle)
+{
+	auto itCommand = m_commands.find(handle.commandID);
+
+	if ( m_commands.end() == itCommand ) {
+		return;
+	}
+	CommandRoute &route = itCommand->second;
+	route.exact.erase(handle.messageParam);
+
+	if ( route.empty() ) {
+		m_commands.erase(itCommand);
+	}
+}
+
+void RoutingTable::removeReactor(size_t reactorID)
+{
+	for ( auto itCommand = m_commands.begin(); itCommand != m_commands.end(); ) {
+		CommandRoute &route = itCommand->second;
+
+		for ( auto itExact = route.exact.begin(); itExact != route.exact.end(); ) {
+			ReactorHandlers &reactMap = itExact->second;
+			reactMap.erase(reactorID);
+
+			if ( reactMap.empty() ) {
+				itExact = route.exact.erase(itExact);
+			}
+			else {
+				++ itExact;
+			}
+		}
+
+		route.ranges.erase(std::remove_if(route.ranges.begin(), route.ranges.end(),
+			[reactorID](const RangeSubscription &sub) {
+				return sub.reactorID == reactorID;
+			}), route.ranges.end());
+
+		if ( route.empty() ) {
+			itCommand = m_commands.erase(itCommand);
+		}
+		else {
+			++ itCommand;
+		}
+	}
+}
+
+size_t RoutingTable::moveHandler(EventHandler *handler, size_t fromReactorID,
+								 size_t toReactorID)
+{
+	size_t moved = 0;
+
+	for ( auto &command : m_commands ) {
+		CommandRoute &route = command.second;
+
+		for ( auto &param_Reactors : route.exact ) {
+			ReactorHandlers &reactMap = param_Reactors.second;
+			auto itFrom = reactMap.find(fromReactorID);
+
+			if ( reactMap.end() == itFrom || 0 == itFrom->second.erase(handler) ) {
+				continue;
+			}
+
+			if ( itFrom->second.empty() ) {
+				reactMap.erase(itFrom);
+			}
+			reactMap[toReactorID].insert(handler);
+			++ moved;
+		}
+
+		bool rangeMoved = false;
+
+		for ( RangeSubscription &sub : route.ranges ) {
+			if ( sub.handler == handler && sub.reactorID == fromReactorID ) {
+				sub.reactorID = toReactorID;
+				rangeMoved = true;
+				++ moved;
+			}
+		}
+
+		if ( ! rangeMoved ) {
+			continue;
+		}
+
+		// обработчик мог быть подписан на тот же диапазон и в toReactorID
+		std::vector<RangeSubscription> unique;
+
+		for ( const RangeSubscription &sub : route.ranges ) {
+			bool duplicate = false;
+
+			for ( const RangeSubscription &kept : unique ) {
+				if ( kept.paramFrom == sub.paramFrom && kept.paramTo == sub.paramTo &&
+					 kept.reactorID == sub.reactorID && kept.handler == sub.handler ) {
+					duplicate = true;
+					break;
+				}
+			}
+
+			if ( ! duplicate ) {
+				unique.push_back(sub);
+			}
+		}
+		route.ranges.swap(unique);
+	}
+
+	return moved;
+}
+
+std::set<size_t> RoutingTable::reactorsOf(EventHandler *handler) const
+{
+	std::set<size_t> result;
+
+	for ( const auto &command : m_commands ) {
+		for ( const auto &param_Reactors : command.second.exact ) {
+			for ( const auto &reactId_HandlerSet : param_Reactors.second ) {
+				if ( reactId_HandlerSet.second.count(handler) ) {
+					result.insert(reactId_HandlerSet.first);
+				}
+			}
+		}
+
+		for ( const RangeSubscription &sub : command.second.ranges ) {
+			if ( sub.handler == handler ) {
+				result.insert(sub.reactorID);
+			}
+		}
+	}
+
+	return result;
+}
+
+std::set<EventHandler *> RoutingTable::handlersOf(size_t reactorID) const
+{
+	std::set<EventHandler *> result;
+
+	for ( const auto &command : m_commands ) {
+		for ( const auto &param_Reactors : command.second.exact ) {
+			auto itReact = param_Reactors.second.find(reactorID);
+
+			if ( param_Reactors.second.end() != itReact ) {
+				result.insert(itReact->second.begin(), itReact->second.end());
+			}
+		}
+
+		for ( const RangeSubscription &sub : command.second.ranges ) {
+			if ( sub.reactorID == reactorID ) {
+				result.insert(sub.handler);
+			}
+		}
+	}
+
+	return result;
+}
+
+bool RoutingTable::contains(const Handle &handle, size_t reactorID,
+							EventHandler *handler) const
+{
+	auto itCommand = m_commands.find(handle.commandID);
+
+	if ( m_commands.end() == itCommand ) {
+		return false;
+	}
+	const CommandRoute &route = itCommand->second;
+	auto itExact = route.exact.find(handle.messageParam);
+
+	if ( route.exact.end() != itExact ) {
+		auto itReact = itExact->second.find(reactorID);
+
+		if ( itExact->second.end() != itReact &&
+			 itReact->second.find(handler) != itReact->second.end() ) {
+			return true;
+		}
+	}
+
+	for ( const RangeSubscription &sub : route.ranges ) {
+		if ( sub.paramFrom > handle.messageParam ) {
+			break;
+		}
+
+		if ( handle.messageParam <= sub.paramTo &&
+			 sub.reactorID == reactorID && sub.handler == handler ) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+size_t RoutingTable::size() const
+{
+	size_t result = 0;
+
+	for ( const auto &command : m_commands ) {
+		result += command.second.exact.size() + command.second.ranges.size();
+	}
+
+	return result;
+}
+
+bool RoutingTable::isDelivered(const ReactorHandlers *exactHandlers,
+							   std::vector<RangeSubscription>::const_iterator itBegin,
+							   std::vector<RangeSubscription>::const_iterator itRange,
+							   unsigned long long messageParam)
+{
+	if ( nullptr != exactHandlers ) {
+		auto itReact = exactHandlers->find(itRange->reactorID);
+
+		if ( exactHandlers->end() != itReact &&
+			 itReact->second.find(itRange->handler) != itReact->second.end() ) {
+			return true;
+		}
+	}
+
+	for ( auto itPrev = itBegin; itPrev != itRange; ++ itPrev ) {
+		if ( itPrev->handler == itRange->handler &&
+			 itPrev->reactorID == itRange->reactorID &&
+			 messageParam <= itPrev->paramTo ) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+} // namespace andre
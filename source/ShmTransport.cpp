@@ -0,0 +1,840 @@
+#include "ShmTransport.h"
+#include "AsyncOperProcessor.h"
+#include "MessageCodec.h"
+#include "NameRegistry.h"
+
+#include "bytering.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace andre
+{
+
+namespace
+{
+
+const uint64_t kRegionMagic = 0x416e64726553686dULL;
+const size_t kCacheLine = 64;
+
+enum PeerSlotState : uint32_t
+{
+	SlotFree = 0,
+	SlotClaiming = 1,
+	SlotAlive = 2
+};
+
+size_t alignUp(size_t value)
+{
+	return (value + kCacheLine - 1) / kCacheLine * kCacheLine;
+}
+
+uint64_t monotonicNow()
+{
+	return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+std::string shmName(const std::string &regionName)
+{
+	return ( !regionName.empty() && '/' == regionName[0] ) ?
+				regionName : "/" + regionName;
+}
+
+} // namespace
+
+// Заголовок разделяемой области
+struct ShmRegion
+{
+	std::atomic<uint64_t> magic;
+	uint32_t maxPeers;
+	uint32_t slotCount;
+	uint32_t slotSize;
+	uint32_t maxSubscriptions;
+	uint64_t peerStride;
+	uint64_t ringsOffset;
+	uint64_t ringStride;
+};
+
+// Слот пира. За ним следуют maxSubscriptions записей HandleRange.
+struct ShmPeerSlot
+{
+	std::atomic<uint32_t> state;
+	std::atomic<int32_t> pid;
+	std::atomic<uint64_t> generation;
+	std::atomic<uint64_t> heartbeat;
+
+	// процессы, пишущие сейчас в кольцо слота; кольцо пересоздаётся только
+	// после их ухода
+	std::atomic<uint32_t> senders;
+
+	// seqlock подписок: нечётное значение - идёт запись
+	std::atomic<uint64_t> subscriptionSeq;
+	std::atomic<uint32_t> subscriptionCount;
+
+	HandleRange *subscriptions()
+	{
+		return reinterpret_cast<HandleRange *>(
+					reinterpret_cast<char *>(this) + alignUp(sizeof(ShmPeerSlot)));
+	}
+};
+
+// Локальный подписчик, представляющий подписки другого процесса.
+// Сообщения пересылаются в кольцо пира.
+class ShmPeerProxy : public EventHandler
+{
+public:
+	ShmPeerProxy(ShmTransport *transport, int peerIndex, uint64_t generation,
+				 const std::vector<HandleRange> &subscriptions, bool forwarding)
+		: m_transport(transport), m_peerIndex(peerIndex), m_generation(generation),
+		  m_forwarding(forwarding), m_successor(nullptr), m_retired(false)
+	{
+		m_marker.commandID = NameRegistry::instance().intern("ShmPeerProxyMarker");
+		m_marker.messageParam = reinterpret_cast<unsigned long long>(this);
+		addHandle(m_marker);
+
+		for ( const HandleRange &range : subscriptions ) {
+			if ( range.paramFrom == range.paramTo ) {
+				addHandle({range.commandID, range.paramFrom});
+			}
+			else {
+				addHandleRange(range);
+			}
+		}
+	}
+
+	// Снимает прокси с маршрутизации. Сообщения, поставленные в очередь раньше,
+	// будут отправлены; после этого управление переходит к successor'у.
+	void retire(ShmPeerProxy *successor)
+	{
+		m_successor = successor;
+
+		std::unique_ptr<ConstData> cdata = std::make_unique<ConstData>();
+		cdata->handle = m_marker;
+		std::shared_ptr<MessageData> marker = std::make_shared<MessageData>(cdata);
+		AsyncOperProcessor &processor = AsyncOperProcessor::instance();
+
+		while ( ! processor.deregisterHandler(this, false, marker) ) {
+			// реактор уже остановлен (drainAndShutdown): маркер не дойдёт
+			if ( ! processor.isHandlerRouted(this) ) {
+				finishRetire();
+				return;
+			}
+			std::this_thread::yield();
+		}
+	}
+
+	bool isRetired() const
+	{
+		return m_retired;
+	}
+
+private:
+	ShmTransport *m_transport;
+	int m_peerIndex;
+	uint64_t m_generation;
+	Handle m_marker;
+
+	// false - сообщения ещё отправляет предшественник
+	std::atomic<bool> m_forwarding;
+	ShmPeerProxy *m_successor;
+	std::atomic<bool> m_retired;
+
+	// прежние сообщения отправлены - передаём управление successor'у
+	void finishRetire()
+	{
+		if ( nullptr != m_successor ) {
+			m_successor->m_forwarding = true;
+		}
+		m_retired = true;
+	}
+
+	void handleEvent(const std::shared_ptr<MessageData> &msg) override
+	{
+		if ( msg->getData()->handle == m_marker ) {
+			finishRetire();
+			return;
+		}
+
+		if ( ! m_forwarding || m_transport->getOriginTag() == msg->getOrigin() ) {
+			return;
+		}
+		m_transport->sendToPeer(m_peerIndex, m_generation, msg);
+	}
+};
+
+void ShmTransport::StopHandler::handleEvent(const std::shared_ptr<MessageData> &)
+{
+	AsyncOperProcessor::instance().shutdownReactorDispatcher();
+}
+
+ShmTransport::ShmTransport(const std::string &regionName,
+						   const ShmTransportConfig &config)
+	: m_regionName(shmName(regionName)), m_config(config),
+	  m_region(nullptr), m_regionSize(0), m_peerIndex(-1),
+	  m_running(false), m_dispatcherThreadID(0),
+	  m_stalled(false), m_stalledPos(0),
+	  m_sent(0), m_received(0), m_dropped(0)
+{
+	m_stopHandle.commandID = NameRegistry::instance().intern("ShmTransportStop");
+	m_stopHandle.messageParam = getOriginTag();
+}
+
+ShmTransport::~ShmTransport()
+{
+	stop();
+}
+
+bool ShmTransport::start()
+{
+	if ( m_running ) {
+		return true;
+	}
+
+	if ( ! mapRegion() ) {
+		return false;
+	}
+
+	if ( ! claimSlot() ) {
+		unmapRegion();
+		return false;
+	}
+	{
+		std::lock_guard<std::mutex> lk(m_subscriptionsMutex);
+		publishSubscriptions();
+	}
+
+	m_stopHandler = std::make_unique<StopHandler>(m_stopHandle);
+	std::promise<void> registered;
+	std::future<void> registeredFuture = registered.get_future();
+	m_dispatcherThread = std::thread(&ShmTransport::dispatcherLoop, this, &registered);
+	registeredFuture.wait();
+
+	m_running = true;
+	m_serviceThread = std::thread(&ShmTransport::serviceLoop, this);
+
+	return true;
+}
+
+void ShmTransport::stop()
+{
+	if ( ! m_running ) {
+		return;
+	}
+	m_running = false;
+	m_serviceThread.join();
+
+	for ( auto &peer : m_peers ) {
+		if ( nullptr != peer.second.proxy ) {
+			peer.second.proxy->retire(nullptr);
+			m_retiredProxies.push_back(peer.second.proxy);
+		}
+	}
+	m_peers.clear();
+
+	// маркеры прокси стоят в очереди раньше команды остановки
+	std::unique_ptr<ConstData> cdata = std::make_unique<ConstData>();
+	cdata->handle = m_stopHandle;
+	std::shared_ptr<MessageData> stopMsg = std::make_shared<MessageData>(cdata);
+
+	AsyncOperProcessor &processor = AsyncOperProcessor::instance();
+
+	while ( ! processor.postMessage(stopMsg) ) {
+		// реактор уже остановлен (drainAndShutdown), поток завершается сам
+		if ( ! processor.isAccepting() || ! processor.isHandlerRouted(m_stopHandler.get()) ) {
+			break;
+		}
+		std::this_thread::yield();
+	}
+	m_dispatcherThread.join();
+
+	reapRetiredProxies(true);
+	m_stopHandler.reset();
+
+	releaseSlot();
+	unmapRegion();
+}
+
+bool ShmTransport::subscribe(const Handle &handle)
+{
+	return subscribe(HandleRange{handle.commandID, handle.messageParam,
+								 handle.messageParam});
+}
+
+bool ShmTransport::subscribe(const HandleRange &range)
+{
+	std::lock_guard<std::mutex> lk(m_subscriptionsMutex);
+
+	for ( const HandleRange &sub : m_subscriptions ) {
+		if ( sub == range ) {
+			return true;
+		}
+	}
+
+	if ( m_subscriptions.size() >= m_config.maxSubscriptions ) {
+		return false;
+	}
+	m_subscriptions.push_back(range);
+
+	if ( -1 != m_peerIndex ) {
+		publishSubscriptions();
+	}
+
+	return true;
+}
+
+bool ShmTransport::unsubscribe(const HandleRange &range)
+{
+	std::lock_guard<std::mutex> lk(m_subscriptionsMutex);
+
+	for ( auto it = m_subscriptions.begin(); it != m_subscriptions.end(); ++it ) {
+		if ( *it == range ) {
+			m_subscriptions.erase(it);
+
+			if ( -1 != m_peerIndex ) {
+				publishSubscriptions();
+			}
+			return true;
+		}
+	}
+
+	return false;
+}
+
+std::vector<int> ShmTransport::getAlivePeers() const
+{
+	std::vector<int> result;
+
+	if ( nullptr == m_region ) {
+		return result;
+	}
+
+	for ( int i = 0; i < int(m_region->maxPeers); ++i ) {
+		ShmPeerSlot *slot = slotAt(i);
+
+		if ( SlotAlive == slot->state.load(std::memory_order_acquire) &&
+			 ! isPeerDead(slot) ) {
+			result.push_back(i);
+		}
+	}
+
+	return result;
+}
+
+bool ShmTransport::unlinkRegion(const std::string &regionName)
+{
+	return 0 == shm_unlink(shmName(regionName).c_str());
+}
+
+bool ShmTransport::mapRegion()
+{
+	if ( 0 == m_config.slotCount ||
+		 0 != (m_config.slotCount & (m_config.slotCount - 1)) ||
+		 0 == m_config.maxPeers ) {
+		return false;
+	}
+
+	size_t peerStride = alignUp(alignUp(sizeof(ShmPeerSlot)) +
+								m_config.maxSubscriptions * sizeof(HandleRange));
+	size_t ringsOffset = alignUp(sizeof(ShmRegion)) + m_config.maxPeers * peerStride;
+	size_t ringStride = alignUp(multithread::ByteRing::memorySize(
+									m_config.slotCount, m_config.slotSize));
+	m_regionSize = ringsOffset + m_config.maxPeers * ringStride;
+
+	bool creator = true;
+	int fd = shm_open(m_regionName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+
+	if ( -1 == fd && EEXIST == errno ) {
+		creator = false;
+		fd = shm_open(m_regionName.c_str(), O_RDWR, 0600);
+	}
+
+	if ( -1 == fd ) {
+		return false;
+	}
+
+	if ( creator ) {
+		if ( 0 != ftruncate(fd, off_t(m_regionSize)) ) {
+			close(fd);
+			shm_unlink(m_regionName.c_str());
+			return false;
+		}
+	}
+	else {
+		// создатель мог ещё не успеть задать размер
+		struct stat st;
+		auto deadline = std::chrono::steady_clock::now() + m_config.peerTimeout;
+
+		while ( 0 == fstat(fd, &st) && size_t(st.st_size) < m_regionSize ) {
+			if ( std::chrono::steady_clock::now() > deadline ) {
+				close(fd);
+				return false;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+
+	void *memory = mmap(nullptr, m_regionSize, PROT_READ | PROT_WRITE,
+						MAP_SHARED, fd, 0);
+	close(fd);
+
+	if ( MAP_FAILED == memory ) {
+		return false;
+	}
+	m_region = static_cast<ShmRegion *>(memory);
+
+	if ( creator ) {
+		m_region->maxPeers = m_config.maxPeers;
+		m_region->slotCount = m_config.slotCount;
+		m_region->slotSize = m_config.slotSize;
+		m_region->maxSubscriptions = m_config.maxSubscriptions;
+		m_region->peerStride = peerStride;
+		m_region->ringsOffset = ringsOffset;
+		m_region->ringStride = ringStride;
+
+		for ( int i = 0; i < int(m_config.maxPeers); ++i ) {
+			ShmPeerSlot *slot = slotAt(i);
+			slot->state.store(SlotFree, std::memory_order_relaxed);
+			slot->pid.store(0, std::memory_order_relaxed);
+			slot->generation.store(0, std::memory_order_relaxed);
+			slot->heartbeat.store(0, std::memory_order_relaxed);
+			slot->senders.store(0, std::memory_order_relaxed);
+			slot->subscriptionSeq.store(0, std::memory_order_relaxed);
+			slot->subscriptionCount.store(0, std::memory_order_relaxed);
+		}
+		m_region->magic.store(kRegionMagic, std::memory_order_release);
+
+		return true;
+	}
+
+	auto deadline = std::chrono::steady_clock::now() + m_config.peerTimeout;
+
+	while ( kRegionMagic != m_region->magic.load(std::memory_order_acquire) ) {
+		if ( std::chrono::steady_clock::now() > deadline ) {
+			unmapRegion();
+			return false;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	if ( m_region->maxPeers != m_config.maxPeers ||
+		 m_region->slotCount != m_config.slotCount ||
+		 m_region->slotSize != m_config.slotSize ||
+		 m_region->maxSubscriptions != m_config.maxSubscriptions ) {
+		unmapRegion();
+		return false;
+	}
+
+	return true;
+}
+
+void ShmTransport::unmapRegion()
+{
+	if ( nullptr != m_region ) {
+		munmap(m_region, m_regionSize);
+		m_region = nullptr;
+	}
+}
+
+bool ShmTransport::claimSlot()
+{
+	for ( int i = 0; i < int(m_region->maxPeers); ++i ) {
+		ShmPeerSlot *slot = slotAt(i);
+		uint32_t state = SlotFree;
+
+		// свободный слот либо слот мёртвого процесса
+		if ( ! slot->state.compare_exchange_strong(state, SlotClaiming) ) {
+			state = SlotAlive;
+
+			if ( ! isPeerDead(slot) ||
+				 ! slot->state.compare_exchange_strong(state, SlotClaiming) ) {
+				continue;
+			}
+		}
+
+		// Новые отправители видят SlotClaiming либо другое поколение и
+		// в кольцо не пишут; ждём тех, кто уже пишет в старое.
+		slot->generation.fetch_add(1);
+		auto deadline = std::chrono::steady_clock::now() + m_config.peerTimeout;
+
+		while ( 0 != slot->senders.load() ) {
+			// отправитель умер посреди записи
+			if ( std::chrono::steady_clock::now() > deadline ) {
+				slot->senders.store(0);
+				break;
+			}
+			std::this_thread::yield();
+		}
+
+		slot->pid.store(int32_t(getpid()), std::memory_order_relaxed);
+		slot->heartbeat.store(monotonicNow(), std::memory_order_relaxed);
+		slot->subscriptionCount.store(0, std::memory_order_relaxed);
+		multithread::ByteRing::create(ringAt(i), m_region->slotCount,
+									  m_region->slotSize);
+		slot->state.store(SlotAlive, std::memory_order_release);
+
+		m_peerIndex = i;
+		return true;
+	}
+
+	return false;
+}
+
+void ShmTransport::releaseSlot()
+{
+	if ( -1 == m_peerIndex ) {
+		return;
+	}
+	ShmPeerSlot *slot = slotAt(m_peerIndex);
+	slot->subscriptionCount.store(0, std::memory_order_relaxed);
+	slot->pid.store(0, std::memory_order_relaxed);
+	slot->state.store(SlotFree, std::memory_order_release);
+	m_peerIndex = -1;
+}
+
+ShmPeerSlot *ShmTransport::slotAt(int peerIndex) const
+{
+	char *base = reinterpret_cast<char *>(m_region) + alignUp(sizeof(ShmRegion));
+	return reinterpret_cast<ShmPeerSlot *>(base + peerIndex * m_region->peerStride);
+}
+
+multithread::ByteRing *ShmTransport::ringAt(int peerIndex) const
+{
+	char *base = reinterpret_cast<char *>(m_region) + m_region->ringsOffset;
+	return reinterpret_cast<multithread::ByteRing *>(
+				base + peerIndex * m_region->ringStride);
+}
+
+// вызывается под m_subscriptionsMutex (или до запуска потоков)
+void ShmTransport::publishSubscriptions()
+{
+	ShmPeerSlot *slot = slotAt(m_peerIndex);
+	uint64_t seq = slot->subscriptionSeq.load(std::memory_order_relaxed);
+
+	slot->subscriptionSeq.store(seq + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	std::memcpy(slot->subscriptions(), m_subscriptions.data(),
+				m_subscriptions.size() * sizeof(HandleRange));
+	slot->subscriptionCount.store(uint32_t(m_subscriptions.size()),
+								  std::memory_order_relaxed);
+
+	slot->subscriptionSeq.store(seq + 2, std::memory_order_release);
+}
+
+bool ShmTransport::readSubscriptions(ShmPeerSlot *slot, std::vector<HandleRange> &out,
+									 uint64_t &version) const
+{
+	for ( int attempt = 0; attempt < 100; ++attempt ) {
+		uint64_t before = slot->subscriptionSeq.load(std::memory_order_acquire);
+
+		if ( before & 1 ) {
+			std::this_thread::yield();
+			continue;
+		}
+		uint32_t count = std::min(slot->subscriptionCount.load(std::memory_order_relaxed),
+								  m_region->maxSubscriptions);
+		out.resize(count);
+		std::memcpy(out.data(), slot->subscriptions(), count * sizeof(HandleRange));
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		if ( slot->subscriptionSeq.load(std::memory_order_relaxed) == before ) {
+			version = before;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void ShmTransport::dispatcherLoop(std::promise<void> *registered)
+{
+	std::hash<std::thread::id> hasher;
+	m_dispatcherThreadID = hasher(std::this_thread::get_id());
+
+	AsyncOperProcessor::instance().registerHandler<Reactor>(m_stopHandler.get());
+	registered->set_value();
+
+	AsyncOperProcessor::StartReactorDispatcher dispatcher;
+}
+
+void ShmTransport::serviceLoop()
+{
+	auto lastHeartbeat = std::chrono::steady_clock::time_point();
+	unsigned int idle = 0;
+
+	while ( m_running ) {
+		if ( drainInbox() ) {
+			idle = 0;
+		}
+		else {
+			++ idle;
+		}
+
+		auto now = std::chrono::steady_clock::now();
+
+		if ( now - lastHeartbeat >= m_config.heartbeatInterval ) {
+			lastHeartbeat = now;
+			heartbeat();
+			scanPeers();
+			reapRetiredProxies(false);
+		}
+
+		// ожидание без системных вызовов, пока поток недавно был занят
+		if ( idle > 4096 ) {
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+		}
+		else if ( idle > 256 ) {
+			std::this_thread::yield();
+		}
+	}
+
+	drainInbox();
+}
+
+bool ShmTransport::drainInbox()
+{
+	multithread::ByteRing *ring = ringAt(m_peerIndex);
+	bool consumed = false;
+
+	for ( int i = 0; i < 256; ++i ) {
+		std::shared_ptr<MessageData> msg;
+
+		if ( ! ring->tryConsume([&msg](const char *data, size_t length) {
+					msg = MessageCodec::instance().decode(data, length);
+				}) ) {
+			if ( ! skipStalledSlot(ring) ) {
+				break;
+			}
+			consumed = true;
+			++ m_dropped;
+			continue;
+		}
+		m_stalled = false;
+		consumed = true;
+
+		if ( nullptr == msg ) {
+			++ m_dropped;
+			continue;
+		}
+		msg->setOrigin(getOriginTag());
+		++ m_received;
+		AsyncOperProcessor::instance().postMessage(msg);
+	}
+
+	return consumed;
+}
+
+bool ShmTransport::skipStalledSlot(multithread::ByteRing *ring)
+{
+	uint64_t pos;
+
+	if ( ! ring->isHeadClaimed(pos) ) {
+		m_stalled = false;
+		return false;
+	}
+	auto now = std::chrono::steady_clock::now();
+
+	if ( ! m_stalled || pos != m_stalledPos ) {
+		m_stalled = true;
+		m_stalledPos = pos;
+		m_stalledSince = now;
+		return false;
+	}
+
+	// живой отправитель публикует запись за микросекунды
+	if ( now - m_stalledSince < m_config.peerTimeout || ! ring->skipClaimed(pos) ) {
+		return false;
+	}
+	m_stalled = false;
+
+	return true;
+}
+
+void ShmTransport::heartbeat()
+{
+	slotAt(m_peerIndex)->heartbeat.store(monotonicNow(), std::memory_order_release);
+}
+
+bool ShmTransport::isPeerDead(ShmPeerSlot *slot) const
+{
+	pid_t pid = slot->pid.load(std::memory_order_relaxed);
+
+	if ( 0 >= pid || ( -1 == kill(pid, 0) && ESRCH == errno ) ) {
+		return true;
+	}
+
+	uint64_t last = slot->heartbeat.load(std::memory_order_acquire);
+	uint64_t timeout = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+									m_config.peerTimeout).count());
+	uint64_t now = monotonicNow();
+
+	return now > last && now - last > timeout;
+}
+
+void ShmTransport::scanPeers()
+{
+	std::vector<HandleRange> subscriptions;
+
+	for ( int i = 0; i < int(m_region->maxPeers); ++i ) {
+		if ( i == m_peerIndex ) {
+			continue;
+		}
+		ShmPeerSlot *slot = slotAt(i);
+		auto itPeer = m_peers.find(i);
+
+		if ( SlotAlive != slot->state.load(std::memory_order_acquire) ) {
+			if ( m_peers.end() != itPeer ) {
+				dropPeer(i, false);
+			}
+			continue;
+		}
+
+		if ( isPeerDead(slot) ) {
+			dropPeer(i, true);
+			continue;
+		}
+		uint64_t generation = slot->generation.load(std::memory_order_relaxed);
+
+		// слот занят новым процессом
+		if ( m_peers.end() != itPeer && itPeer->second.generation != generation ) {
+			dropPeer(i, false);
+			itPeer = m_peers.end();
+		}
+
+		if ( m_peers.end() == itPeer ) {
+			PeerState state;
+			state.pid = slot->pid.load(std::memory_order_relaxed);
+			state.generation = generation;
+			state.subscriptionVersion = ~0ULL;
+			itPeer = m_peers.emplace(i, state).first;
+		}
+		uint64_t version;
+
+		if ( readSubscriptions(slot, subscriptions, version) &&
+			 version != itPeer->second.subscriptionVersion ) {
+			itPeer->second.subscriptionVersion = version;
+			replaceProxy(i, itPeer->second, subscriptions);
+		}
+	}
+}
+
+void ShmTransport::dropPeer(int peerIndex, bool reclaim)
+{
+	auto itPeer = m_peers.find(peerIndex);
+	bool known = ( m_peers.end() != itPeer );
+
+	if ( known ) {
+		if ( nullptr != itPeer->second.proxy ) {
+			itPeer->second.proxy->retire(nullptr);
+			m_retiredProxies.push_back(itPeer->second.proxy);
+		}
+		m_peers.erase(itPeer);
+	}
+
+	if ( reclaim ) {
+		ShmPeerSlot *slot = slotAt(peerIndex);
+		uint32_t state = SlotAlive;
+
+		if ( slot->state.compare_exchange_strong(state, SlotClaiming) ) {
+			slot->subscriptionCount.store(0, std::memory_order_relaxed);
+			slot->pid.store(0, std::memory_order_relaxed);
+			slot->state.store(SlotFree, std::memory_order_release);
+		}
+	}
+
+	if ( known && m_peerDownCallback ) {
+		m_peerDownCallback(peerIndex);
+	}
+}
+
+void ShmTransport::replaceProxy(int peerIndex, PeerState &state,
+								const std::vector<HandleRange> &subscriptions)
+{
+	ShmPeerProxy *previous = state.proxy;
+	ShmPeerProxy *fresh = nullptr;
+
+	if ( ! subscriptions.empty() ) {
+		// пока предшественник не отправит уже поставленные в очередь сообщения,
+		// новый прокси их пропускает
+		fresh = new ShmPeerProxy(this, peerIndex, state.generation, subscriptions,
+								 nullptr == previous);
+
+		if ( ! AsyncOperProcessor::instance().registerHandler(fresh,
+														m_dispatcherThreadID) ) {
+			delete fresh;
+			return;
+		}
+	}
+
+	if ( nullptr != previous ) {
+		previous->retire(fresh);
+		m_retiredProxies.push_back(previous);
+	}
+	state.proxy = fresh;
+}
+
+void ShmTransport::reapRetiredProxies(bool force)
+{
+	for ( auto it = m_retiredProxies.begin(); it != m_retiredProxies.end(); ) {
+		if ( force || (*it)->isRetired() ) {
+			delete *it;
+			it = m_retiredProxies.erase(it);
+		}
+		else {
+			++ it;
+		}
+	}
+}
+
+bool ShmTransport::sendToPeer(int peerIndex, uint64_t generation,
+							  const std::shared_ptr<MessageData> &msg)
+{
+	thread_local std::string buffer;
+
+	if ( ! MessageCodec::instance().encode(*msg->getData(), buffer) ) {
+		++ m_dropped;
+		return false;
+	}
+	ShmPeerSlot *slot = slotAt(peerIndex);
+	bool sent = false;
+
+	// счётчик - до проверки состояния: claimSlot либо увидит его,
+	// либо мы увидим SlotClaiming/новое поколение
+	slot->senders.fetch_add(1);
+
+	if ( SlotAlive == slot->state.load() && generation == slot->generation.load() ) {
+		multithread::ByteRing *ring = ringAt(peerIndex);
+
+		for ( unsigned int attempt = 0; attempt <= m_config.fullRingRetries; ++attempt ) {
+			if ( ring->tryPush(buffer.data(), buffer.size()) ) {
+				sent = true;
+				break;
+			}
+
+			if ( buffer.size() > ring->slotSize() ) {
+				break;
+			}
+			std::this_thread::yield();
+		}
+	}
+	slot->senders.fetch_sub(1, std::memory_order_release);
+
+	if ( ! sent ) {
+		++ m_dropped;
+		return false;
+	}
+	++ m_sent;
+
+	return true;
+}
+
+} // namespace andre
@@ -0,0 +1,178 @@
+#include "SimExecutor.h"
+
+namespace andre
+{
+
+// Реактор без собственного цикла: события по одному забирает SimExecutor
+class SimReactor : public Reactor
+{
+public:
+	void handleEvents() override {}
+
+	bool runOne()
+	{
+		ReactorEvent re;
+
+		if ( m_exit || ! m_events.tryAndPop(re) ) {
+			return false;
+		}
+		dispatchEvent(re);
+
+		return true;
+	}
+};
+
+SimExecutor::SimExecutor(const SimExecutorConfig &config)
+	: m_config(config), m_random(config.seed), m_now(0),
+	  m_dispatched(0), m_timerSequence(0)
+{
+}
+
+SimExecutor::~SimExecutor()
+{
+	for ( const std::shared_ptr<SimReactor> &reactor : m_reactors ) {
+		AsyncOperProcessor::instance().detachReactor(threadKey(reactor));
+	}
+}
+
+size_t SimExecutor::addReactor()
+{
+	std::shared_ptr<SimReactor> reactor = std::make_shared<SimReactor>();
+
+	m_reactorIDs.push_back(AsyncOperProcessor::instance().attachReactor(reactor,
+																		threadKey(reactor)));
+	m_reactors.push_back(reactor);
+	m_reactorDispatched.push_back(0);
+
+	return m_reactors.size() - 1;
+}
+
+bool SimExecutor::registerHandler(size_t reactor, EventHandler *handler)
+{
+	if ( reactor >= m_reactors.size() ) {
+		return false;
+	}
+
+	return AsyncOperProcessor::instance().registerHandler(handler,
+														  threadKey(m_reactors[reactor]));
+}
+
+size_t SimExecutor::getReactorID(size_t reactor) const
+{
+	return m_reactorIDs.at(reactor);
+}
+
+void SimExecutor::schedule(std::chrono::nanoseconds delay, const std::function<void ()> &func)
+{
+	m_timers.push({m_now + delay, m_timerSequence ++, func});
+}
+
+void SimExecutor::postAfter(std::chrono::nanoseconds delay,
+							const std::shared_ptr<MessageData> &msg)
+{
+	schedule(delay, [msg]() {
+		AsyncOperProcessor::instance().postMessage(msg);
+	});
+}
+
+bool SimExecutor::step()
+{
+	if ( fireTimers() ) {
+		return true;
+	}
+	std::vector<size_t> runnable;
+
+	for ( size_t i = 0; i < m_reactors.size(); ++i ) {
+		if ( 0 != m_reactors[i]->getQueueSize() ) {
+			runnable.push_back(i);
+		}
+	}
+
+	if ( runnable.empty() ) {
+		if ( m_timers.empty() ) {
+			return false;
+		}
+		// событий нет - время перескакивает к ближайшему таймеру
+		m_now = m_timers.top().time;
+
+		return fireTimers();
+	}
+	std::uniform_int_distribution<size_t> distribution(0, runnable.size() - 1);
+	size_t chosen = runnable[distribution(m_random)];
+
+	if ( m_reactors[chosen]->runOne() ) {
+		++ m_dispatched;
+		++ m_reactorDispatched[chosen];
+	}
+	m_now += m_config.stepTime;
+
+	return true;
+}
+
+size_t SimExecutor::runUntilIdle(size_t maxSteps)
+{
+	size_t steps = 0;
+
+	while ( steps < maxSteps && step() ) {
+		++ steps;
+	}
+
+	return steps;
+}
+
+size_t SimExecutor::runFor(std::chrono::nanoseconds duration)
+{
+	std::chrono::nanoseconds until = m_now + duration;
+	size_t steps = 0;
+
+	while ( m_now < until ) {
+		bool hasEvents = false;
+
+		for ( const std::shared_ptr<SimReactor> &reactor : m_reactors ) {
+			if ( 0 != reactor->getQueueSize() ) {
+				hasEvents = true;
+				break;
+			}
+		}
+
+		// следующий таймер - позже срока: останавливаемся на сроке
+		if ( ! hasEvents && (m_timers.empty() || m_timers.top().time > until) ) {
+			m_now = until;
+			break;
+		}
+
+		if ( ! step() ) {
+			break;
+		}
+		++ steps;
+	}
+
+	return steps;
+}
+
+unsigned long long SimExecutor::getDispatchedCount(size_t reactor) const
+{
+	return m_reactorDispatched.at(reactor);
+}
+
+size_t SimExecutor::threadKey(const std::shared_ptr<SimReactor> &reactor)
+{
+	// адрес реактора; с хешем идентификатора потока совпадает лишь случайно
+	return reinterpret_cast<size_t>(reactor.get());
+}
+
+bool SimExecutor::fireTimers()
+{
+	bool fired = false;
+
+	while ( ! m_timers.empty() && m_timers.top().time <= m_now ) {
+		std::function<void ()> func = m_timers.top().func;
+		m_timers.pop();
+		func();
+		fired = true;
+	}
+
+	return fired;
+}
+
+} // namespace andre
@@ -0,0 +1,781 @@
+#include "SocketBridge.h"
+#include "AsyncOperProcessor.h"
+#include "MessageCodec.h"
+#include "NameRegistry.h"
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace andre
+{
+
+namespace
+{
+
+enum FrameType : uint8_t
+{
+	FrameMessage = 1,
+	FrameSubscribe = 2
+};
+
+const size_t kFrameHeaderSize = 5;
+
+// подписка: commandID, paramFrom, paramTo
+const size_t kSubscribeSize = 8 * 3;
+
+// максимальный размер кадра, больший считается повреждением потока
+const uint32_t kMaxFrameSize = 64 * 1024 * 1024;
+
+// числа в кадре - little-endian независимо от порядка байт узла
+void appendUint(std::string &out, uint64_t value, size_t size)
+{
+	for ( size_t i = 0; i < size; ++ i ) {
+		out.push_back(char(uint8_t(value >> (8 * i))));
+	}
+}
+
+uint64_t readUint(const char *data, size_t size)
+{
+	uint64_t value = 0;
+
+	for ( size_t i = size; i > 0; -- i ) {
+		value = (value << 8) | uint8_t(data[i - 1]);
+	}
+	return value;
+}
+
+std::string encodeSubscription(const HandleRange &range)
+{
+	std::string out;
+	appendUint(out, range.commandID, 8);
+	appendUint(out, range.paramFrom, 8);
+	appendUint(out, range.paramTo, 8);
+
+	return out;
+}
+
+HandleRange decodeSubscription(const char *data)
+{
+	return {readUint(data, 8), readUint(data + 8, 8), readUint(data + 16, 8)};
+}
+
+bool setNonBlocking(int fd)
+{
+	int flags = fcntl(fd, F_GETFL, 0);
+	return -1 != flags && 0 == fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// "tcp:host:port" -> host, port; "unix:/path" -> path
+bool parseAddress(const std::string &address, bool &isUnix,
+				  std::string &host, std::string &port)
+{
+	if ( 0 == address.compare(0, 5, "unix:") ) {
+		isUnix = true;
+		host = address.substr(5);
+		return !host.empty() && host.size() < sizeof(sockaddr_un::sun_path);
+	}
+
+	if ( 0 == address.compare(0, 4, "tcp:") ) {
+		isUnix = false;
+		size_t colon = address.rfind(':');
+
+		if ( colon <= 3 ) {
+			return false;
+		}
+		host = address.substr(4, colon - 4);
+		port = address.substr(colon + 1);
+		return !port.empty();
+	}
+
+	return false;
+}
+
+} // namespace
+
+// Соединение с другой стороной. Как EventHandler подписан на то, что
+// запросила другая сторона, и копит эти сообщения в исходящем буфере.
+class SocketBridge::Link : public EventHandler, public IoHandler
+{
+public:
+	Link(SocketBridge *bridge, int fd)
+		: m_bridge(bridge), m_fd(fd), m_outPos(0), m_writable(true), m_closed(false),
+		  m_markerQueued(false), m_retired(false)
+	{
+		m_marker.commandID = NameRegistry::instance().intern("SocketBridgeLinkMarker");
+		m_marker.messageParam = reinterpret_cast<unsigned long long>(this);
+		addHandle(m_marker);
+
+		// дескриптор соединения - в epoll своего IoReactor
+		setMigratable(false);
+	}
+
+	~Link() override
+	{
+		close(m_fd);
+	}
+
+	int getFd() const
+	{
+		return m_fd;
+	}
+
+	bool isRetired() const
+	{
+		return m_retired;
+	}
+
+	void sendFrame(uint8_t type, const char *data, size_t length)
+	{
+		if ( m_out.size() - m_outPos + length > m_bridge->m_config.maxPendingBytes ) {
+			++ m_bridge->m_dropped;
+			return;
+		}
+		appendUint(m_out, length, 4);
+		m_out.push_back(char(type));
+		m_out.append(data, length);
+	}
+
+	// false - соединение разорвано
+	bool flush()
+	{
+		while ( m_writable && m_outPos < m_out.size() ) {
+			ssize_t written = send(m_fd, m_out.data() + m_outPos,
+								   m_out.size() - m_outPos, MSG_NOSIGNAL);
+			++ m_bridge->m_writes;
+
+			if ( written > 0 ) {
+				m_outPos += size_t(written);
+				continue;
+			}
+
+			if ( written < 0 && (EAGAIN == errno || EWOULDBLOCK == errno) ) {
+				// допишем, когда сокет станет доступен для записи
+				m_writable = false;
+				IoReactor::current()->modify(m_fd, EPOLLIN | EPOLLOUT);
+				break;
+			}
+
+			if ( written < 0 && EINTR == errno ) {
+				continue;
+			}
+
+			return false;
+		}
+
+		if ( m_outPos == m_out.size() ) {
+			m_out.clear();
+			m_outPos = 0;
+		}
+
+		return true;
+	}
+
+	// Снимает соединение с маршрутов. Удалить его можно, когда до него дойдёт
+	// маркер, поставленный в очередь реактора после всех его сообщений.
+	void retire()
+	{
+		m_closed = true;
+		AsyncOperProcessor::instance().deregisterHandler(this);
+		queueMarker();
+	}
+
+	// false - очередь реактора полна, повторить позже (SocketBridge::reapLinks).
+	// Вызывается из потока моста - единственного читателя этой очереди,
+	// поэтому ждать в нём места нельзя.
+	bool queueMarker()
+	{
+		if ( m_markerQueued || m_retired ) {
+			return true;
+		}
+		IoReactor *reactor = IoReactor::current();
+
+		// реактор уже остановлен: сообщений для соединения больше не будет
+		if ( nullptr == reactor ) {
+			m_retired = true;
+			return true;
+		}
+		std::unique_ptr<ConstData> cdata = std::make_unique<ConstData>();
+		cdata->handle = m_marker;
+		m_markerQueued = reactor->addEvent(this, std::make_shared<MessageData>(cdata));
+
+		return m_markerQueued;
+	}
+
+private:
+	SocketBridge *m_bridge;
+	int m_fd;
+	Handle m_marker;
+
+	std::string m_out;
+	size_t m_outPos;
+	bool m_writable;
+
+	std::string m_in;
+	bool m_closed;			// снято с маршрутов, сообщения из очереди отбрасываются
+	bool m_markerQueued;
+	bool m_retired;
+
+	void handleEvent(const std::shared_ptr<MessageData> &msg) override
+	{
+		if ( msg->getData()->handle == m_marker ) {
+			m_retired = true;
+			return;
+		}
+
+		if ( m_closed ) {
+			++ m_bridge->m_dropped;
+			return;
+		}
+
+		// пришло из этого же моста - обратно не отправляем
+		if ( m_bridge->getOriginTag() == msg->getOrigin() ) {
+			return;
+		}
+		thread_local std::string buffer;
+
+		if ( ! MessageCodec::instance().encode(*msg->getData(), buffer) ) {
+			++ m_bridge->m_dropped;
+			return;
+		}
+		sendFrame(FrameMessage, buffer.data(), buffer.size());
+		++ m_bridge->m_sent;
+
+		if ( m_out.size() - m_outPos >= m_bridge->m_config.maxBatchBytes ) {
+			if ( ! flush() ) {
+				m_bridge->closeLink(this);
+			}
+		}
+		else {
+			m_bridge->armTimer();
+		}
+	}
+
+	void handleIoEvent(int, uint32_t events) override
+	{
+		if ( events & EPOLLOUT ) {
+			m_writable = true;
+			IoReactor::current()->modify(m_fd, EPOLLIN);
+
+			if ( ! flush() ) {
+				m_bridge->closeLink(this);
+				return;
+			}
+		}
+
+		if ( events & (EPOLLIN | EPOLLHUP | EPOLLERR) ) {
+			if ( ! receive() ) {
+				m_bridge->closeLink(this);
+			}
+		}
+	}
+
+	// false - соединение закрыто или поток повреждён
+	bool receive()
+	{
+		char chunk[64 * 1024];
+
+		for (;;) {
+			ssize_t count = recv(m_fd, chunk, sizeof(chunk), 0);
+
+			if ( count > 0 ) {
+				m_in.append(chunk, size_t(count));
+				continue;
+			}
+
+			if ( count < 0 && (EAGAIN == errno || EWOULDBLOCK == errno) ) {
+				break;
+			}
+
+			if ( count < 0 && EINTR == errno ) {
+				continue;
+			}
+			parseFrames();
+			return false;
+		}
+
+		return parseFrames();
+	}
+
+	bool parseFrames()
+	{
+		size_t pos = 0;
+
+		while ( m_in.size() - pos >= kFrameHeaderSize ) {
+			uint32_t length = uint32_t(readUint(m_in.data() + pos, 4));
+
+			if ( length > kMaxFrameSize ) {
+				return false;
+			}
+
+			if ( m_in.size() - pos < kFrameHeaderSize + length ) {
+				break;
+			}
+			uint8_t type = uint8_t(m_in[pos + 4]);
+			const char *payload = m_in.data() + pos + kFrameHeaderSize;
+			pos += kFrameHeaderSize + length;
+
+			if ( FrameMessage == type ) {
+				std::shared_ptr<MessageData> msg =
+						MessageCodec::instance().decode(payload, length);
+
+				if ( nullptr == msg ) {
+					++ m_bridge->m_dropped;
+					continue;
+				}
+				msg->setOrigin(m_bridge->getOriginTag());
+				++ m_bridge->m_received;
+				AsyncOperProcessor::instance().postMessage(msg);
+			}
+			else if ( FrameSubscribe == type && kSubscribeSize == length ) {
+				addSubscription(decodeSubscription(payload));
+			}
+		}
+		m_in.erase(0, pos);
+
+		return true;
+	}
+
+	void addSubscription(const HandleRange &range)
+	{
+		if ( range.paramFrom == range.paramTo ) {
+			addHandle({range.commandID, range.paramFrom});
+		}
+		else {
+			addHandleRange(range);
+		}
+		AsyncOperProcessor::instance().addHandlerRoute(this, range);
+	}
+};
+
+SocketBridge::Control::Control(SocketBridge *bridge) : m_bridge(bridge)
+{
+	addHandle(bridge->m_stopHandle);
+	addHandle(bridge->m_subscribeHandle);
+	setMigratable(false);
+}
+
+void SocketBridge::Control::handleEvent(const std::shared_ptr<MessageData> &msg)
+{
+	const Handle &handle = msg->getData()->handle;
+
+	if ( handle == m_bridge->m_subscribeHandle ) {
+		m_bridge->announceSubscriptions();
+		return;
+	}
+
+	if ( handle == m_bridge->m_stopHandle ) {
+		m_bridge->flushAll();
+
+		while ( ! m_bridge->m_links.empty() ) {
+			m_bridge->closeLink(m_bridge->m_links.begin()->second.get());
+		}
+		AsyncOperProcessor::instance().shutdownReactorDispatcher();
+	}
+}
+
+void SocketBridge::Control::handleIoEvent(int fd, uint32_t)
+{
+	if ( fd == m_bridge->m_timerFd ) {
+		uint64_t expirations;
+
+		if ( sizeof(expirations) != read(fd, &expirations, sizeof(expirations)) ) {
+			return;
+		}
+		m_bridge->m_timerArmed = false;
+		m_bridge->flushAll();
+		m_bridge->reapLinks();
+		return;
+	}
+
+	if ( fd == m_bridge->m_listenFd ) {
+		for (;;) {
+			int client = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+			if ( -1 == client ) {
+				break;
+			}
+			m_bridge->addLink(client);
+		}
+	}
+}
+
+SocketBridge::SocketBridge(const SocketBridgeConfig &config)
+	: m_config(config), m_running(false), m_listenFd(-1), m_timerFd(-1),
+	  m_timerArmed(false), m_announced(0), m_connections(0),
+	  m_sent(0), m_received(0), m_dropped(0), m_writes(0)
+{
+	m_stopHandle.commandID = NameRegistry::instance().intern("SocketBridgeStop");
+	m_stopHandle.messageParam = getOriginTag();
+	m_subscribeHandle.commandID = NameRegistry::instance().intern("SocketBridgeSubscribe");
+	m_subscribeHandle.messageParam = getOriginTag();
+}
+
+SocketBridge::~SocketBridge()
+{
+	stop();
+}
+
+bool SocketBridge::start()
+{
+	if ( m_running ) {
+		return true;
+	}
+	int fd = openSocket();
+
+	if ( -1 == fd ) {
+		return false;
+	}
+
+	if ( m_config.listen ) {
+		m_listenFd = fd;
+	}
+	m_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+	if ( -1 == m_timerFd ) {
+		closeSocket(fd);
+		return false;
+	}
+	m_control = std::make_unique<Control>(this);
+
+	std::promise<bool> started;
+	std::future<bool> startedFuture = started.get_future();
+	m_thread = std::thread(&SocketBridge::threadLoop, this, fd, &started);
+
+	// поток моста при неудаче сокет не закрывает
+	if ( ! startedFuture.get() ) {
+		m_thread.join();
+		m_control.reset();
+		closeSocket(fd);
+		close(m_timerFd);
+		m_timerFd = -1;
+		return false;
+	}
+	m_running = true;
+
+	return true;
+}
+
+void SocketBridge::closeSocket(int fd)
+{
+	close(fd);
+
+	if ( fd != m_listenFd ) {
+		return;
+	}
+	m_listenFd = -1;
+
+	bool isUnix;
+	std::string path, port;
+
+	if ( parseAddress(m_config.address, isUnix, path, port) && isUnix ) {
+		unlink(path.c_str());
+	}
+}
+
+void SocketBridge::stop()
+{
+	if ( ! m_running ) {
+		return;
+	}
+	m_running = false;
+
+	// false - реактор уже остановлен, поток моста завершается сам
+	postControl(m_stopHandle);
+	m_thread.join();
+
+	// реактор остановлен, маркеры соединений больше не нужны
+	m_retiredLinks.clear();
+	m_links.clear();
+	m_control.reset();
+
+	close(m_timerFd);
+	m_timerFd = -1;
+
+	if ( -1 != m_listenFd ) {
+		closeSocket(m_listenFd);
+	}
+}
+
+bool SocketBridge::subscribe(const Handle &handle)
+{
+	return subscribe(HandleRange{handle.commandID, handle.messageParam,
+								 handle.messageParam});
+}
+
+bool SocketBridge::subscribe(const HandleRange &range)
+{
+	{
+		std::lock_guard<std::mutex> lk(m_subscriptionsMutex);
+
+		for ( const HandleRange &sub : m_subscriptions ) {
+			if ( sub == range ) {
+				return true;
+			}
+		}
+		m_subscriptions.push_back(range);
+	}
+
+	if ( m_running ) {
+		postControl(m_subscribeHandle);
+	}
+
+	return true;
+}
+
+int SocketBridge::openSocket()
+{
+	bool isUnix;
+	std::string host, port;
+
+	if ( ! parseAddress(m_config.address, isUnix, host, port) ) {
+		return -1;
+	}
+	sockaddr_storage address;
+	socklen_t addressLength = 0;
+	int family;
+
+	if ( isUnix ) {
+		sockaddr_un *un = reinterpret_cast<sockaddr_un *>(&address);
+		std::memset(un, 0, sizeof(*un));
+		un->sun_family = AF_UNIX;
+		std::strncpy(un->sun_path, host.c_str(), sizeof(un->sun_path) - 1);
+		addressLength = sizeof(*un);
+		family = AF_UNIX;
+	}
+	else {
+		addrinfo hints = {};
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = m_config.listen ? AI_PASSIVE : 0;
+		addrinfo *result = nullptr;
+
+		if ( 0 != getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(),
+							  &hints, &result) || nullptr == result ) {
+			return -1;
+		}
+		std::memcpy(&address, result->ai_addr, result->ai_addrlen);
+		addressLength = result->ai_addrlen;
+		family = result->ai_family;
+		freeaddrinfo(result);
+	}
+
+	int fd = socket(family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+	if ( -1 == fd ) {
+		return -1;
+	}
+
+	if ( m_config.listen ) {
+		int one = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+		if ( isUnix ) {
+			unlink(host.c_str());
+		}
+
+		if ( 0 != bind(fd, reinterpret_cast<sockaddr *>(&address), addressLength) ||
+			 0 != ::listen(fd, 128) || ! setNonBlocking(fd) ) {
+			close(fd);
+			return -1;
+		}
+		return fd;
+	}
+
+	// другая сторона может ещё не слушать
+	auto deadline = std::chrono::steady_clock::now() + m_config.connectTimeout;
+
+	while ( 0 != connect(fd, reinterpret_cast<sockaddr *>(&address), addressLength) ) {
+		if ( std::chrono::steady_clock::now() > deadline ) {
+			close(fd);
+			return -1;
+		}
+		close(fd);
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		fd = socket(family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+		if ( -1 == fd ) {
+			return -1;
+		}
+	}
+
+	if ( ! setNonBlocking(fd) ) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+void SocketBridge::threadLoop(int fd, std::promise<bool> *started)
+{
+	AsyncOperProcessor::instance().registerHandler<IoReactor>(m_control.get());
+	IoReactor *reactor = IoReactor::current();
+
+	// реактор не создан или epoll не принял дескриптор
+	if ( nullptr == reactor || ! reactor->watch(m_timerFd, EPOLLIN, m_control.get()) ||
+		 (m_config.listen && ! reactor->watch(fd, EPOLLIN, m_control.get())) ) {
+		AsyncOperProcessor::instance().shutdownReactorDispatcher();
+		started->set_value(false);
+		return;
+	}
+
+	if ( ! m_config.listen ) {
+		addLink(fd);
+	}
+	started->set_value(true);
+
+	AsyncOperProcessor::StartReactorDispatcher dispatcher;
+}
+
+void SocketBridge::addLink(int fd)
+{
+	std::unique_ptr<Link> link = std::make_unique<Link>(this, fd);
+
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	AsyncOperProcessor::instance().registerHandler<IoReactor>(link.get());
+	bool watched = IoReactor::current()->watch(fd, EPOLLIN, link.get());
+
+	std::vector<HandleRange> subscriptions;
+	{
+		std::lock_guard<std::mutex> lk(m_subscriptionsMutex);
+		subscriptions = m_subscriptions;
+		m_announced = m_subscriptions.size();
+	}
+
+	for ( const HandleRange &range : subscriptions ) {
+		std::string frame = encodeSubscription(range);
+		link->sendFrame(FrameSubscribe, frame.data(), frame.size());
+	}
+	Link *raw = link.get();
+	m_links[fd] = std::move(link);
+	++ m_connections;
+
+	if ( ! watched || ! raw->flush() ) {
+		closeLink(raw);
+	}
+}
+
+void SocketBridge::closeLink(Link *link)
+{
+	auto it = m_links.find(link->getFd());
+
+	if ( m_links.end() == it ) {
+		return;
+	}
+	link->flush();
+	IoReactor::current()->unwatch(link->getFd());
+	shutdown(link->getFd(), SHUT_RDWR);
+
+	// удалим, когда маркер пройдёт через очередь
+	link->retire();
+	m_retiredLinks.push_back(std::move(it->second));
+	m_links.erase(it);
+	-- m_connections;
+	armTimer();
+}
+
+void SocketBridge::reapLinks()
+{
+	bool pending = false;
+
+	for ( auto it = m_retiredLinks.begin(); it != m_retiredLinks.end(); ) {
+		if ( (*it)->isRetired() ) {
+			it = m_retiredLinks.erase(it);
+			continue;
+		}
+
+		// очередь была полна - маркер ещё не поставлен
+		if ( ! (*it)->queueMarker() ) {
+			pending = true;
+		}
+		++ it;
+	}
+
+	if ( pending ) {
+		armTimer();
+	}
+}
+
+void SocketBridge::announceSubscriptions()
+{
+	std::vector<HandleRange> fresh;
+	{
+		std::lock_guard<std::mutex> lk(m_subscriptionsMutex);
+		fresh.assign(m_subscriptions.begin() + long(m_announced), m_subscriptions.end());
+		m_announced = m_subscriptions.size();
+	}
+
+	for ( const HandleRange &range : fresh ) {
+		std::string frame = encodeSubscription(range);
+
+		for ( auto &fd_Link : m_links ) {
+			fd_Link.second->sendFrame(FrameSubscribe, frame.data(), frame.size());
+		}
+	}
+	flushAll();
+}
+
+void SocketBridge::armTimer()
+{
+	if ( m_timerArmed ) {
+		return;
+	}
+	itimerspec spec = {};
+	auto delay = std::chrono::duration_cast<std::chrono::nanoseconds>(m_config.flushDelay);
+	spec.it_value.tv_sec = time_t(delay.count() / 1000000000);
+	spec.it_value.tv_nsec = long(delay.count() % 1000000000);
+
+	if ( 0 == spec.it_value.tv_sec && 0 == spec.it_value.tv_nsec ) {
+		spec.it_value.tv_nsec = 1;
+	}
+	timerfd_settime(m_timerFd, 0, &spec, nullptr);
+	m_timerArmed = true;
+}
+
+void SocketBridge::flushAll()
+{
+	std::vector<Link *> broken;
+
+	for ( auto &fd_Link : m_links ) {
+		if ( ! fd_Link.second->flush() ) {
+			broken.push_back(fd_Link.second.get());
+		}
+	}
+
+	for ( Link *link : broken ) {
+		closeLink(link);
+	}
+}
+
+bool SocketBridge::postControl(const Handle &handle)
+{
+	std::unique_ptr<ConstData> cdata = std::make_unique<ConstData>();
+	cdata->handle = handle;
+	std::shared_ptr<MessageData> msg = std::make_shared<MessageData>(cdata);
+	AsyncOperProcessor &processor = AsyncOperProcessor::instance();
+
+	while ( ! processor.postMessage(msg) ) {
+		// после drainAndShutdown сообщения не принимаются, реактор моста
+		// остановлен или вот-вот остановится сам
+		if ( ! processor.isAccepting() || ! processor.isHandlerRouted(m_control.get()) ) {
+			return false;
+		}
+		std::this_thread::yield();
+	}
+
+	return true;
+}
+
+} // namespace andre
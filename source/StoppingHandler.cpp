@@ -6,6 +6,7 @@ namespace andre
 StoppingHandler::StoppingHandler()
 {
 	addHandle(getHandle());
+	setMigratable(false);
 }
 
 } // namespace andre
@@ -0,0 +1,629 @@
+// Нагрузочная проверка ядра: поток сообщений на фоне регистрации и дерегистрации
+// обработчиков, ожиданий в waitInLoop и запуска/остановки реакторов.
+//
+// Сборка (из корня репозитория):
+//   g++ -std=c++17 -O2 -pthread -Iinclude -Imultithreading/include
+//       source/*.cpp stress/churn_stress.cpp -o churn_stress -lrt
+//
+// Параметры - --имя=значение, см. Config. Пример:
+//   ./churn_stress --seconds=30 --producers=4 --churners=4 --routes=1
+//
+// Проверяется: каждое сообщение постоянным обработчикам доставлено ровно
+// один раз и по порядку отправителя; после onDestroyable обработчик не получает
+// сообщений; дерегистрация завершается. Код возврата 0 - ошибок нет.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AsyncOperProcessor.h"
+#include "DeregisterableHandler.h"
+#include "DispatchReactorStoppable.h"
+#include "NameRegistry.h"
+#include "StoppingHandler.h"
+
+using namespace andre;
+
+namespace
+{
+
+struct Config
+{
+	unsigned int seconds = 10;
+	unsigned int reactors = 4;			// постоянные реакторы с получателями
+	unsigned int sinksPerReactor = 8;
+	unsigned int producers = 2;
+	unsigned int churners = 2;			// потоки регистрации/дерегистрации
+	unsigned int churnMessages = 16;	// сообщений временному обработчику
+	unsigned int waiters = 1;			// реакторы, ждущие ответа в waitInLoop
+	unsigned int restarters = 1;		// потоки запуска/остановки реакторов
+	unsigned int routes = 0;			// 1 - отправители используют Route
+};
+
+bool parseArgument(const char *argument, Config &config)
+{
+	struct Option
+	{
+		const char *name;
+		unsigned int *value;
+	};
+	const Option options[] = {
+		{"seconds", &config.seconds},
+		{"reactors", &config.reactors},
+		{"sinks", &config.sinksPerReactor},
+		{"producers", &config.producers},
+		{"churners", &config.churners},
+		{"churn-messages", &config.churnMessages},
+		{"waiters", &config.waiters},
+		{"restarters", &config.restarters},
+		{"routes", &config.routes},
+	};
+
+	for ( const Option &option : options ) {
+		std::string prefix = std::string("--") + option.name + "=";
+
+		if ( 0 == std::strncmp(argument, prefix.c_str(), prefix.size()) ) {
+			*option.value = static_cast<unsigned int>(std::strtoul(argument + prefix.size(),
+																   nullptr, 10));
+			return true;
+		}
+	}
+
+	return false;
+}
+
+unsigned long long nowNs()
+{
+	return static_cast<unsigned long long>(
+			std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+size_t currentThreadID()
+{
+	return std::hash<std::thread::id>()(std::this_thread::get_id());
+}
+
+// Задержки по степеням двойки наносекунд
+class LatencyHistogram
+{
+public:
+	LatencyHistogram()
+	{
+		for ( auto &bucket : m_buckets ) {
+			bucket = 0;
+		}
+	}
+
+	void add(unsigned long long ns)
+	{
+		size_t bucket = 0;
+
+		while ( bucket + 1 < m_buckets.size() && (1ULL << (bucket + 1)) <= ns ) {
+			++ bucket;
+		}
+		m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// верхняя граница корзины, в которую попал процентиль
+	unsigned long long percentileNs(double percentile) const
+	{
+		unsigned long long total = count();
+		unsigned long long seen = 0;
+
+		for ( size_t bucket = 0; bucket < m_buckets.size(); ++bucket ) {
+			seen += m_buckets[bucket];
+
+			if ( 0 != total && seen >= total * percentile ) {
+				return 1ULL << (bucket + 1);
+			}
+		}
+
+		return 0;
+	}
+
+	unsigned long long count() const
+	{
+		unsigned long long total = 0;
+
+		for ( const auto &bucket : m_buckets ) {
+			total += bucket;
+		}
+		return total;
+	}
+
+private:
+	std::array<std::atomic<unsigned long long>, 48> m_buckets;
+};
+
+struct StressMessage : ConstData
+{
+	unsigned int producer = 0;
+	unsigned long long sequence = 0;
+	unsigned long long sentNs = 0;
+};
+
+struct Totals
+{
+	std::atomic<unsigned long long> sent{0};
+	std::atomic<unsigned long long> delivered{0};
+	std::atomic<unsigned long long> lost{0};
+	std::atomic<unsigned long long> duplicated{0};
+	std::atomic<unsigned long long> retries{0};
+	std::atomic<unsigned long long> unrouted{0};
+
+	std::atomic<unsigned long long> churnCycles{0};
+	std::atomic<unsigned long long> churnDelivered{0};
+	std::atomic<unsigned long long> lateDeliveries{0};
+	std::atomic<unsigned long long> stuckDeregistrations{0};
+
+	std::atomic<unsigned long long> waits{0};
+	std::atomic<unsigned long long> failedWaits{0};
+	std::atomic<int> waitsInFlight{0};
+
+	std::atomic<unsigned long long> restarts{0};
+
+	LatencyHistogram latency;
+	LatencyHistogram waitLatency;
+};
+
+Totals totals;
+
+unsigned long long commandID(const char *name)
+{
+	return NameRegistry::instance().intern(name);
+}
+
+// Постоянный получатель: номер сообщения каждого отправителя должен расти на 1
+class Sink : public EventHandler
+{
+public:
+	Sink(unsigned long long key, unsigned int producers)
+		: m_lastSequence(producers, 0)
+	{
+		addHandle({commandID("stress_sink"), key});
+	}
+
+	// отправленные, но не дошедшие к концу проверки
+	unsigned long long countMissing(const std::vector<unsigned long long> &sent) const
+	{
+		unsigned long long missing = 0;
+
+		for ( size_t producer = 0; producer < sent.size(); ++producer ) {
+			if ( sent[producer] > m_lastSequence[producer] ) {
+				missing += sent[producer] - m_lastSequence[producer];
+			}
+		}
+		return missing;
+	}
+
+private:
+	std::vector<unsigned long long> m_lastSequence;
+
+	void handleEvent(const std::shared_ptr<MessageData> &msg) override
+	{
+		const StressMessage &message = static_cast<const StressMessage &>(*msg->getData());
+		unsigned long long &last = m_lastSequence[message.producer];
+
+		if ( message.sequence <= last ) {
+			++ totals.duplicated;
+			return;
+		}
+
+		if ( message.sequence > last + 1 ) {
+			totals.lost += message.sequence - last - 1;
+		}
+		last = message.sequence;
+		++ totals.delivered;
+		totals.latency.add(nowNs() - message.sentNs);
+	}
+};
+
+// Отвечает ожидающим: {stress_echo, id} -> {stress_reply, id}
+class Echo : public EventHandler
+{
+public:
+	Echo()
+	{
+		addWildcardHandle(commandID("stress_echo"));
+	}
+
+private:
+	void handleEvent(const std::shared_ptr<MessageData> &msg) override
+	{
+		std::unique_ptr<ConstData> reply = std::make_unique<ConstData>();
+		reply->handle = {commandID("stress_reply"), msg->getData()->handle.messageParam};
+		AsyncOperProcessor::instance().postMessage(std::make_shared<MessageData>(reply));
+	}
+};
+
+// По {stress_tick, id} отправляет запрос и ждёт ответ в waitInLoop
+class Waiter : public EventHandler
+{
+public:
+	explicit Waiter(unsigned long long id)
+		: m_replyHandle{commandID("stress_reply"), id}, m_busy(false)
+	{
+		addHandle({commandID("stress_tick"), id});
+		addHandle(m_replyHandle);
+	}
+
+	// следующий запрос - после ответа на предыдущий
+	bool tryStart()
+	{
+		bool expected = false;
+
+		if ( ! m_busy.compare_exchange_strong(expected, true) ) {
+			return false;
+		}
+		++ totals.waitsInFlight;
+		return true;
+	}
+
+private:
+	Handle m_replyHandle;
+	std::atomic<bool> m_busy;
+
+	void handleEvent(const std::shared_ptr<MessageData> &msg) override
+	{
+		if ( msg->getData()->handle == m_replyHandle ) {
+			return;
+		}
+		unsigned long long start = nowNs();
+		std::unique_ptr<ConstData> request = std::make_unique<ConstData>();
+		request->handle = {commandID("stress_echo"), m_replyHandle.messageParam};
+		AsyncOperProcessor::instance().postMessage(std::make_shared<MessageData>(request));
+
+		if ( nullptr != AsyncOperProcessor::instance().waitInLoop(this, m_replyHandle) ) {
+			++ totals.waits;
+			totals.waitLatency.add(nowNs() - start);
+		}
+		else {
+			++ totals.failedWaits;
+		}
+		m_busy = false;
+		-- totals.waitsInFlight;
+	}
+};
+
+// Временный обработчик на чужом реакторе
+class ChurnHandler : public DeregisterableHandler
+{
+public:
+	explicit ChurnHandler(unsigned long long key)
+		: m_destroyable(false)
+	{
+		addHandle({commandID("stress_churn"), key});
+	}
+
+	bool isDestroyable() const
+	{
+		return m_destroyable;
+	}
+
+private:
+	std::atomic<bool> m_destroyable;
+
+	void onHandleEvent(const std::shared_ptr<MessageData> &) override
+	{
+		if (m_destroyable) {
+			++ totals.lateDeliveries;
+		}
+		++ totals.churnDelivered;
+	}
+
+	void onDestroyable(const std::shared_ptr<MessageData> &) override
+	{
+		m_destroyable = true;
+	}
+};
+
+// Реактор, который останавливает сообщение {stress_stop, id}
+class Ephemeral : public EventHandler
+{
+public:
+	explicit Ephemeral(unsigned long long id)
+		: m_stopHandle{commandID("stress_stop"), id}
+	{
+		addHandle({commandID("stress_ephemeral"), id});
+		addHandle(m_stopHandle);
+	}
+
+private:
+	Handle m_stopHandle;
+
+	void handleEvent(const std::shared_ptr<MessageData> &msg) override
+	{
+		if ( msg->getData()->handle == m_stopHandle ) {
+			AsyncOperProcessor::instance().shutdownReactorDispatcher();
+		}
+	}
+};
+
+void postSimple(const Handle &handle)
+{
+	std::unique_ptr<ConstData> data = std::make_unique<ConstData>();
+	data->handle = handle;
+	AsyncOperProcessor::instance().postMessage(std::make_shared<MessageData>(data));
+}
+
+void runProducer(unsigned int producer, const Config &config, size_t sinkCount,
+				 std::vector<unsigned long long> &sent, const std::atomic<bool> &running)
+{
+	AsyncOperProcessor &processor = AsyncOperProcessor::instance();
+	std::mt19937_64 random(producer + 1);
+	std::vector<Route> routes;
+
+	for ( size_t sink = 0; sink < sinkCount; ++sink ) {
+		routes.emplace_back(Handle{commandID("stress_sink"), sink});
+	}
+	std::map< unsigned long long, std::set<EventHandler *> > overflows;
+
+	while (running) {
+		size_t sink = random() % sinkCount;
+		std::unique_ptr<StressMessage> message = std::make_unique<StressMessage>();
+		message->handle = {commandID("stress_sink"), sink};
+		message->producer = producer;
+		message->sequence = sent[sink] + 1;
+		message->sentNs = nowNs();
+		std::unique_ptr<ConstData> data(std::move(message));
+		std::shared_ptr<MessageData> msg = std::make_shared<MessageData>(data);
+
+		for (;;) {
+			overflows.clear();
+			bool routed = ( 0 != config.routes ) ? processor.postMessage(routes[sink], msg, &overflows)
+												 : processor.postMessage(msg, &overflows);
+			if ( ! routed ) {
+				++ totals.unrouted;
+				break;
+			}
+
+			if ( overflows.empty() ) {
+				++ sent[sink];
+				++ totals.sent;
+				break;
+			}
+			// очередь получателя полна - сообщение не поставлено
+			++ totals.retries;
+			std::this_thread::yield();
+		}
+	}
+}
+
+void runChurner(unsigned int churner, const Config &config,
+				const std::vector<size_t> &reactorThreads, const std::atomic<bool> &running)
+{
+	AsyncOperProcessor &processor = AsyncOperProcessor::instance();
+	std::mt19937_64 random(1000 + churner);
+	unsigned long long key = static_cast<unsigned long long>(churner) << 32;
+
+	while (running) {
+		std::unique_ptr<ChurnHandler> handler(new ChurnHandler(++ key));
+		size_t threadID = reactorThreads[random() % reactorThreads.size()];
+
+		if ( ! processor.registerHandler(handler.get(), threadID) ) {
+			continue;
+		}
+
+		for ( unsigned int i = 0; i < config.churnMessages; ++i ) {
+			postSimple({commandID("stress_churn"), key});
+		}
+
+		if ( 0 == random() % 2 ) {
+			handler->deregister();
+		}
+		else {
+			handler->deregisterBlocking();
+		}
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+
+		while ( ! handler->isDestroyable() && std::chrono::steady_clock::now() < deadline ) {
+			std::this_thread::yield();
+		}
+
+		if ( ! handler->isDestroyable() ) {
+			// обработчик мог остаться в очереди реактора - не освобождаем
+			++ totals.stuckDeregistrations;
+			handler.release();
+			continue;
+		}
+		++ totals.churnCycles;
+	}
+}
+
+void runRestarter(unsigned int restarter, const std::atomic<bool> &running)
+{
+	unsigned long long id = static_cast<unsigned long long>(restarter) << 32;
+
+	while (running) {
+		++ id;
+		Ephemeral handler(id);
+		std::atomic<bool> registered(false);
+
+		std::thread reactor([&handler, &registered]() {
+			AsyncOperProcessor::instance().registerHandler<DispatchReactorStoppable>(&handler);
+			registered = true;
+			AsyncOperProcessor::StartReactorDispatcher();
+		});
+
+		while ( ! registered ) {
+			std::this_thread::yield();
+		}
+
+		for ( int i = 0; i < 100; ++i ) {
+			postSimple({commandID("stress_ephemeral"), id});
+		}
+		postSimple({commandID("stress_stop"), id});
+		reactor.join();
+		++ totals.restarts;
+	}
+}
+
+void runTicker(const std::vector< std::unique_ptr<Waiter> > &waiters,
+			   const std::atomic<bool> &running)
+{
+	while (running) {
+		for ( size_t waiter = 0; waiter < waiters.size(); ++waiter ) {
+			if ( waiters[waiter]->tryStart() ) {
+				postSimple({commandID("stress_tick"), waiter});
+			}
+		}
+		std::this_thread::sleep_for(std::chrono::microseconds(200));
+	}
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+	Config config;
+
+	for ( int i = 1; i < argc; ++i ) {
+		if ( ! parseArgument(argv[i], config) ) {
+			std::fprintf(stderr, "unknown option %s\n", argv[i]);
+			return 2;
+		}
+	}
+	config.reactors = std::max(1u, config.reactors);
+	config.sinksPerReactor = std::max(1u, config.sinksPerReactor);
+	config.producers = std::max(1u, config.producers);
+
+	AsyncOperProcessor &processor = AsyncOperProcessor::instance();
+	size_t sinkCount = config.reactors * config.sinksPerReactor;
+	std::vector< std::unique_ptr<Sink> > sinks;
+
+	for ( size_t sink = 0; sink < sinkCount; ++sink ) {
+		sinks.emplace_back(new Sink(sink, config.producers));
+	}
+	Echo echo;
+	std::vector<std::unique_ptr<Waiter>> waiters;
+
+	for ( unsigned int waiter = 0; waiter < config.waiters; ++waiter ) {
+		waiters.emplace_back(new Waiter(waiter));
+	}
+
+	// постоянные реакторы и реакторы ожидающих
+	std::vector<size_t> reactorThreads(config.reactors);
+	std::atomic<unsigned int> started(0);
+	std::vector<std::thread> reactors;
+
+	for ( unsigned int reactor = 0; reactor < config.reactors; ++reactor ) {
+		reactors.emplace_back([&, reactor]() {
+			for ( size_t sink = reactor; sink < sinkCount; sink += config.reactors ) {
+				processor.registerHandler<DispatchReactorStoppable>(sinks[sink].get());
+			}
+
+			if ( 0 == reactor ) {
+				processor.registerHandler<DispatchReactorStoppable>(&echo);
+			}
+			reactorThreads[reactor] = currentThreadID();
+			++ started;
+			AsyncOperProcessor::StartReactorDispatcher();
+		});
+	}
+
+	for ( unsigned int waiter = 0; waiter < config.waiters; ++waiter ) {
+		reactors.emplace_back([&, waiter]() {
+			processor.registerHandler<DispatchReactorStoppable>(waiters[waiter].get());
+			++ started;
+			AsyncOperProcessor::StartReactorDispatcher();
+		});
+	}
+
+	while ( started < config.reactors + config.waiters ) {
+		std::this_thread::yield();
+	}
+
+	std::atomic<bool> producing(true);
+	std::atomic<bool> churning(true);
+	std::vector<std::thread> workers;
+	std::vector< std::vector<unsigned long long> > sent(config.producers,
+														std::vector<unsigned long long>(sinkCount, 0));
+	auto start = std::chrono::steady_clock::now();
+
+	for ( unsigned int producer = 0; producer < config.producers; ++producer ) {
+		workers.emplace_back(runProducer, producer, std::cref(config), sinkCount,
+							 std::ref(sent[producer]), std::cref(producing));
+	}
+
+	for ( unsigned int churner = 0; churner < config.churners; ++churner ) {
+		workers.emplace_back(runChurner, churner, std::cref(config),
+							 std::cref(reactorThreads), std::cref(churning));
+	}
+
+	for ( unsigned int restarter = 0; restarter < config.restarters; ++restarter ) {
+		workers.emplace_back(runRestarter, restarter, std::cref(churning));
+	}
+
+	if ( 0 != config.waiters ) {
+		workers.emplace_back(runTicker, std::cref(waiters), std::cref(churning));
+	}
+
+	std::this_thread::sleep_for(std::chrono::seconds(config.seconds));
+	churning = false;
+	producing = false;
+
+	for ( std::thread &worker : workers ) {
+		worker.join();
+	}
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	// дожидаемся отправленного и ответов ожидающим
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+
+	while ( ( totals.delivered + totals.lost < totals.sent || 0 != totals.waitsInFlight ) &&
+			std::chrono::steady_clock::now() < deadline ) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	unsigned long long missing = 0;
+
+	for ( size_t sink = 0; sink < sinkCount; ++sink ) {
+		std::vector<unsigned long long> sentToSink(config.producers);
+
+		for ( unsigned int producer = 0; producer < config.producers; ++producer ) {
+			sentToSink[producer] = sent[producer][sink];
+		}
+		missing += sinks[sink]->countMissing(sentToSink);
+	}
+
+	StoppingHandler::postStoppingMessage();
+
+	for ( std::thread &reactor : reactors ) {
+		reactor.join();
+	}
+
+	std::printf("duration           %.2f s\n", elapsed);
+	std::printf("sent               %llu (%.0f msg/s), retries on full queue %llu\n",
+				totals.sent.load(), totals.sent / elapsed, totals.retries.load());
+	std::printf("delivered          %llu, latency p50 <%llu us, p99 <%llu us, p99.9 <%llu us\n",
+				totals.delivered.load(), totals.latency.percentileNs(0.5) / 1000,
+				totals.latency.percentileNs(0.99) / 1000, totals.latency.percentileNs(0.999) / 1000);
+	std::printf("churn cycles       %llu (%.0f /s), churn messages delivered %llu\n",
+				totals.churnCycles.load(), totals.churnCycles / elapsed, totals.churnDelivered.load());
+	std::printf("reactor restarts   %llu\n", totals.restarts.load());
+	std::printf("waitInLoop         %llu, p99 <%llu us\n",
+				totals.waits.load(), totals.waitLatency.percentileNs(0.99) / 1000);
+
+	unsigned long long errors = totals.lost + missing + totals.duplicated + totals.unrouted +
+								totals.lateDeliveries + totals.stuckDeregistrations +
+								totals.failedWaits;
+
+	std::printf("errors             %llu: lost %llu, missing %llu, duplicated %llu, unrouted %llu,\n"
+				"                   late %llu, stuck deregistrations %llu, failed waits %llu\n",
+				errors, totals.lost.load(), missing, totals.duplicated.load(),
+				totals.unrouted.load(), totals.lateDeliveries.load(),
+				totals.stuckDeregistrations.load(), totals.failedWaits.load());
+
+	return 0 == errors ? 0 : 1;
+}